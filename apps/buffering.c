@@ -670,7 +670,6 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
         size_t widx = h->widx;
         ssize_t copy_n = h->filesize - h->end;
         copy_n = MIN(copy_n, BUFFERING_DEFAULT_FILECHUNK);
-        copy_n = MIN(copy_n, (off_t)(buffer_len - widx));
 
         mutex_lock(&llist_mutex);
 
@@ -690,8 +689,15 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
         if (copy_n <= 0)
             return false; /* no space for read */
 
-        /* rc is the actual amount read */
-        ssize_t rc = read(h->fd, ringbuf_ptr(widx), copy_n);
+        /* rc is the actual amount read; a chunk that runs past the end of
+           the buffer is read in the same call as its wrapped remainder */
+        struct iovec iov[2];
+        iov[0].iov_base = ringbuf_ptr(widx);
+        iov[0].iov_len  = MIN((size_t)copy_n, buffer_len - widx);
+        iov[1].iov_base = ringbuf_ptr(0);
+        iov[1].iov_len  = copy_n - iov[0].iov_len;
+
+        ssize_t rc = readv(h->fd, iov, iov[1].iov_len ? 2 : 1);
 
         if (rc <= 0) {
             /* Some kind of filesystem error, maybe recoverable if not codec */
@@ -870,7 +876,11 @@ static int load_image(int fd, const char *path,
     if (aa != NULL) {
         lseek(fd, aa->pos, SEEK_SET);
         rc = clip_jpeg_fd(fd, aa->size, bmp, (int)max_size, format, NULL);
+        if (rc > 0 && data->thumb_path)
+            albumart_thumb_write(data->thumb_path, bmp);
     }
+    else if (!strcmp(path + strlen(path) - 4, ALBUMART_THUMB_EXT))
+        rc = albumart_thumb_read(fd, bmp, (int)max_size);
     else if (strcmp(path + strlen(path) - 4, ".bmp"))
         rc = read_jpeg_fd(fd, bmp, (int)max_size, format, NULL);
     else
@@ -38,10 +38,44 @@
 #include "plugin.h"
 #include "playback.h"
 #include "cuesheet.h"
+#include "crc32.h"
+#include "dir.h"
 #include "gui/wps.h"
 
 #define CUE_DIR ROCKBOX_DIR "/cue"
 
+/*
+ * Parsed cuesheets are cached in CUE_DIR/.cache, one file per cuesheet
+ * named after the crc of its path. The cache is only trusted while the
+ * cuesheet's path, size, mtime, (for embedded cuesheets) position and the
+ * codepage it was decoded with match.
+ * After the header come the FILE, TITLE, PERFORMER and SONGWRITER strings,
+ * then for each track its offset followed by its own three strings. Strings
+ * are NUL-terminated and a track's performer and songwriter are left empty
+ * when they are the cuesheet's.
+ */
+#define CUE_CACHE_DIR   CUE_DIR "/.cache"
+#define CUE_CACHE_MAGIC 0x43554302 /* "CUC" + version */
+
+struct cue_cache_header
+{
+    uint32_t magic;         /* CUE_CACHE_MAGIC */
+    uint32_t name_crc;      /* crc_32 of the cuesheet path */
+    uint32_t size;          /* size of the cuesheet file */
+    uint32_t mtime;         /* mtime of the cuesheet file */
+    uint32_t pos;           /* position of an embedded cuesheet */
+    uint32_t codepage;      /* codepage for sheets without a BOM */
+    uint32_t track_count;
+};
+
+/* buffered access to a cache file */
+struct cue_cache_io
+{
+    int fd;
+    int pos, len;
+    char buf[256];
+};
+
 static bool search_for_cuesheet(const char *path, struct cuesheet_file *cue_file)
 {
     size_t len;
@@ -198,6 +232,233 @@ static enum eCS_SUPPORTED_TAGS cuesheet_tag_get_option(const char *option)
 #undef CS_OPTN
 }
 
+/* If some songs don't have performer info, we copy the cuesheet performer */
+static void cue_fill_defaults(struct cuesheet *cue)
+{
+    int i;
+    for (i = 0; i < cue->track_count; i++)
+    {
+        if (*(cue->tracks[i].performer) == '\0')
+            strmemccpy(cue->tracks[i].performer, cue->performer, MAX_NAME*3);
+
+        if (*(cue->tracks[i].songwriter) == '\0')
+            strmemccpy(cue->tracks[i].songwriter, cue->songwriter, MAX_NAME*3);
+    }
+}
+
+static void cue_cache_path(char *buf, size_t bufsize, uint32_t name_crc)
+{
+    snprintf(buf, bufsize, CUE_CACHE_DIR "/%08lx.cuc", (unsigned long)name_crc);
+}
+
+/*
+ * Get the identity of the cuesheet file that a cache must match. Sheets
+ * without a BOM are decoded using the current codepage, so that is part of
+ * it too.
+ */
+static bool cue_cache_get_header(const struct cuesheet_file *cue_file, int fd,
+                                 struct cue_cache_header *hdr)
+{
+    time_t mtime;
+
+    if (!file_get_mtime(cue_file->path, &mtime))
+        return false;
+
+    hdr->magic = CUE_CACHE_MAGIC;
+    hdr->name_crc = crc_32(cue_file->path, strlen(cue_file->path), -1);
+    hdr->size = filesize(fd);
+    hdr->mtime = mtime;
+    hdr->pos = cue_file->pos;
+    hdr->codepage = get_codepage();
+    return true;
+}
+
+/* read a string of at most size-1 characters, skipping any excess */
+static bool cue_cache_read_string(struct cue_cache_io *io, char *dst,
+                                  size_t size)
+{
+    size_t n = 0;
+
+    while (1)
+    {
+        if (io->pos >= io->len)
+        {
+            io->len = read(io->fd, io->buf, sizeof (io->buf));
+            io->pos = 0;
+            if (io->len <= 0)
+                return false;
+        }
+
+        char c = io->buf[io->pos++];
+        if (n < size - 1)
+            dst[n++] = c;
+        if (c == '\0')
+            break;
+    }
+
+    dst[n] = '\0';
+    return true;
+}
+
+static bool cue_cache_read(struct cue_cache_io *io, void *dst, size_t size)
+{
+    unsigned char *p = dst;
+
+    while (size > 0)
+    {
+        if (io->pos >= io->len)
+        {
+            io->len = read(io->fd, io->buf, sizeof (io->buf));
+            io->pos = 0;
+            if (io->len <= 0)
+                return false;
+        }
+
+        size_t n = MIN(size, (size_t)(io->len - io->pos));
+        memcpy(p, io->buf + io->pos, n);
+        io->pos += n;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/*
+ * Fill "cue" from the cache saved by the last parse of this cuesheet;
+ * returns false if there is none or it is stale.
+ */
+static bool cue_cache_load(const struct cue_cache_header *hdr,
+                           const char *cuepath, struct cuesheet *cue)
+{
+    char path[MAX_PATH];
+    struct cue_cache_header saved;
+    struct cue_cache_io io = { .pos = 0, .len = 0 };
+    bool loaded = false;
+
+    cue_cache_path(path, sizeof (path), hdr->name_crc);
+    io.fd = open(path, O_RDONLY);
+    if (io.fd < 0)
+        return false;
+
+    if (!cue_cache_read(&io, &saved, sizeof (saved)) ||
+        saved.magic != hdr->magic || saved.name_crc != hdr->name_crc ||
+        saved.size != hdr->size || saved.mtime != hdr->mtime ||
+        saved.pos != hdr->pos || saved.codepage != hdr->codepage ||
+        saved.track_count > MAX_TRACKS)
+        goto out;
+
+    memset(cue, 0, sizeof (struct cuesheet));
+    strcpy(cue->path, cuepath);
+    cue->curr_track = cue->tracks;
+
+    if (!cue_cache_read_string(&io, cue->file, sizeof (cue->file)) ||
+        !cue_cache_read_string(&io, cue->title, sizeof (cue->title)) ||
+        !cue_cache_read_string(&io, cue->performer, sizeof (cue->performer)) ||
+        !cue_cache_read_string(&io, cue->songwriter, sizeof (cue->songwriter)))
+        goto out;
+
+    for (uint32_t i = 0; i < saved.track_count; i++)
+    {
+        struct cue_track_info *track = &cue->tracks[i];
+        uint32_t offset;
+
+        if (!cue_cache_read(&io, &offset, sizeof (offset)) ||
+            !cue_cache_read_string(&io, track->title, sizeof (track->title)) ||
+            !cue_cache_read_string(&io, track->performer,
+                                   sizeof (track->performer)) ||
+            !cue_cache_read_string(&io, track->songwriter,
+                                   sizeof (track->songwriter)))
+            goto out;
+
+        track->offset = offset;
+    }
+
+    cue->track_count = saved.track_count;
+    cue_fill_defaults(cue);
+    loaded = true;
+out:
+    close(io.fd);
+    return loaded;
+}
+
+static bool cue_cache_write(struct cue_cache_io *io, const void *src,
+                            size_t size)
+{
+    const unsigned char *p = src;
+
+    while (size > 0)
+    {
+        if (io->pos >= (int)sizeof (io->buf))
+        {
+            if (write(io->fd, io->buf, io->pos) != io->pos)
+                return false;
+            io->pos = 0;
+        }
+
+        size_t n = MIN(size, sizeof (io->buf) - io->pos);
+        memcpy(io->buf + io->pos, p, n);
+        io->pos += n;
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool cue_cache_write_string(struct cue_cache_io *io, const char *str)
+{
+    return cue_cache_write(io, str, strlen(str) + 1);
+}
+
+/* save a freshly parsed cuesheet, before the track defaults are filled in */
+static void cue_cache_save(struct cue_cache_header *hdr,
+                           const struct cuesheet *cue)
+{
+    char path[MAX_PATH];
+    struct cue_cache_io io = { .pos = 0 };
+    bool ok = true;
+
+    cue_cache_path(path, sizeof (path), hdr->name_crc);
+    io.fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (io.fd < 0)
+    {
+        /* the directory is made on first use */
+        mkdir(CUE_DIR);
+        mkdir(CUE_CACHE_DIR);
+        io.fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        if (io.fd < 0)
+            return;
+    }
+
+    hdr->track_count = cue->track_count;
+    ok = cue_cache_write(&io, hdr, sizeof (*hdr)) &&
+         cue_cache_write_string(&io, cue->file) &&
+         cue_cache_write_string(&io, cue->title) &&
+         cue_cache_write_string(&io, cue->performer) &&
+         cue_cache_write_string(&io, cue->songwriter);
+
+    for (int i = 0; ok && i < cue->track_count; i++)
+    {
+        const struct cue_track_info *track = &cue->tracks[i];
+        uint32_t offset = track->offset;
+
+        ok = cue_cache_write(&io, &offset, sizeof (offset)) &&
+             cue_cache_write_string(&io, track->title) &&
+             cue_cache_write_string(&io, track->performer) &&
+             cue_cache_write_string(&io, track->songwriter);
+    }
+
+    if (ok && io.pos > 0)
+        ok = write(io.fd, io.buf, io.pos) == io.pos;
+
+    close(io.fd);
+
+    /* don't leave a partial cache behind */
+    if (!ok)
+        remove(path);
+}
+
 /* parse cuesheet "cue_file" and store the information in "cue" */
 bool parse_cuesheet(struct cuesheet_file *cue_file, struct cuesheet *cue)
 {
@@ -213,6 +474,15 @@ bool parse_cuesheet(struct cuesheet_file *cue_file, struct cuesheet *cue)
     int fd = open(cue_file->path, O_RDONLY, 0644);
     if(fd < 0)
         return false;
+
+    struct cue_cache_header hdr;
+    bool cacheable = cue_cache_get_header(cue_file, fd, &hdr);
+    if (cacheable && cue_cache_load(&hdr, cue_file->path, cue))
+    {
+        close(fd);
+        return true;
+    }
+
     if (cue_file->pos > 0)
     {
         is_embedded = true;
@@ -389,17 +659,10 @@ bool parse_cuesheet(struct cuesheet_file *cue_file, struct cuesheet *cue)
         strmemccpy(slash, line, MAX_PATH - (slash - cue->file));
     }
 
-    /* If some songs don't have performer info, we copy the cuesheet performer */
-    int i;
-    for (i = 0; i < cue->track_count; i++)
-    {
-        if (*(cue->tracks[i].performer) == '\0')
-            strmemccpy(cue->tracks[i].performer, cue->performer, MAX_NAME*3);
-
-        if (*(cue->tracks[i].songwriter) == '\0')
-            strmemccpy(cue->tracks[i].songwriter, cue->songwriter, MAX_NAME*3);
-    }
+    if (cacheable)
+        cue_cache_save(&hdr, cue);
 
+    cue_fill_defaults(cue);
     return true;
 }
 
@@ -423,9 +686,16 @@ static bool seek(unsigned long pos)
    and updates the information about the current track. */
 int cue_find_current_track(struct cuesheet *cue, unsigned long curpos)
 {
-    int i=0;
-    while (i < cue->track_count-1 && cue->tracks[i+1].offset < curpos)
-        i++;
+    /* the last track starting before curpos; tracks are in time order */
+    int i = 0, hi = cue->track_count - 1;
+    while (i < hi)
+    {
+        int mid = (i + hi + 1) / 2;
+        if (cue->tracks[mid].offset < curpos)
+            i = mid;
+        else
+            hi = mid - 1;
+    }
 
     cue->curr_track_idx = i;
     cue->curr_track = cue->tracks + i;
@@ -56,6 +56,7 @@
 #include "logf.h"
 #if (CONFIG_PLATFORM & PLATFORM_NATIVE)
 #include "disk.h"
+#include "disk_cache.h"
 #include "adc.h"
 #include "usb.h"
 #include "rtc.h"
@@ -1788,6 +1789,40 @@ static bool dbg_disk_info(void)
     info.scroll_all = true;
     return simplelist_show_list(&info);
 }
+
+static int disk_cache_callback(int btn, struct gui_synclist *lists)
+{
+    (void)lists;
+    struct dc_stats stats;
+    dc_get_stats(&stats);
+
+    simplelist_set_line_count(0);
+
+    unsigned long probes = stats.hits + stats.misses;
+    unsigned int hitrate = probes ? 1000ull*stats.hits / probes : 0;
+    simplelist_addline("Sectors: %d x %d B", DC_NUM_ENTRIES,
+                       DC_CACHE_BUFSIZE);
+    simplelist_addline("Hits: %lu (%u.%u%%)", stats.hits,
+                       hitrate / 10, hitrate % 10);
+    simplelist_addline("Misses: %lu", stats.misses);
+    simplelist_addline("Readahead: %d sectors", DC_READAHEAD_SECTORS);
+    simplelist_addline("Read ahead: %lu", stats.prefetched);
+    simplelist_addline("Read ahead & used: %lu", stats.prefetch_hits);
+
+    if (btn == ACTION_NONE)
+        btn = ACTION_REDRAW;
+
+    return btn;
+}
+
+static bool dbg_disk_cache_info(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "Disk Cache Info", 6, NULL);
+    info.action_callback = disk_cache_callback;
+    info.timeout = HZ;
+    return simplelist_show_list(&info);
+}
 #endif /* PLATFORM_NATIVE */
 
 #ifdef HAVE_DIRCACHE
@@ -1841,6 +1876,11 @@ static int dircache_callback(int btn, struct gui_synclist *lists)
                        ticks / HZ, (ticks*10 / HZ) % 10);
     simplelist_addline("Entry count: %u", info.entry_count);
 
+    int resolved, total;
+    bool pending = playlist_dc_scan_progress(&resolved, &total);
+    simplelist_addline("Playlist refs: %d/%d%s", resolved, total,
+                       pending ? " (scanning)" : "");
+
     if (btn == ACTION_NONE)
         btn = ACTION_REDRAW;
 
@@ -1851,7 +1891,7 @@ static bool dbg_dircache_info(void)
 {
     struct simplelist_info info;
     int syncbuild = 0;
-    simplelist_info_init(&info, "Dircache Info", 8, &syncbuild);
+    simplelist_info_init(&info, "Dircache Info", 9, &syncbuild);
     info.action_callback = dircache_callback;
     info.scroll_all = true;
     return simplelist_show_list(&info);
@@ -2628,6 +2668,7 @@ static const struct {
 #endif
 #if (CONFIG_PLATFORM & PLATFORM_NATIVE)
         { "View disk info", dbg_disk_info },
+        { "View disk cache info", dbg_disk_cache_info },
 #if (CONFIG_STORAGE & STORAGE_ATA)
         { "Dump ATA identify info", dbg_identify_info},
 #ifdef HAVE_ATA_SMART
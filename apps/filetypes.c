@@ -120,6 +120,7 @@ static const struct filetype inbuilt_filetypes[] = {
     { "aac",  FILE_ATTR_AUDIO },
     { "m3u",  FILE_ATTR_M3U },
     { "m3u8", FILE_ATTR_M3U },
+    { "rbpl", FILE_ATTR_M3U },
     { "cfg",  FILE_ATTR_CFG },
     { "wps",  FILE_ATTR_WPS },
 #ifdef HAVE_REMOTE_LCD
@@ -24,6 +24,7 @@
 #include "filetree.h"
 #include "wps.h"
 #include "playback.h"
+#include "playlist.h"
 #include "string-extra.h"
 
 /*
@@ -83,7 +84,8 @@ static void get_playlist_name(unsigned char *dest,
         /*Increment only if there is a playlist extension*/
         if ((extension=strrchr(playlist_file->d_name, '.')) != NULL){
             if ((strcmp(extension, ".m3u") == 0 ||
-                 strcmp(extension, ".m3u8") == 0))
+                 strcmp(extension, ".m3u8") == 0 ||
+                 playlist_is_binary_name(playlist_file->d_name)))
                 nbr++;
         }
     }
@@ -125,7 +127,8 @@ static unsigned long nbr_total_playlists(void)
         if ((extension=strrchr(playlist_file->d_name, '.')) != NULL)
         {
             if ((strcmp(extension, ".m3u") == 0 ||
-                 strcmp(extension, ".m3u8") == 0))
+                 strcmp(extension, ".m3u8") == 0 ||
+                 playlist_is_binary_name(playlist_file->d_name)))
             {
                 nbr_total_playlists++;
             }
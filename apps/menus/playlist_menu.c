@@ -55,8 +55,15 @@ int save_playlist_screen(struct playlist_info* playlist)
     len = strlen(temp);
 
     if (len <= 1) /* root or dynamic playlist */
-        create_numbered_filename(temp, directoryonly, PLAYLIST_UNTITLED_PREFIX, ".m3u8",
+    {
+        /* dynamic playlists, e.g. from the database, reopen fastest
+           in the binary format */
+        bool dynamic = (!playlist || playlist == playlist_get_current()) &&
+                       playlist_dynamic_only();
+        create_numbered_filename(temp, directoryonly, PLAYLIST_UNTITLED_PREFIX,
+                                 dynamic ? PLAYLIST_BIN_EXT : ".m3u8",
                                  1 IF_CNFN_NUM_(, NULL));
+    }
     else if (!strcmp((temp + len - 1), "/")) /* dir playlists other than root  */
     {
         temp[len - 1] = '\0';
@@ -385,6 +385,12 @@ static bool clean_shutdown(enum shutdown_type sd_type,
             audio_close_recording();
 #endif
 
+#ifdef DIRCACHE_SNAPSHOT
+            /* save it while it is still intact; the few files written from
+               here on are in directories that are always reread at load */
+            if (global_settings.dircache)
+                dircache_save();
+#endif
             system_flush();
 #ifdef HAVE_EEPROM_SETTINGS
             if (firmware_settings.initialized)
@@ -1590,6 +1596,43 @@ int open_utf8(const char* pathname, int flags)
     return ret >= 0 ? fd : -1;
 }
 
+#ifndef __PCTOOL__
+/*
+ * Look up the mtime of the file at "path". It isn't available from an open
+ * descriptor so the file's directory is searched for it; returns false if
+ * the file isn't found there.
+ */
+bool file_get_mtime(const char *path, time_t *mtime)
+{
+    char dirpath[MAX_PATH];
+    const char *name = strrchr(path, '/');
+    bool found = false;
+
+    if (!name || !*++name || (size_t)(name - path) >= sizeof (dirpath))
+        return false;
+
+    strmemccpy(dirpath, path, name - path + 1);
+
+    DIR *dir = opendir(dirpath);
+    if (!dir)
+        return false;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        if (!strcasecmp(entry->d_name, name))
+        {
+            *mtime = dir_get_info(dir, entry).mtime;
+            found = true;
+            break;
+        }
+    }
+
+    closedir(dir);
+    return found;
+}
+#endif /* !__PCTOOL__ */
+
 
 #ifdef HAVE_LCD_COLOR
 /*
@@ -128,6 +128,7 @@ int split_string(char *str, const char needle, char *vector[], int vector_length
 void fix_path_part(char* path, int offset, int count);
 int open_pathfmt(char *buf, size_t size, int oflag, const char *pathfmt, ...);
 int open_utf8(const char* pathname, int flags);
+bool file_get_mtime(const char *path, time_t *mtime);
 int string_option(const char *option, const char *const oplist[], bool ignore_case);
 
 #ifdef BOOTFILE
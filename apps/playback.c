@@ -1776,6 +1776,9 @@ static int audio_load_albumart(struct track_info *infop,
         user_data.dim = &albumart_slots[i].dim;
 
         char path[MAX_PATH];
+#ifdef HAVE_JPEG
+        char thumb[MAX_PATH];
+#endif
         if(global_settings.album_art == AA_PREFER_IMAGE_FILE)
         {
             if (find_albumart(track_id3, path, sizeof(path),
@@ -1793,8 +1796,27 @@ static int audio_load_albumart(struct track_info *infop,
         {
             if (is_current_track)
                 clear_last_folder_album_art();
-            user_data.embedded_albumart = &track_id3->albumart;
-            hid = bufopen(track_id3->path, 0, TYPE_BITMAP, &user_data);
+
+#ifdef HAVE_JPEG
+            /* a thumbnail saved last time spares decoding the full image */
+            if (albumart_thumb_path(track_id3, &albumart_slots[i].dim,
+                                    thumb, sizeof(thumb)))
+            {
+                if (file_exists(thumb))
+                    hid = bufopen(thumb, 0, TYPE_BITMAP, &user_data);
+                user_data.thumb_path = thumb;
+            }
+#endif
+
+            if (hid < 0 && hid != ERR_BUFFER_FULL)
+            {
+                user_data.embedded_albumart = &track_id3->albumart;
+                hid = bufopen(track_id3->path, 0, TYPE_BITMAP, &user_data);
+            }
+
+            /* an image file tried next is neither embedded nor thumbnailed */
+            user_data.embedded_albumart = NULL;
+            user_data.thumb_path = NULL;
         }
 
         if (global_settings.album_art != AA_OFF && !checked_image_file &&
@@ -2861,6 +2883,11 @@ static void audio_start_playback(const struct audio_resume_info *resume_info,
         logf("%s(%lu, %lu): starting", __func__, resume.elapsed,
              resume.offset);
 
+#ifdef HAVE_ALBUMART
+        /* album art may have been added since the directories were listed */
+        albumart_flush_dir_cache();
+#endif
+
         /* Set audio parameters */
 #if INPUT_SRC_CAPS != 0
         audio_set_input_source(AUDIO_SRC_PLAYBACK, SRCF_PLAYBACK);
@@ -4129,6 +4156,9 @@ void INIT_ATTR playback_init(void)
 
     /* Initialize the track buffering system */
     mutex_init(&id3_mutex);
+#ifdef HAVE_ALBUMART
+    albumart_init();
+#endif
     track_list_init();
     buffering_init();
     pcmbuf_update_frequency();
@@ -68,6 +68,7 @@ void playback_update_aa_dims(void);
 struct bufopen_bitmap_data {
     struct dim *dim;
     struct mp3_albumart *embedded_albumart;
+    const char *thumb_path; /* save the scaled embedded art here */
 };
 
 #endif /* HAVE_ALBUMART */
@@ -30,6 +30,10 @@
     2. Control file :  This file is automatically created when a playlist is
                        started and contains all the commands done to it.
 
+    Large playlist files additionally get an index file holding the line
+    offsets found by the last scan, so a resume can skip rescanning them. It
+    is only trusted while the playlist file's name, size and mtime match.
+
     The first non-comment line in a control file must begin with
     "P:VERSION:DIR:FILE" where VERSION is the playlist control file version
     DIR is the directory where the playlist is located and FILE is the
@@ -128,6 +132,16 @@
 /* default load buffer size (should be at least 1 KiB) */
 #define PLAYLIST_LOAD_BUFLEN    (32*1024)
 
+/* the current playlist's index always has room for this many tracks (or the
+   limit setting, if lower) and grows by at least a page when it fills up;
+   growing while playing is limited to free memory, so this is kept large
+   enough that the usual limit settings are reserved in full at boot */
+#define PLAYLIST_INDEX_MIN      32000
+#define PLAYLIST_INDEX_PAGE     1024
+
+/* allocation overhead to allow for when checking for free memory */
+#define PLAYLIST_ALLOC_SLACK    64
+
 /*
  * Minimum supported version and current version of the control file.
  * Any versions outside of this range will be rejected by the loader.
@@ -144,6 +158,42 @@
 
 #define PLAYLIST_COMMAND_SIZE (MAX_PATH+12)
 
+/* playlist files with fewer entries than this aren't worth indexing */
+#define PLAYLIST_INDEX_MIN_ENTRIES  1000
+#define PLAYLIST_INDEX_MAGIC        0x504c4902 /* "PLI" + version */
+
+struct playlist_index_header
+{
+    uint32_t magic;         /* PLAYLIST_INDEX_MAGIC */
+    uint32_t name_crc;      /* crc_32 of the playlist path */
+    uint32_t size;          /* size of the playlist file */
+    uint32_t mtime;         /* mtime of the playlist file */
+    uint32_t amount;        /* number of uint32_t entries that follow */
+};
+
+/*
+ * Compact binary playlist (PLAYLIST_BIN_EXT), in native byte order. The
+ * header is followed by the tracks, each preceded by its directory when that
+ * differs from the previous track's, then by the table of track offsets that
+ * is loaded straight into the indices. Directories are NUL-terminated
+ * absolute paths; a track is a struct playlist_bin_track followed by its
+ * NUL-terminated name.
+ */
+#define PLAYLIST_BIN_MAGIC          0x52425001 /* "RBP" + version */
+
+struct playlist_bin_header
+{
+    uint32_t magic;         /* PLAYLIST_BIN_MAGIC */
+    uint32_t amount;        /* number of tracks */
+    uint32_t table;         /* offset of the uint32_t track offsets */
+};
+
+struct playlist_bin_track
+{
+    uint32_t dir;           /* offset of the track's directory */
+    int32_t  idx_id;        /* tagcache idx_id of the track or -1 */
+};
+
 /*
     Each playlist index has a flag associated with it which identifies what
     type of track it is.  These flags are stored in the 4 high order bits of
@@ -201,6 +251,301 @@ static void dc_init_filerefs(struct playlist_info *playlist,
 #endif
 }
 
+/*
+ * Need no movement protection since all 3 allocations are not passed to
+ * other functions which can yield().
+ */
+static int move_callback(int handle, void* current, void* new)
+{
+    (void)handle;
+    struct playlist_info* playlist = &current_playlist;
+    if (current == playlist->indices)
+        playlist->indices = new;
+    return BUFLIB_CB_OK;
+}
+
+
+static struct buflib_callbacks ops = {
+    .move_callback = move_callback,
+    .shrink_callback = NULL,
+};
+
+static int indices_handle;
+
+/* control file writes buffered by an insert context */
+#define PLAYLIST_BATCH_BUFSZ    (4*PLAYLIST_COMMAND_SIZE)
+
+/*
+ * State of the open insert context. Tracks added one after another at the
+ * same spot go into a gap left in the index by moving the entries after it
+ * to the end of the buffer once, instead of shifting them for every track.
+ * Their control file records are written out a buffer at a time.
+ */
+static struct
+{
+    struct playlist_info *playlist; /* playlist being batched into or NULL */
+    bool   use_gap;                 /* inserts are expected to be sequential */
+    int    gap;                     /* logical position of the gap or -1 */
+    off_t  ctlbase;                 /* control file offset of ctlbuf[0] */
+    size_t ctllen;                  /* bytes pending in ctlbuf */
+    char   ctlbuf[PLAYLIST_BATCH_BUFSZ];
+} pl_batch;
+
+/* move the entries after the gap back next to it */
+static void pl_batch_close_gap(struct playlist_info *playlist)
+{
+    if (pl_batch.playlist != playlist || pl_batch.gap < 0)
+        return;
+
+    int gap = pl_batch.gap;
+    int tail = playlist->amount - gap;
+    int src = playlist->max_playlist_size - tail;
+
+    memmove(&playlist->indices[gap], &playlist->indices[src],
+            tail * sizeof (*playlist->indices));
+#ifdef HAVE_DIRCACHE
+    if (playlist->dcfrefs_handle)
+    {
+        struct dircache_fileref *dcfrefs =
+            core_get_data(playlist->dcfrefs_handle);
+        memmove(&dcfrefs[gap], &dcfrefs[src], tail * sizeof (*dcfrefs));
+    }
+#endif
+
+    pl_batch.gap = -1;
+}
+
+/*
+ * Free the index entry at 'position' for a new track by moving up the ones
+ * at and after it; capacity for one more entry must already be reserved
+ */
+static void pl_open_index_slot(struct playlist_info *playlist, int position)
+{
+    int tail = playlist->amount - position;
+
+    if (pl_batch.playlist == playlist && pl_batch.use_gap)
+    {
+        if (pl_batch.gap >= 0 && pl_batch.gap != position)
+            pl_batch_close_gap(playlist);
+
+        if (pl_batch.gap < 0)
+        {
+            /* park the tail at the end of the buffer until the batch ends */
+            int dst = playlist->max_playlist_size - tail;
+            memmove(&playlist->indices[dst], &playlist->indices[position],
+                    tail * sizeof (*playlist->indices));
+#ifdef HAVE_DIRCACHE
+            if (playlist->dcfrefs_handle)
+            {
+                struct dircache_fileref *dcfrefs =
+                    core_get_data(playlist->dcfrefs_handle);
+                memmove(&dcfrefs[dst], &dcfrefs[position],
+                        tail * sizeof (*dcfrefs));
+            }
+#endif
+        }
+
+        pl_batch.gap = position + 1;
+        return;
+    }
+
+    memmove(&playlist->indices[position + 1], &playlist->indices[position],
+            tail * sizeof (*playlist->indices));
+#ifdef HAVE_DIRCACHE
+    if (playlist->dcfrefs_handle)
+    {
+        struct dircache_fileref *dcfrefs =
+            core_get_data(playlist->dcfrefs_handle);
+        memmove(&dcfrefs[position + 1], &dcfrefs[position],
+                tail * sizeof (*dcfrefs));
+    }
+#endif
+}
+
+#define playlist_read_lock(p)       mutex_lock(&(p)->mutex)
+#define playlist_read_unlock(p)     mutex_unlock(&(p)->mutex)
+#define playlist_write_lock(p)      mutex_lock(&(p)->mutex)
+#define playlist_write_unlock(p)    mutex_unlock(&(p)->mutex)
+
+/* smallest size of the current playlist's index */
+static int pl_index_min_size(void)
+{
+    return MIN(PLAYLIST_INDEX_MIN, global_settings.max_files_in_playlist);
+}
+
+/*
+ * Allocate index buffers for 'size' tracks and return the handle of the
+ * index, or 0 if there is no room. While the playlist lock is held or
+ * playback is running, 'free_only' must be set: more memory than is free
+ * would come out of the audio buffer, whose shrink callback stops playback
+ * and waits for the audio thread, which may in turn wait for the lock.
+ */
+static int pl_alloc_indices(int size, bool free_only, int *dcfrefs_handle)
+{
+    size_t len = size * sizeof (uint32_t);
+
+    *dcfrefs_handle = 0;
+
+    if (free_only && core_allocatable() < len + PLAYLIST_ALLOC_SLACK)
+        return 0;
+
+    int handle = core_alloc_ex(len, &ops);
+    if (handle <= 0)
+        return 0;
+
+#ifdef HAVE_DIRCACHE
+    /* the references are only a speedup; go without if they don't fit */
+    len = size * sizeof (struct dircache_fileref);
+    if (!free_only || core_allocatable() >= len + PLAYLIST_ALLOC_SLACK)
+        *dcfrefs_handle = MAX(core_alloc(len), 0);
+#endif
+
+    return handle;
+}
+
+/*
+ * Move the current playlist's index to buffers from pl_alloc_indices()
+ */
+static void pl_swap_indices(struct playlist_info *playlist, int size,
+                            int handle, int dcfrefs_handle)
+{
+    /* only the entries before the gap would be copied */
+    pl_batch_close_gap(playlist);
+
+    memcpy(core_get_data(handle), playlist->indices,
+           playlist->amount * sizeof (*playlist->indices));
+    core_free(indices_handle);
+    indices_handle = handle;
+    playlist->indices = core_get_data(handle);
+
+    int dc_start = playlist->amount;
+#ifdef HAVE_DIRCACHE
+    if (dcfrefs_handle > 0 && playlist->dcfrefs_handle > 0)
+    {
+        memcpy(core_get_data(dcfrefs_handle),
+               core_get_data(playlist->dcfrefs_handle),
+               playlist->amount * sizeof (struct dircache_fileref));
+    }
+    else
+    {
+        dc_start = 0;
+    }
+
+    if (playlist->dcfrefs_handle > 0)
+        core_free(playlist->dcfrefs_handle);
+
+    playlist->dcfrefs_handle = dcfrefs_handle;
+#else
+    (void)dcfrefs_handle;
+#endif
+
+    playlist->max_playlist_size = size;
+    dc_init_filerefs(playlist, dc_start, size - dc_start);
+}
+
+/*
+ * Make room for 'count' more tracks. Caller-supplied index buffers are fixed
+ * in size but the current playlist's index and dircache references are grown
+ * here, at least a page at a time, so a large limit setting doesn't reserve
+ * memory that goes unused by most playlists. The lock is held, so only free
+ * memory is used; pl_prepare_indices() reserves more ahead of bulk changes.
+ * Returns false if there is no room.
+ */
+static bool pl_reserve_indices(struct playlist_info *playlist, int count)
+{
+    int need = playlist->amount + count;
+
+    if (need <= playlist->max_playlist_size)
+        return true;
+
+    if (playlist != &current_playlist ||
+        need > global_settings.max_files_in_playlist)
+        return false;
+
+    int size = MAX(need, 2*playlist->max_playlist_size);
+    size = ALIGN_UP(size, PLAYLIST_INDEX_PAGE);
+    size = MIN(size, global_settings.max_files_in_playlist);
+
+    int dcfrefs_handle;
+    int handle = pl_alloc_indices(size, true, &dcfrefs_handle);
+    if (handle <= 0)
+        return false;
+
+    pl_swap_indices(playlist, size, handle, dcfrefs_handle);
+    return true;
+}
+
+/*
+ * Grow the current playlist's index to room for 'size' tracks before a bulk
+ * change. Must be called without the playlist lock held. While playback is
+ * stopped the memory may come from the idle audio buffer. While it runs only
+ * free memory is used, since anything else would stop playback, unless
+ * 'replacing' says the change replaces what is playing anyway.
+ * pl_trim_indices() gives back what the change didn't use.
+ */
+static void pl_prepare_indices(struct playlist_info *playlist, int size,
+                               bool replacing)
+{
+    size = MIN(size, global_settings.max_files_in_playlist);
+
+    if (playlist != &current_playlist || size <= playlist->max_playlist_size)
+        return;
+
+    bool free_only = !replacing && (audio_status() & AUDIO_STATUS_PLAY);
+    int dcfrefs_handle;
+    int handle = pl_alloc_indices(size, free_only, &dcfrefs_handle);
+    if (handle <= 0)
+        return;
+
+    playlist_write_lock(playlist);
+
+    if (size > playlist->max_playlist_size)
+    {
+        pl_swap_indices(playlist, size, handle, dcfrefs_handle);
+    }
+    else
+    {
+        core_free(handle);
+        if (dcfrefs_handle > 0)
+            core_free(dcfrefs_handle);
+    }
+
+    playlist_write_unlock(playlist);
+}
+
+/*
+ * Give back the part of the current playlist's index that a bulk change
+ * didn't use, keeping a page of room to grow
+ */
+static void pl_trim_indices(struct playlist_info *playlist)
+{
+    if (playlist != &current_playlist || indices_handle <= 0)
+        return;
+
+    pl_batch_close_gap(playlist);
+
+    int size = ALIGN_UP(playlist->amount + PLAYLIST_INDEX_PAGE,
+                        PLAYLIST_INDEX_PAGE);
+    size = MAX(size, pl_index_min_size());
+
+    if (size >= playlist->max_playlist_size)
+        return;
+
+    core_shrink(indices_handle, playlist->indices,
+                size * sizeof (*playlist->indices));
+    playlist->indices = core_get_data(indices_handle);
+#ifdef HAVE_DIRCACHE
+    if (playlist->dcfrefs_handle > 0)
+    {
+        core_shrink(playlist->dcfrefs_handle,
+                    core_get_data(playlist->dcfrefs_handle),
+                    size * sizeof (struct dircache_fileref));
+    }
+#endif
+
+    playlist->max_playlist_size = size;
+}
+
 #ifdef HAVE_DIRCACHE
 #define PLAYLIST_DC_SCAN_START  1
 #define PLAYLIST_DC_SCAN_STOP   2
@@ -209,12 +554,25 @@ static struct event_queue playlist_queue;
 static struct queue_sender_list playlist_queue_sender_list;
 static long playlist_stack[(DEFAULT_STACK_SIZE + 0x800)/sizeof(long)];
 static const char dc_thread_playlist_name[] = "playlist cachectrl";
-#endif
 
-#define playlist_read_lock(p)       mutex_lock(&(p)->mutex)
-#define playlist_read_unlock(p)     mutex_unlock(&(p)->mutex)
-#define playlist_write_lock(p)      mutex_lock(&(p)->mutex)
-#define playlist_write_unlock(p)    mutex_unlock(&(p)->mutex)
+#define PLAYLIST_DC_BATCH       64  /* stale references gathered per round */
+#define PLAYLIST_DC_DIRS        4   /* directories remembered while resolving */
+
+/* progress of the reference scan, as seen by playlist_dc_scan_progress() */
+static struct
+{
+    int  resolved;  /* valid references counted by the last scan */
+    int  total;     /* tracks in the playlist at that time */
+    bool pending;   /* stale references remain to be resolved */
+} dc_scan_progress;
+
+/* most recently used directories of the scan, most recent first */
+static struct dc_scan_dir
+{
+    struct dircache_fileref dcfref;
+    char path[MAX_PATH];
+} dc_scan_dirs[PLAYLIST_DC_DIRS];
+#endif
 
 #if defined(PLAYLIST_DEBUG_ACCESS_ERRORS)
 #define notify_access_error() (splashf(HZ*2, "%s %s", \
@@ -317,6 +675,67 @@ static bool is_m3u8_name(const char* filename)
     return (!dot || strcasecmp(dot, ".m3u") != 0);
 }
 
+/* Check if the filename suggests the compact binary format. */
+bool playlist_is_binary_name(const char *filename)
+{
+    char *dot = strrchr(filename, '.');
+    return (dot && !strcasecmp(dot, PLAYLIST_BIN_EXT));
+}
+
+/*
+ * Read and check the header of a binary playlist.
+ */
+static bool pl_bin_read_header(int fd, struct playlist_bin_header *hdr)
+{
+    if (lseek(fd, 0, SEEK_SET) != 0 ||
+        read(fd, hdr, sizeof (*hdr)) != sizeof (*hdr) ||
+        hdr->magic != PLAYLIST_BIN_MAGIC)
+        return false;
+
+    /* the table must fit in the file and its offsets in the indices */
+    off_t size = filesize(fd);
+    return hdr->table <= PLAYLIST_SEEK_MASK &&
+           hdr->amount <= (PLAYLIST_SEEK_MASK - hdr->table) / sizeof (uint32_t) &&
+           hdr->table + hdr->amount * sizeof (uint32_t) <= (uint32_t)size;
+}
+
+/*
+ * Read the full path of the binary playlist track at 'seek' into buf, using
+ * tmp as scratch space. Returns the length of the path or -1 on error.
+ */
+static int pl_bin_read_track(int fd, unsigned long seek, char *buf,
+                             size_t bufsz, char *tmp, size_t tmpsz)
+{
+    struct playlist_bin_track track;
+    ssize_t n;
+
+    if (lseek(fd, seek, SEEK_SET) != (off_t)seek ||
+        (n = read(fd, tmp, tmpsz - 1)) <= (ssize_t)sizeof (track))
+        return -1;
+
+    tmp[n] = '\0';
+    memcpy(&track, tmp, sizeof (track));
+    const char *name = tmp + sizeof (track);
+
+    if (lseek(fd, track.dir, SEEK_SET) != (off_t)track.dir ||
+        (n = read(fd, buf, bufsz - 1)) <= 0)
+        return -1;
+
+    buf[n] = '\0';
+    size_t len = strlen(buf);
+
+    /* only the root ends with a separator */
+    if (len && buf[len - 1] != PATH_SEPCH)
+        buf[len++] = PATH_SEPCH;
+
+    size_t namelen = strlen(name);
+    if (len + namelen >= bufsz)
+        return -1;
+
+    memcpy(buf + len, name, namelen + 1);
+    return len + namelen;
+}
+
 /* Convert a filename in an M3U playlist to UTF-8.
  *
  * buf     - the filename to convert; can contain more than one line from the
@@ -394,10 +813,64 @@ static int rotate_index(const struct playlist_info* playlist, int index)
     return index;
 }
 
+/*
+ * Write out the control file records buffered by an insert context
+ */
+static int pl_batch_flush_control(struct playlist_info* playlist)
+{
+    if (pl_batch.playlist != playlist || pl_batch.ctllen == 0)
+        return 0;
+
+    int fd = playlist->control_fd;
+    ssize_t len = pl_batch.ctllen;
+    pl_batch.ctllen = 0;
+
+    if (lseek(fd, pl_batch.ctlbase, SEEK_SET) != pl_batch.ctlbase ||
+        write(fd, pl_batch.ctlbuf, len) != len)
+    {
+        notify_control_access_error();
+        return -1;
+    }
+
+    return 0;
+}
+
 static void sync_control_unlocked(struct playlist_info* playlist)
 {
     if (playlist->control_fd >= 0)
+    {
+        pl_batch_flush_control(playlist);
         fsync(playlist->control_fd);
+    }
+}
+
+/*
+ * Add an (A)dd or (Q)ueue record to the insert context's buffer, flushing it
+ * first if the record might not fit
+ */
+static int pl_batch_add_control(struct playlist_info* playlist,
+                                enum playlist_command command, int i1, int i2,
+                                const char* s1, int *seekpos)
+{
+    size_t len = strlen(s1) + 2*12 + 4;
+
+    if (pl_batch.ctllen + len > sizeof (pl_batch.ctlbuf) &&
+        pl_batch_flush_control(playlist) < 0)
+        return -1;
+
+    if (pl_batch.ctllen == 0)
+        pl_batch.ctlbase = lseek(playlist->control_fd, 0, SEEK_END);
+
+    char *buf = pl_batch.ctlbuf + pl_batch.ctllen;
+    size_t bufsize = sizeof (pl_batch.ctlbuf) - pl_batch.ctllen;
+
+    int result = snprintf(buf, bufsize, "%c:%d:%d:",
+                          command == PLAYLIST_COMMAND_ADD ? 'A' : 'Q', i1, i2);
+    *seekpos = pl_batch.ctlbase + pl_batch.ctllen + result;
+    result += snprintf(buf + result, bufsize - result, "%s\n", s1);
+
+    pl_batch.ctllen += result;
+    return result;
 }
 
 static int update_control_unlocked(struct playlist_info* playlist,
@@ -407,6 +880,16 @@ static int update_control_unlocked(struct playlist_info* playlist,
     int fd = playlist->control_fd;
     int result;
 
+    if (pl_batch.playlist == playlist)
+    {
+        if (command == PLAYLIST_COMMAND_ADD || command == PLAYLIST_COMMAND_QUEUE)
+            return pl_batch_add_control(playlist, command, i1, i2, s1, seekpos);
+
+        /* keep the records in order */
+        if (pl_batch_flush_control(playlist) < 0)
+            return -1;
+    }
+
     lseek(fd, 0, SEEK_END);
 
     switch (command)
@@ -459,6 +942,7 @@ static void update_playlist_filename_unlocked(struct playlist_info* playlist,
     int dirlen = strlen(dir);
 
     playlist->utf8 = is_m3u8_name(file);
+    playlist->binary = playlist_is_binary_name(file);
 
     /* If the dir does not end in trailing slash, we use a separator.
        Otherwise we don't. */
@@ -491,6 +975,7 @@ static void empty_playlist_unlocked(struct playlist_info* playlist, bool resume)
     playlist->seed = 0;
 
     playlist->utf8 = true;
+    playlist->binary = false;
     playlist->control_created = false;
     playlist->flags = 0;
 
@@ -689,6 +1174,147 @@ static void display_playlist_count(int count, const unsigned char *fmt,
     splashf(0, P2STR(fmt), count, str(LANG_OFF_ABORT));
 }
 
+/*
+ * Returns a pointer to the first '\n' or '\r' in [p, end), or end if there
+ * is none. Long lines are skipped a machine word at a time.
+ */
+static unsigned char *find_line_end(unsigned char *p, unsigned char *end)
+{
+    #define ONES  (~0ul / 0xff)
+    #define HIGHS (ONES * 0x80)
+    #define HASZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
+    while (p < end && ((uintptr_t)p & (sizeof (unsigned long) - 1)))
+    {
+        if (*p == '\n' || *p == '\r')
+            return p;
+        p++;
+    }
+
+    while ((size_t)(end - p) >= sizeof (unsigned long))
+    {
+        unsigned long w = *(unsigned long *)p;
+        if (HASZERO(w ^ (ONES * '\n')) | HASZERO(w ^ (ONES * '\r')))
+            break;
+        p += sizeof (unsigned long);
+    }
+
+    while (p < end && *p != '\n' && *p != '\r')
+        p++;
+
+    return p;
+
+    #undef HASZERO
+    #undef HIGHS
+    #undef ONES
+}
+
+/*
+ * Get the size and mtime of the playlist file that identify a saved index.
+ */
+static bool pl_index_get_header(struct playlist_info* playlist,
+                                struct playlist_index_header *hdr)
+{
+    time_t mtime;
+
+    if (!file_get_mtime(playlist->filename, &mtime))
+        return false;
+
+    hdr->magic = PLAYLIST_INDEX_MAGIC;
+    hdr->name_crc = crc_32(playlist->filename, strlen(playlist->filename), -1);
+    hdr->size = filesize(playlist->fd);
+    hdr->mtime = mtime;
+    return true;
+}
+
+/*
+ * Load the indices saved by the last scan of this playlist file; returns
+ * false if there are none or they are stale.
+ */
+static bool pl_index_load(struct playlist_info* playlist,
+                          const struct playlist_index_header *hdr)
+{
+    struct playlist_index_header saved;
+    bool loaded = false;
+
+    int fd = open(PLAYLIST_INDEX_FILE, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    if (read(fd, &saved, sizeof (saved)) == sizeof (saved) &&
+        saved.magic == hdr->magic && saved.name_crc == hdr->name_crc &&
+        saved.size == hdr->size && saved.mtime == hdr->mtime &&
+        saved.amount > 0 && pl_reserve_indices(playlist, saved.amount))
+    {
+        ssize_t len = saved.amount * sizeof (*playlist->indices);
+        if (read(fd, playlist->indices, len) == len)
+        {
+            playlist->amount = saved.amount;
+            dc_init_filerefs(playlist, 0, playlist->amount);
+            loaded = true;
+        }
+    }
+
+    close(fd);
+    return loaded;
+}
+
+static void pl_index_save(struct playlist_info* playlist,
+                          struct playlist_index_header *hdr)
+{
+    int fd = open(PLAYLIST_INDEX_FILE, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0)
+        return;
+
+    hdr->amount = playlist->amount;
+    ssize_t len = playlist->amount * sizeof (*playlist->indices);
+
+    if (write(fd, hdr, sizeof (*hdr)) != sizeof (*hdr) ||
+        write(fd, playlist->indices, len) != len)
+    {
+        /* don't leave a partial index behind */
+        close(fd);
+        remove(PLAYLIST_INDEX_FILE);
+        return;
+    }
+
+    close(fd);
+}
+
+/*
+ * Load the track offsets of a binary playlist from its table
+ */
+static int pl_bin_add_indices(struct playlist_info* playlist)
+{
+    struct playlist_bin_header hdr;
+
+    if (!pl_bin_read_header(playlist->fd, &hdr))
+        return -1;
+
+    if (!pl_reserve_indices(playlist, hdr.amount))
+    {
+        notify_buffer_full();
+        return -1;
+    }
+
+    uint32_t *indices = &playlist->indices[playlist->amount];
+    ssize_t len = hdr.amount * sizeof (*indices);
+
+    if (lseek(playlist->fd, hdr.table, SEEK_SET) != (off_t)hdr.table ||
+        read(playlist->fd, indices, len) != len)
+        return -1;
+
+    for (uint32_t i = 0; i < hdr.amount; i++)
+    {
+        if (indices[i] & ~PLAYLIST_SEEK_MASK)
+            return -1;
+    }
+
+    dc_init_filerefs(playlist, playlist->amount, hdr.amount);
+    playlist->amount += hdr.amount;
+    return 0;
+}
+
 /*
  * calculate track offsets within a playlist file
  */
@@ -696,10 +1322,12 @@ static int add_indices_to_playlist(struct playlist_info* playlist,
                                    char* buffer, size_t buflen)
 {
     ssize_t nread;
-    unsigned int i, count = 0;
+    unsigned int i;
     bool store_index;
-    unsigned char *p;
+    unsigned char *p, *end;
     int result = 0;
+    struct playlist_index_header hdr;
+    bool indexable;
     /* get emergency buffer so we don't fail horribly */
     if (!buflen)
         buffer = alloca((buflen = 64));
@@ -715,6 +1343,20 @@ static int add_indices_to_playlist(struct playlist_info* playlist,
         goto exit;
     }
 
+    /* binary playlists carry their own offsets */
+    if (playlist->binary)
+    {
+        result = pl_bin_add_indices(playlist);
+        goto exit;
+    }
+
+    /* the saved offsets only make sense for a scan of the whole file */
+    indexable = playlist->amount == 0 &&
+                pl_index_get_header(playlist, &hdr);
+
+    if (indexable && pl_index_load(playlist, &hdr))
+        goto exit;
+
     i = lseek(playlist->fd, 0, SEEK_CUR);
 
     splash(0, ID2P(LANG_WAIT));
@@ -728,37 +1370,52 @@ static int add_indices_to_playlist(struct playlist_info* playlist,
             break;
 
         p = (unsigned char *)buffer;
+        end = p + nread;
 
-        for(count=0; count < (unsigned int)nread; count++,p++) {
+        while (p < end)
+        {
+            /* Skip the rest of the line we're in */
+            if (!store_index)
+            {
+                p = find_line_end(p, end);
+                if (p >= end)
+                    break;
+            }
 
             /* Are we on a new line? */
-            if((*p == '\n') || (*p == '\r'))
+            if ((*p == '\n') || (*p == '\r'))
             {
                 store_index = true;
             }
-            else if(store_index)
+            else
             {
                 store_index = false;
 
                 if(*p != '#')
                 {
-                    if ( playlist->amount >= playlist->max_playlist_size ) {
+                    if (!pl_reserve_indices(playlist, 1)) {
                         notify_buffer_full();
                         result = -1;
                         goto exit;
                     }
 
                     /* Store a new entry */
-                    playlist->indices[ playlist->amount ] = i+count;
+                    playlist->indices[ playlist->amount ] =
+                        i + (p - (unsigned char *)buffer);
                     dc_init_filerefs(playlist, playlist->amount, 1);
                     playlist->amount++;
                 }
             }
+
+            p++;
         }
 
-        i+= count;
+        i += nread;
     }
 
+    if (indexable && playlist->amount >= PLAYLIST_INDEX_MIN_ENTRIES)
+        pl_index_save(playlist, &hdr);
+
 exit:
     playlist_write_unlock(playlist);
     return result;
@@ -1042,12 +1699,17 @@ static int get_track_filename(struct playlist_info* playlist, int index,
     char tmp_buf[MAX_PATH+1];
     char dir_buf[MAX_PATH+1];
     bool utf8 = playlist->utf8;
+    bool formatted = false;
 
     if (index < 0 || index >= playlist->amount)
         return -1;
 
     playlist_write_lock(playlist);
 
+    /* the entry may still be in a gap or its record in the batch buffer */
+    pl_batch_close_gap(playlist);
+    pl_batch_flush_control(playlist);
+
     bool control_file = playlist->indices[index] & PLAYLIST_INSERT_TYPE_MASK;
     unsigned long seek = playlist->indices[index] & PLAYLIST_SEEK_MASK;
 
@@ -1077,7 +1739,14 @@ static int get_track_filename(struct playlist_info* playlist, int index,
 
         if(-1 != fd)
         {
-            if (lseek(fd, seek, SEEK_SET) != (off_t)seek)
+            if (!control_file && playlist->binary)
+            {
+                /* stored as absolute paths; nothing to convert */
+                max = pl_bin_read_track(fd, seek, tmp_buf, sizeof(tmp_buf),
+                                        dir_buf, sizeof(dir_buf));
+                formatted = max >= 0;
+            }
+            else if (lseek(fd, seek, SEEK_SET) != (off_t)seek)
                 max = -1;
             else
             {
@@ -1117,6 +1786,9 @@ static int get_track_filename(struct playlist_info* playlist, int index,
 
     playlist_write_unlock(playlist);
 
+    if (formatted)
+        return strmemccpy(buf, tmp_buf, buf_length) ? 0 : -1;
+
     if (format_track_path(buf, tmp_buf, buf_length,
                           playlist->filename, playlist->dirlen) < 0)
         return -1;
@@ -1227,11 +1899,10 @@ static int add_track_to_playlist_unlocked(struct playlist_info* playlist,
 {
     int insert_position, orig_position;
     unsigned long flags = PLAYLIST_INSERT_TYPE_INSERT;
-    int i;
 
     insert_position = orig_position = position;
 
-    if (playlist->amount >= playlist->max_playlist_size)
+    if (!pl_reserve_indices(playlist, 1))
     {
         notify_buffer_full();
         return -1;
@@ -1322,22 +1993,6 @@ static int add_track_to_playlist_unlocked(struct playlist_info* playlist,
     if (queue)
         flags |= PLAYLIST_QUEUED;
 
-#ifdef HAVE_DIRCACHE
-    struct dircache_fileref *dcfrefs = NULL;
-    if (playlist->dcfrefs_handle)
-        dcfrefs = core_get_data(playlist->dcfrefs_handle);
-#else
-    int *dcfrefs = NULL;
-#endif
-
-    /* shift indices so that track can be added */
-    for (i=playlist->amount; i>insert_position; i--)
-    {
-        playlist->indices[i] = playlist->indices[i-1];
-        if (dcfrefs)
-            dcfrefs[i] = dcfrefs[i-1];
-    }
-
     /* update stored indices if needed */
 
     if (orig_position < 0)
@@ -1386,6 +2041,9 @@ static int add_track_to_playlist_unlocked(struct playlist_info* playlist,
             return result;
     }
 
+    /* shift indices so that track can be added */
+    pl_open_index_slot(playlist, insert_position);
+
     playlist->indices[insert_position] = flags | seek_pos;
     dc_init_filerefs(playlist, insert_position, 1);
 
@@ -1409,27 +2067,26 @@ static int directory_search_callback(char* filename, void* context)
 static int remove_track_unlocked(struct playlist_info* playlist,
                                  int position, bool write)
 {
-    int i;
     int result = 0;
 
     if (playlist->amount <= 0)
         return -1;
 
-#ifdef HAVE_DIRCACHE
-    struct dircache_fileref *dcfrefs = NULL;
-    if (playlist->dcfrefs_handle)
-        dcfrefs = core_get_data(playlist->dcfrefs_handle);
-#else
-    int *dcfrefs = NULL;
-#endif
+    pl_batch_close_gap(playlist);
 
     /* shift indices now that track has been removed */
-    for (i=position; i<playlist->amount; i++)
+    int tail = playlist->amount - position - 1;
+    memmove(&playlist->indices[position], &playlist->indices[position + 1],
+            tail * sizeof (*playlist->indices));
+#ifdef HAVE_DIRCACHE
+    if (playlist->dcfrefs_handle)
     {
-        playlist->indices[i] = playlist->indices[i+1];
-        if (dcfrefs)
-            dcfrefs[i] = dcfrefs[i+1];
+        struct dircache_fileref *dcfrefs =
+            core_get_data(playlist->dcfrefs_handle);
+        memmove(&dcfrefs[position], &dcfrefs[position + 1],
+                tail * sizeof (*dcfrefs));
     }
+#endif
 
     playlist->amount--;
 
@@ -1542,8 +2199,8 @@ static int randomise_playlist_unlocked(struct playlist_info* playlist,
  */
 static int sort_compare_fn(const void* p1, const void* p2)
 {
-    unsigned long* e1 = (unsigned long*) p1;
-    unsigned long* e2 = (unsigned long*) p2;
+    uint32_t* e1 = (uint32_t*) p1;
+    uint32_t* e2 = (uint32_t*) p2;
     unsigned long flags1 = *e1 & PLAYLIST_INSERT_TYPE_MASK;
     unsigned long flags2 = *e2 & PLAYLIST_INSERT_TYPE_MASK;
 
@@ -1730,6 +2387,83 @@ static int get_next_index(const struct playlist_info* playlist, int steps,
 }
 
 #ifdef HAVE_DIRCACHE
+/*
+ * Resolve the dircache reference of a track by looking up its name in its
+ * directory. The last few directories are remembered so that a run of tracks
+ * from the same one walks its path only once. 'path' is modified.
+ *
+ * returns > 0 if the reference is now valid
+ */
+static int dc_resolve_track(struct dircache_fileref *dcfrefp, char *path)
+{
+    char *name = strrchr(path, '/');
+
+    if (!name || name == path || is_dotdir_name(name + 1))
+    {
+        /* nothing to gain; search the whole path */
+        return dircache_search(DCS_CACHED_PATH | DCS_UPDATE_FILEREF,
+                               dcfrefp, path);
+    }
+
+    *name++ = '\0';
+
+    int i;
+    for (i = 0; i < PLAYLIST_DC_DIRS; i++)
+    {
+        struct dc_scan_dir *dirp = &dc_scan_dirs[i];
+        if (!strcmp(dirp->path, path) &&
+            dircache_search(DCS_FILEREF, &dirp->dcfref, NULL) > 0)
+            break;
+    }
+
+    if (i == PLAYLIST_DC_DIRS)
+    {
+        /* replace the least recently used one */
+        i = PLAYLIST_DC_DIRS - 1;
+        struct dc_scan_dir *dirp = &dc_scan_dirs[i];
+
+        if (dircache_search(DCS_CACHED_PATH | DCS_UPDATE_FILEREF,
+                            &dirp->dcfref, path) <= 0)
+        {
+            dirp->path[0] = '\0';
+            return 0;
+        }
+
+        strmemccpy(dirp->path, path, sizeof (dirp->path));
+    }
+
+    if (i > 0)
+    {
+        struct dc_scan_dir dir = dc_scan_dirs[i];
+        memmove(&dc_scan_dirs[1], &dc_scan_dirs[0],
+                i * sizeof (dc_scan_dirs[0]));
+        dc_scan_dirs[0] = dir;
+    }
+
+    return dircache_search_name(&dc_scan_dirs[0].dcfref, name, dcfrefp);
+}
+
+/*
+ * Put a batch of track indices in the order their names are stored in the
+ * playlist and control files. Playlists list the tracks of a directory
+ * together, so even when shuffled this brings them next to each other.
+ */
+static void dc_sort_batch(const struct playlist_info *playlist,
+                          int *batch, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        int index = batch[i];
+        uint32_t key = playlist->indices[index];
+        int j;
+
+        for (j = i; j > 0 && playlist->indices[batch[j-1]] > key; j--)
+            batch[j] = batch[j-1];
+
+        batch[j] = index;
+    }
+}
+
 /**
  * Thread to update filename pointers to dircache on background
  * without affecting playlist load up performance.
@@ -1741,6 +2475,7 @@ static void dc_thread_playlist(void)
 
     struct playlist_info *playlist = &current_playlist;
     struct dircache_fileref *dcfrefs;
+    int batch[PLAYLIST_DC_BATCH];
     int index;
 
     /* Thread starts out stopped */
@@ -1759,6 +2494,7 @@ static void dc_thread_playlist(void)
                     is_dirty = true;
 
                 stop_count--;
+                dc_scan_progress.pending = is_dirty;
                 if (is_dirty && stop_count == 0)
                 {
                     /* Start the background scanning after either the disk
@@ -1784,6 +2520,9 @@ static void dc_thread_playlist(void)
                 if (!playlist->dcfrefs_handle || playlist->amount <= 0)
                 {
                     is_dirty = false;
+                    dc_scan_progress.pending = false;
+                    dc_scan_progress.resolved = 0;
+                    dc_scan_progress.total = 0;
                     sleep_time = TIMEOUT_BLOCK;
                     logf("%s: nothing to scan", __func__);
                     break;
@@ -1806,36 +2545,68 @@ static void dc_thread_playlist(void)
                 trigger_cpu_boost();
                 dcfrefs = core_get_data_pinned(playlist->dcfrefs_handle);
 
-                for (index = 0; index < playlist->amount; index++)
-                {
-                    /* Process only pointers that are superficially stale. */
-                    if (dircache_search(DCS_FILEREF, &dcfrefs[index], NULL) > 0)
-                        continue;
+                /* Directories may have been renamed since the last scan */
+                for (int i = 0; i < PLAYLIST_DC_DIRS; i++)
+                    dc_scan_dirs[i].path[0] = '\0';
 
-                    /* Bail out if a command needs servicing. */
-                    if (!queue_empty(&playlist_queue))
+                int resolved = 0;
+                bool interrupted = false;
+                index = 0;
+
+                while (index < playlist->amount && !interrupted)
+                {
+                    /* Gather a batch of pointers that are superficially
+                     * stale and resolve them in file order. */
+                    int count = 0;
+                    for (; index < playlist->amount &&
+                           count < PLAYLIST_DC_BATCH; index++)
                     {
-                        logf("%s: scan interrupted", __func__);
-                        break;
+                        if (dircache_search(DCS_FILEREF, &dcfrefs[index],
+                                            NULL) > 0)
+                            resolved++;
+                        else
+                            batch[count++] = index;
                     }
 
-                    /* Load the filename from playlist file. */
-                    if (get_track_filename(playlist, index, tmp, sizeof(tmp)) != 0)
-                        break;
+                    dc_sort_batch(playlist, batch, count);
+
+                    for (int i = 0; i < count; i++)
+                    {
+                        /* Bail out if a command needs servicing. */
+                        if (!queue_empty(&playlist_queue))
+                        {
+                            logf("%s: scan interrupted", __func__);
+                            interrupted = true;
+                            break;
+                        }
+
+                        /* Load the filename from playlist file. */
+                        if (get_track_filename(playlist, batch[i], tmp,
+                                               sizeof(tmp)) != 0)
+                        {
+                            interrupted = true;
+                            break;
+                        }
+
+                        /* Obtain the dircache file entry cookie. */
+                        if (dc_resolve_track(&dcfrefs[batch[i]], tmp) > 0)
+                            resolved++;
+                    }
 
-                    /* Obtain the dircache file entry cookie. */
-                    dircache_search(DCS_CACHED_PATH | DCS_UPDATE_FILEREF,
-                                    &dcfrefs[index], tmp);
+                    dc_scan_progress.resolved = resolved;
+                    dc_scan_progress.total = playlist->amount;
 
-                    /* And be on background so user doesn't notice any delays. */
+                    /* And be on background so user doesn't notice any
+                     * delays. */
                     yield();
                 }
 
                 /* If we indexed the whole playlist without being interrupted
                  * then there are no dirty references; go to sleep. */
-                if (index == playlist->amount)
+                if (!interrupted)
                 {
                     is_dirty = false;
+                    dc_scan_progress.pending = false;
                     sleep_time = TIMEOUT_BLOCK;
                     logf("%s: scan complete", __func__);
                 }
@@ -1873,25 +2644,6 @@ static int alloc_tempbuf(size_t* buflen)
     return core_alloc_maximum(buflen, &buflib_ops_locked);
 }
 
-/*
- * Need no movement protection since all 3 allocations are not passed to
- * other functions which can yield().
- */
-static int move_callback(int handle, void* current, void* new)
-{
-    (void)handle;
-    struct playlist_info* playlist = &current_playlist;
-    if (current == playlist->indices)
-        playlist->indices = new;
-    return BUFLIB_CB_OK;
-}
-
-
-static struct buflib_callbacks ops = {
-    .move_callback = move_callback,
-    .shrink_callback = NULL,
-};
-
 /******************************************************************************/
 /******************************************************************************/
 /* ************************************************************************** */
@@ -1904,7 +2656,6 @@ static struct buflib_callbacks ops = {
  */
 void playlist_init(void)
 {
-    int handle;
     struct playlist_info* playlist = &current_playlist;
     mutex_init(&playlist->mutex);
 
@@ -1912,10 +2663,10 @@ void playlist_init(void)
             sizeof(playlist->control_filename));
     playlist->fd = -1;
     playlist->control_fd = -1;
-    playlist->max_playlist_size = global_settings.max_files_in_playlist;
+    playlist->max_playlist_size = pl_index_min_size();
 
-    handle = core_alloc_ex(playlist->max_playlist_size * sizeof(*playlist->indices), &ops);
-    playlist->indices = core_get_data(handle);
+    indices_handle = core_alloc_ex(playlist->max_playlist_size * sizeof(*playlist->indices), &ops);
+    playlist->indices = core_get_data(indices_handle);
 
     empty_playlist_unlocked(playlist, true);
 
@@ -1989,29 +2740,22 @@ int playlist_create_ex(struct playlist_info* playlist,
     playlist->fd = -1;
     playlist->control_fd = -1;
 
-    if (index_buffer)
-    {
-        int num_indices = index_buffer_size /
-            playlist_get_required_bufsz(playlist, false, 1);
+    /* the current playlist's index only has room for its own tracks and can
+       move, so it can't be shared */
+    if (!index_buffer || playlist == &current_playlist)
+        return -1;
 
-        if (num_indices > global_settings.max_files_in_playlist)
-            num_indices = global_settings.max_files_in_playlist;
+    int num_indices = index_buffer_size /
+        playlist_get_required_bufsz(playlist, false, 1);
 
-        playlist->max_playlist_size = num_indices;
-        playlist->indices = index_buffer;
-#ifdef HAVE_DIRCACHE
-        playlist->dcfrefs_handle = 0;
-#endif
-    }
-    else
-    {
-        /* FIXME not sure if it's safe to share index buffers */
-        playlist->max_playlist_size = current_playlist.max_playlist_size;
-        playlist->indices = current_playlist.indices;
+    if (num_indices > global_settings.max_files_in_playlist)
+        num_indices = global_settings.max_files_in_playlist;
+
+    playlist->max_playlist_size = num_indices;
+    playlist->indices = index_buffer;
 #ifdef HAVE_DIRCACHE
-        playlist->dcfrefs_handle = 0;
+    playlist->dcfrefs_handle = 0;
 #endif
-    }
 
     new_playlist_unlocked(playlist, dir, file);
 
@@ -2031,6 +2775,9 @@ int playlist_create(const char *dir, const char *file)
     int status = 0;
 
     dc_thread_stop(playlist);
+    if (file)
+        pl_prepare_indices(playlist, global_settings.max_files_in_playlist,
+                           true);
     playlist_write_lock(playlist);
 
     new_playlist_unlocked(playlist, dir, file);
@@ -2057,6 +2804,7 @@ int playlist_create(const char *dir, const char *file)
         }
     }
 
+    pl_trim_indices(playlist);
     playlist_write_unlock(playlist);
     dc_thread_start(playlist, true);
 
@@ -2135,6 +2883,65 @@ out:
     return result;
 }
 
+/*
+ * Read the tracks of a binary playlist and notify via callback.
+ */
+int playlist_bin_tracksearch(const char *filename,
+                             int (*callback)(char*, void*), void *context)
+{
+    char buf[MAX_PATH+1];
+    char tmp[MAX_PATH+1];
+    struct playlist_bin_header hdr;
+    int result = -1;
+
+    if (!callback)
+        return -1;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        notify_access_error();
+        return -1;
+    }
+
+    if (!pl_bin_read_header(fd, &hdr))
+    {
+        notify_access_error();
+        goto out;
+    }
+
+    for (uint32_t i = 0; i < hdr.amount; i++)
+    {
+        /* user abort */
+        if (action_userabort(TIMEOUT_NOBLOCK))
+            goto out;
+
+        uint32_t seek;
+        off_t pos = hdr.table + i * sizeof (seek);
+
+        if (lseek(fd, pos, SEEK_SET) != pos ||
+            read(fd, &seek, sizeof (seek)) != sizeof (seek) ||
+            pl_bin_read_track(fd, seek, buf, sizeof (buf),
+                              tmp, sizeof (tmp)) < 0)
+        {
+            notify_access_error();
+            goto out;
+        }
+
+        if (callback(buf, context) != 0)
+            goto out;
+
+        /* let the other threads work */
+        yield();
+    }
+
+    result = 0;
+
+out:
+    close(fd);
+    return result;
+}
+
 /*
  * Search specified directory for tracks and notify via callback.  May be
  * called recursively.
@@ -2244,6 +3051,20 @@ struct playlist_info *playlist_get_current(void)
     return &current_playlist;
 }
 
+#ifdef HAVE_DIRCACHE
+/*
+ * Returns how many tracks of the current playlist were found in the dircache
+ * by the last background scan, and out of how many. The result is true while
+ * references remain to be resolved.
+ */
+bool playlist_dc_scan_progress(int *resolved, int *total)
+{
+    *resolved = dc_scan_progress.resolved;
+    *total = dc_scan_progress.total;
+    return dc_scan_progress.pending;
+}
+#endif
+
 /* Returns index of current playing track for display purposes.  This value
    should not be used for resume purposes as it doesn't represent the actual
    index into the playlist */
@@ -2385,6 +3206,8 @@ int playlist_insert_context_create(struct playlist_info* playlist,
     context->initialized = false;
 
     dc_thread_stop(playlist);
+    pl_prepare_indices(playlist, global_settings.max_files_in_playlist,
+                       position == PLAYLIST_REPLACE);
     playlist_write_lock(playlist);
 
     if (check_control(playlist) < 0)
@@ -2410,6 +3233,19 @@ int playlist_insert_context_create(struct playlist_info* playlist,
     context->progress = progress;
     context->initialized = true;
 
+    /* batch the inserts unless an outer context already does */
+    context->batched = !pl_batch.playlist;
+    if (context->batched)
+    {
+        pl_batch.playlist = playlist;
+        /* only these keep inserting right after the previous track */
+        pl_batch.use_gap = position == PLAYLIST_INSERT ||
+                           position == PLAYLIST_INSERT_FIRST ||
+                           position == PLAYLIST_INSERT_LAST;
+        pl_batch.gap = -1;
+        pl_batch.ctllen = 0;
+    }
+
     if (queue)
         context->count_langid = LANG_PLAYLIST_QUEUE_COUNT;
     else
@@ -2448,7 +3284,11 @@ int playlist_insert_context_add(struct playlist_insert_context *context,
         if ((c->count) == PLAYLIST_DISPLAY_COUNT &&
             (audio_status() & AUDIO_STATUS_PLAY) &&
             c->playlist->started)
+        {
+            /* playback peeks at the index without taking the lock */
+            pl_batch_close_gap(c->playlist);
             audio_flush_and_reload_tracks();
+        }
     }
 
     return 0;
@@ -2462,7 +3302,17 @@ void playlist_insert_context_release(struct playlist_insert_context *context)
 
     struct playlist_info* playlist = context->playlist;
     if (context->initialized)
+    {
+        if (context->batched)
+        {
+            pl_batch_close_gap(playlist);
+            pl_batch_flush_control(playlist);
+            pl_batch.playlist = NULL;
+            pl_trim_indices(playlist);
+        }
+
         sync_control_unlocked(playlist);
+    }
     if (context->progress)
         display_playlist_count(context->count, ID2P(context->count_langid), true);
 
@@ -2497,6 +3347,11 @@ int playlist_insert_directory(struct playlist_info* playlist,
     return result;
 }
 
+static int insert_context_add_cb(char *filename, void *context)
+{
+    return playlist_insert_context_add(context, filename) < 0 ? -1 : 0;
+}
+
 /*
  * Insert all tracks from specified playlist into dynamic playlist.
  */
@@ -2518,6 +3373,13 @@ int playlist_insert_playlist(struct playlist_info* playlist, const char *filenam
 
     if (playlist_insert_context_create(playlist, &pl_context, position, queue, true) >= 0)
     {
+        if (playlist_is_binary_name(filename))
+        {
+            result = playlist_bin_tracksearch(filename, insert_context_add_cb,
+                                              &pl_context);
+            goto out;
+        }
+
         fd = open_utf8(filename, O_RDONLY);
         if (fd < 0)
         {
@@ -3094,6 +3956,8 @@ int playlist_resume(void)
 
     struct playlist_info* playlist = &current_playlist;
     dc_thread_stop(playlist);
+    pl_prepare_indices(playlist, global_settings.max_files_in_playlist,
+                       false);
     playlist_write_lock(playlist);
 
     if (core_allocatable() < (1 << 10))
@@ -3472,6 +4336,7 @@ int playlist_resume(void)
     }
 
 out:
+    pl_trim_indices(playlist);
     playlist_write_unlock(playlist);
     dc_thread_start(playlist, true);
 
@@ -3519,6 +4384,7 @@ int playlist_set_current(struct playlist_info* playlist)
         return result;
 
     dc_thread_stop(&current_playlist);
+    pl_prepare_indices(&current_playlist, playlist->amount, false);
     playlist_write_lock(&current_playlist);
 
     empty_playlist_unlocked(&current_playlist, false);
@@ -3548,8 +4414,13 @@ int playlist_set_current(struct playlist_info* playlist)
     current_playlist.dirlen = playlist->dirlen;
 
     if (playlist->indices && playlist->indices != current_playlist.indices)
+    {
+        if (!pl_reserve_indices(&current_playlist, playlist->amount))
+            goto out;
+
         memcpy((void*)current_playlist.indices, (void*)playlist->indices,
-               playlist->max_playlist_size*sizeof(*playlist->indices));
+               playlist->amount*sizeof(*playlist->indices));
+    }
     dc_init_filerefs(&current_playlist, 0, current_playlist.max_playlist_size);
 
     current_playlist.first_index = playlist->first_index;
@@ -3561,6 +4432,7 @@ int playlist_set_current(struct playlist_info* playlist)
     result = 0;
 
 out:
+    pl_trim_indices(&current_playlist);
     playlist_write_unlock(&current_playlist);
     dc_thread_start(&current_playlist, true);
 
@@ -3727,6 +4599,101 @@ static int pl_get_tempname(const char *filename, char *buf, size_t bufsz)
     return 0;
 }
 
+/* state of a binary playlist being written */
+struct pl_bin_writer
+{
+    char dir[MAX_PATH];     /* directory of the last track written */
+    uint32_t diroff;        /* and its offset */
+};
+
+/*
+ * Append a track to a binary playlist being saved at 'offset', writing its
+ * directory first if it differs from the previous track's. Returns the
+ * number of bytes written and the offset of the track record in *trackoff.
+ */
+static int pl_bin_write_track(int fd, off_t offset, const char *path,
+                              struct pl_bin_writer *w, off_t *trackoff)
+{
+    const char *name = strrchr(path, PATH_SEPCH);
+    if (!name)
+        return -1;
+
+    /* keep the separator for the root only */
+    size_t dirlen = MAX(name - path, 1);
+    name++;
+
+    int written = 0;
+
+    if (strncmp(w->dir, path, dirlen) || w->dir[dirlen] != '\0')
+    {
+        if (dirlen >= sizeof (w->dir))
+            return -1;
+
+        strmemccpy(w->dir, path, dirlen + 1);
+        if (write(fd, w->dir, dirlen + 1) != (ssize_t)(dirlen + 1))
+            return -1;
+
+        w->diroff = offset;
+        written = dirlen + 1;
+    }
+
+    struct playlist_bin_track track = { .dir = w->diroff, .idx_id = -1 };
+    size_t namelen = strlen(name) + 1;
+
+    if (write(fd, &track, sizeof (track)) != sizeof (track) ||
+        write(fd, name, namelen) != (ssize_t)namelen)
+        return -1;
+
+    *trackoff = offset + written;
+    return written + sizeof (track) + namelen;
+}
+
+/*
+ * Finish a binary playlist by writing the table of track offsets, which are
+ * by now the seek offsets of the saved tracks, and the header.
+ */
+static int pl_bin_write_table(struct playlist_info* playlist, int fd,
+                              off_t offset, int num_saved)
+{
+    uint32_t table[64];
+    int count = 0;
+    int index = playlist->first_index;
+
+    for (int i = 0; i < playlist->amount; ++i, ++index)
+    {
+        if (index == playlist->amount)
+            index = 0;
+
+        if (playlist->indices[index] & PLAYLIST_QUEUED)
+            continue;
+
+        table[count++] = playlist->indices[index] & PLAYLIST_SEEK_MASK;
+        if (count == ARRAYLEN(table))
+        {
+            if (write(fd, table, sizeof (table)) != sizeof (table))
+                return -1;
+            count = 0;
+        }
+    }
+
+    if (write(fd, table, count * sizeof (*table)) !=
+            (ssize_t)(count * sizeof (*table)))
+        return -1;
+
+    struct playlist_bin_header hdr =
+    {
+        .magic  = PLAYLIST_BIN_MAGIC,
+        .amount = num_saved,
+        .table  = offset,
+    };
+
+    if (lseek(fd, 0, SEEK_SET) != 0 ||
+        write(fd, &hdr, sizeof (hdr)) != sizeof (hdr))
+        return -1;
+
+    return 0;
+}
+
 /*
  * Save all non-queued tracks to an M3U playlist with the given filename.
  * On success, the playlist is updated to point to the new playlist file.
@@ -3740,8 +4707,10 @@ static int pl_save_playlist(struct playlist_info* playlist,
                             char *tmpbuf, size_t tmpsize)
 {
     int fd, index, num_saved;
-    off_t offset;
+    off_t offset, trackoff;
     int ret, err;
+    bool binary = playlist_is_binary_name(filename);
+    static struct pl_bin_writer bin_writer;
 
     if (pl_get_tempname(filename, tmpbuf, tmpsize))
         return -1;
@@ -3758,6 +4727,19 @@ static int pl_save_playlist(struct playlist_info* playlist,
     if (fd < 0)
         return -1;
 
+    if (binary)
+    {
+        /* the header is written last, once the table is in place */
+        struct playlist_bin_header hdr = { .magic = 0 };
+        if (write(fd, &hdr, sizeof (hdr)) != sizeof (hdr))
+        {
+            err = -3;
+            goto error;
+        }
+
+        bin_writer.dir[0] = '\0';
+    }
+
     offset = lseek(fd, 0, SEEK_CUR);
     index = playlist->first_index;
     num_saved = 0;
@@ -3786,18 +4768,28 @@ static int pl_save_playlist(struct playlist_info* playlist,
             goto error;
         }
 
-        /* Update seek offset so it points into the new file. */
-        playlist->indices[index] &= ~PLAYLIST_INSERT_TYPE_MASK;
-        playlist->indices[index] &= ~PLAYLIST_SEEK_MASK;
-        playlist->indices[index] |= offset;
+        if (binary)
+        {
+            ret = pl_bin_write_track(fd, offset, tmpbuf, &bin_writer,
+                                     &trackoff);
+        }
+        else
+        {
+            ret = fdprintf(fd, "%s\n", tmpbuf);
+            trackoff = offset;
+        }
 
-        ret = fdprintf(fd, "%s\n", tmpbuf);
         if (ret < 0)
         {
             err = -3;
             goto error;
         }
 
+        /* Update seek offset so it points into the new file. */
+        playlist->indices[index] &= ~PLAYLIST_INSERT_TYPE_MASK;
+        playlist->indices[index] &= ~PLAYLIST_SEEK_MASK;
+        playlist->indices[index] |= trackoff;
+
         offset += ret;
         num_saved++;
 
@@ -3805,6 +4797,12 @@ static int pl_save_playlist(struct playlist_info* playlist,
             display_playlist_count(num_saved, ID2P(LANG_PLAYLIST_SAVE_COUNT), false);
     }
 
+    if (binary && pl_bin_write_table(playlist, fd, offset, num_saved) < 0)
+    {
+        err = -3;
+        goto error;
+    }
+
     display_playlist_count(num_saved, ID2P(LANG_PLAYLIST_SAVE_COUNT), true);
     close(fd);
     pl_close_playlist(playlist);
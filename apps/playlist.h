@@ -37,6 +37,7 @@
 #define PLAYLIST_DISPLAY_COUNT  10
 
 #define PLAYLIST_UNTITLED_PREFIX "Playlist "
+#define PLAYLIST_BIN_EXT         ".rbpl" /* compact binary playlist */
 
 #define PLAYLIST_FLAG_MODIFIED (1u << 0) /* playlist was manually modified */
 #define PLAYLIST_FLAG_DIRPLAY  (1u << 1) /* enable directory skipping */
@@ -70,12 +71,14 @@ struct playlist_info
 {
     bool utf8;           /* playlist is in .m3u8 format             */
     bool control_created; /* has control file been created?         */
+    bool binary;         /* playlist is in the compact binary format */
     unsigned int flags;  /* flags for misc. state */
     int  fd;             /* descriptor of the open playlist file    */
     int  control_fd;     /* descriptor of the open control file     */
-    int  max_playlist_size; /* Max number of files in playlist. Mirror of
+    int  max_playlist_size; /* Number of files the index has room for; the
+                              current playlist grows this on demand up to
                               global_settings.max_files_in_playlist */
-    unsigned long *indices; /* array of indices            */
+    uint32_t *indices;   /* array of indices (offset and flags)     */
 
     int  index;          /* index of current playing track          */
     int  first_index;    /* index of first song in playlist         */
@@ -109,6 +112,7 @@ struct playlist_insert_context {
     bool queue;
     bool progress;
     bool initialized;
+    bool batched;   /* this context opened the insert batch */
     int count;
     int32_t count_langid;
 };
@@ -136,6 +140,9 @@ int playlist_amount(void);
 void playlist_set_last_shuffled_start(void);
 struct playlist_info *playlist_get_current(void);
 bool playlist_dynamic_only(void);
+#ifdef HAVE_DIRCACHE
+bool playlist_dc_scan_progress(int *resolved, int *total);
+#endif
 
 /* Exported functions for all playlists.  Pass NULL for playlist_info
    structure to work with current playlist. */
@@ -183,6 +190,9 @@ int playlist_save(struct playlist_info* playlist, char *filename);
 int playlist_directory_tracksearch(const char* dirname, bool recurse,
                                    int (*callback)(char*, void*),
                                    void* context);
+bool playlist_is_binary_name(const char *filename);
+int playlist_bin_tracksearch(const char *filename,
+                             int (*callback)(char*, void*), void *context);
 int playlist_remove_all_tracks(struct playlist_info *playlist);
 
 #endif /* __PLAYLIST_H__ */
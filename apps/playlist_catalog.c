@@ -306,6 +306,20 @@ static int add_to_playlist(const char* playlist, bool new_playlist,
         if (fdprintf(fd, "%s\n", sel) > 0)
             result = 0;
     }
+    else if ((sel_attr & FILE_ATTR_MASK) == FILE_ATTR_M3U &&
+             playlist_is_binary_name(sel))
+    {
+        /* append the tracks of a binary playlist as text */
+        struct add_track_context context;
+        context.fd = fd;
+        context.count = 0;
+
+        display_insert_count(0);
+
+        result = playlist_bin_tracksearch(sel, add_track_to_playlist, &context);
+
+        display_insert_count(context.count);
+    }
     else if ((sel_attr & FILE_ATTR_MASK) == FILE_ATTR_M3U)
     {
         /* append playlist */
@@ -384,10 +398,14 @@ bool catalog_view_playlists(void)
     return (display_playlists(NULL, CATBROWSE_CATVIEW) >= 0);
 }
 
-static void apply_playlist_extension(char* buf, size_t buf_size)
+static void apply_playlist_extension(char* buf, size_t buf_size, bool binary)
 {
     size_t len = strlen(buf);
-    if(len > 4 && !strcasecmp(&buf[len-4], ".m3u"))
+    if (playlist_is_binary_name(buf))
+        return;
+    else if (binary)
+        strlcat(buf, PLAYLIST_BIN_EXT, buf_size);
+    else if(len > 4 && !strcasecmp(&buf[len-4], ".m3u"))
         strlcat(buf, "8", buf_size);
     else if(len <= 5 || strcasecmp(&buf[len-5], ".m3u8"))
         strlcat(buf, ".m3u8", buf_size);
@@ -408,11 +426,13 @@ bool catalog_pick_new_playlist_name(char *pl_name, size_t buf_size,
 {
     char bmark_file[MAX_PATH + 7];
     bool do_save = false;
+    /* keep the format the name was suggested in */
+    bool binary = playlist_is_binary_name(pl_name);
     while (!do_save && !remove_extension(pl_name) &&
            !kbd_input(pl_name, buf_size - 7, NULL))
     {
         do_save = true;
-        apply_playlist_extension(pl_name, buf_size);
+        apply_playlist_extension(pl_name, buf_size, binary);
 
         /* warn before overwriting existing (different) playlist */
         if (!curr_pl_name || strcmp(curr_pl_name, pl_name))
@@ -464,7 +484,7 @@ bool catalog_add_to_a_playlist(const char* sel, int sel_attr,
             else
             {
                 strlcat(playlist, name, sizeof(playlist));
-                apply_playlist_extension(playlist, sizeof(playlist));
+                apply_playlist_extension(playlist, sizeof(playlist), false);
             }
         }
         else
@@ -479,6 +499,14 @@ bool catalog_add_to_a_playlist(const char* sel, int sel_attr,
             return false;
     }
 
+    /* tracks are appended as text; binary playlists are written by saving
+       a playlist only */
+    if (playlist_is_binary_name(playlist))
+    {
+        splash(HZ*2, ID2P(LANG_FAILED));
+        return false;
+    }
+
     if (add_to_pl_cb != NULL)
     {
         ctx_add_to_playlist = add_to_pl_cb;
@@ -390,22 +390,26 @@ static bool playlist_viewer_init(struct playlist_viewer * viewer,
         }
         viewer->title = file;
 
-        if (is_playing)
-        {
-            /* Something is playing, try to accommodate
-            *  global_settings.max_files_in_playlist entries */
-            index_buffer_size = playlist_get_required_bufsz(viewer->playlist,
-                                   false, global_settings.max_files_in_playlist);
+        /* Try to accommodate global_settings.max_files_in_playlist entries
+           but leave at least half of the buffer for the track names. The
+           current playlist's index only has room for what it holds, so it
+           can't be shared. */
+        index_buffer_size = playlist_get_required_bufsz(viewer->playlist,
+                               false, global_settings.max_files_in_playlist);
 
-            if ((unsigned)index_buffer_size >= buffer_size - MAX_PATH)
-                index_buffer_size = buffer_size - (MAX_PATH + 1);
+        if ((size_t)index_buffer_size > buffer_size / 2)
+            index_buffer_size = buffer_size / 2;
 
-            index_buffer = buffer;
-        }
+        index_buffer = buffer;
 
-        playlist_create_ex(viewer->playlist, dir, file, index_buffer,
-            index_buffer_size, buffer+index_buffer_size,
-            buffer_size-index_buffer_size);
+        if (playlist_create_ex(viewer->playlist, dir, file, index_buffer,
+                index_buffer_size, buffer+index_buffer_size,
+                buffer_size-index_buffer_size) < 0)
+        {
+            if (temp_ptr)
+                *temp_ptr = '/';
+            return false;
+        }
 
         if (temp_ptr)
             *temp_ptr = '/';
@@ -837,6 +837,13 @@ static const struct plugin_api rockbox_api = {
 #endif
     playlist_get_first_index,
     playlist_get_display_index,
+#ifdef HAVE_DIRCACHE
+    dircache_suspend,
+    dircache_resume,
+    dircache_get_info,
+#endif
+    playlist_is_binary_name,
+    playlist_bin_tracksearch,
 };
 
 static int plugin_buffer_handle;
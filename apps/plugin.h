@@ -120,6 +120,10 @@ int plugin_open(const char *plugin, const char *parameter);
 #include "albumart.h"
 #endif
 
+#ifdef HAVE_DIRCACHE
+#include "dircache.h"
+#endif
+
 #ifdef HAVE_REMOTE_LCD
 #include "lcd-remote.h"
 #endif
@@ -163,7 +167,7 @@ int plugin_open(const char *plugin, const char *parameter);
  * when this happens please take the opportunity to sort in
  * any new functions "waiting" at the end of the list.
  */
-#define PLUGIN_API_VERSION 270
+#define PLUGIN_API_VERSION 272
 
 /* 239 Marks the removal of ARCHOS HWCODEC and CHARCELL */
 
@@ -974,6 +978,15 @@ struct plugin_api {
 #endif
     int (*playlist_get_first_index)(const struct playlist_info* playlist);
     int (*playlist_get_display_index)(void);
+#ifdef HAVE_DIRCACHE
+    void (*dircache_suspend)(void);
+    int (*dircache_resume)(void);
+    void (*dircache_get_info)(struct dircache_info *info);
+#endif
+    bool (*playlist_is_binary_name)(const char *filename);
+    int (*playlist_bin_tracksearch)(const char *filename,
+                                    int (*callback)(char*, void*),
+                                    void *context);
 };
 
 /* plugin header */
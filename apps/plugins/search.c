@@ -39,6 +39,8 @@ static int buffer_pos; /* Position of the buffer in the file */
 
 static int line_end;   /* Index of the end of line */
 
+static bool binary;    /* compact binary playlist, read through the core */
+
 char resultfile[MAX_PATH];
 char path[MAX_PATH];
 
@@ -94,6 +96,24 @@ static void fill_buffer(int pos){
     DEBUGF("\n-------------------\n");
 }
 
+static int search_track(char *filename, void *context){
+    const char crlf = '\n';
+    char *p;
+    (void)context;
+
+    for (p = filename; *p; p++) {
+        if (tolower(*p) == tolower(search_string[0]) &&
+            strpcasecmp(&search_string[0], p)) {
+            rb->write(fdw, filename, rb->strlen(filename));
+            rb->write(fdw, &crlf, 1);
+            results++;
+            break;
+        }
+    }
+
+    return 0;
+}
+
 static void search_buffer(void){
     buffer_pos = 0;
 
@@ -114,23 +134,32 @@ static bool search_init(const char* file){
     if (!rb->kbd_input(search_string,sizeof(search_string), NULL)){
         clear_display();
         rb->splash(0, "Searching...");
-        fd = rb->open_utf8(file, O_RDONLY);
-        if (fd < 0)
-            return false;
-
-        bomsize = rb->lseek(fd, 0, SEEK_CUR);
-        if (bomsize)
+        if (binary) {
+            /* the paths in a binary playlist are UTF-8 */
+            fd = -1;
             fdw = rb->open_utf8(resultfile, O_WRONLY|O_CREAT|O_TRUNC);
-        else
-            fdw = rb->open(resultfile, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        }
+        else {
+            fd = rb->open_utf8(file, O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            bomsize = rb->lseek(fd, 0, SEEK_CUR);
+            if (bomsize)
+                fdw = rb->open_utf8(resultfile, O_WRONLY|O_CREAT|O_TRUNC);
+            else
+                fdw = rb->open(resultfile, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        }
 
         if (fdw < 0) {
             rb->splash(HZ, "Failed to create result file!");
-            rb->close(fd);
+            if (fd >= 0)
+                rb->close(fd);
             return false;
         }
 
-        file_size = rb->lseek(fd, 0, SEEK_END) - bomsize;
+        if (!binary)
+            file_size = rb->lseek(fd, 0, SEEK_END) - bomsize;
 
         return true;
     }
@@ -147,11 +176,12 @@ enum plugin_status plugin_start(const void* parameter)
     if(!parameter) return PLUGIN_ERROR;
 
     DEBUGF("%s - %s\n", (char *)parameter, &filename[rb->strlen(filename)-4]);
-    /* Check the extension. We only allow .m3u files. */
-    if (!(p = rb->strrchr(filename, '.')) ||
-        (rb->strcasecmp(p, ".m3u") && rb->strcasecmp(p, ".m3u8")))
+    /* Check the extension. We only allow playlist files. */
+    binary = rb->playlist_is_binary_name(filename);
+    if (!binary && (!(p = rb->strrchr(filename, '.')) ||
+        (rb->strcasecmp(p, ".m3u") && rb->strcasecmp(p, ".m3u8"))))
     {
-        rb->splash(HZ, "Not a .m3u or .m3u8 file");
+        rb->splash(HZ, "Not a .m3u, .m3u8 or .rbpl file");
         return PLUGIN_ERROR;
     }
 
@@ -165,12 +195,16 @@ enum plugin_status plugin_start(const void* parameter)
     ok = search_init(parameter);
     if (!ok)
         return PLUGIN_ERROR;
-    search_buffer();
+    if (binary)
+        rb->playlist_bin_tracksearch(filename, search_track, NULL);
+    else
+        search_buffer();
 
     clear_display();
     rb->splash(HZ, "Done");
     rb->close(fdw);
-    rb->close(fd);
+    if (fd >= 0)
+        rb->close(fd);
     rb->reload_directory();
 
     return PLUGIN_OK;
@@ -33,6 +33,11 @@
 #else
 #define TEST_SIZE (300*1024*1024)
 #endif
+#if (CONFIG_STORAGE & STORAGE_RAMDISK)
+#define SEEK_TEST_SIZE (4*1024*1024)
+#else
+#define SEEK_TEST_SIZE (32*1024*1024)
+#endif
 #define TEST_TIME 10 /* in seconds */
 
 static unsigned char* audiobuf;
@@ -43,6 +48,8 @@ static int line = 0;
 static int max_line = 0;
 static int log_fd;
 static char logfilename[MAX_PATH];
+static int csv_fd = -1;
+static char csvfilename[MAX_PATH];
 static const char testbasedir[] = TESTBASEDIR;
 
 static void mem_fill_frnd(unsigned char *addr, int len)
@@ -106,6 +113,32 @@ static void log_close(void)
     rb->close(log_fd);
 }
 
+/* Machine-readable results, one row per measurement; the build is repeated
+ * on each row so the files of several builds can simply be concatenated */
+static void csv_init(void)
+{
+    rb->create_numbered_filename(csvfilename, HOME_DIR, "test_disk_", ".csv",
+                                 2 IF_CNFN_NUM_(, NULL));
+    csv_fd = rb->open(csvfilename, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (csv_fd >= 0)
+        rb->fdprintf(csv_fd, "build,test,size,value,unit\n");
+}
+
+static void csv_result(const char *test, long size, long value,
+                       const char *unit)
+{
+    if (csv_fd >= 0)
+        rb->fdprintf(csv_fd, "%s,%s,%ld,%ld,%s\n", rb->rbversion, test, size,
+                     value, unit);
+}
+
+static void csv_close(void)
+{
+    if (csv_fd >= 0)
+        rb->close(csv_fd);
+    csv_fd = -1;
+}
+
 static bool test_fs(void)
 {
     unsigned char text_buf[32];
@@ -236,6 +269,8 @@ static bool file_speed(int chunksize, bool align)
     rb->snprintf(text_buf, sizeof text_buf, "Create (%d,%c): %ld KB/s",
                  chunksize, align ? 'A' : 'U', (25 * (filesize>>8) / time) );
     log_text(text_buf, true);
+    csv_result(align ? "create" : "create_unaligned", chunksize,
+               25 * (filesize>>8) / time, "KB/s");
 
     /* Existing file write speed */
     fd = rb->open(TEST_FILE, O_WRONLY);
@@ -260,6 +295,8 @@ static bool file_speed(int chunksize, bool align)
     rb->snprintf(text_buf, sizeof text_buf, "Write  (%d,%c): %ld KB/s",
                  chunksize, align ? 'A' : 'U', (25 * (filesize>>8) / time) );
     log_text(text_buf, true);
+    csv_result(align ? "write" : "write_unaligned", chunksize,
+               25 * (filesize>>8) / time, "KB/s");
     
     /* File read speed */
     fd = rb->open(TEST_FILE, O_RDONLY);
@@ -284,6 +321,8 @@ static bool file_speed(int chunksize, bool align)
     rb->snprintf(text_buf, sizeof text_buf, "Read   (%d,%c): %ld KB/s",
                  chunksize, align ? 'A' : 'U', (25 * (filesize>>8) / time) );
     log_text(text_buf, true);
+    csv_result(align ? "read" : "read_unaligned", chunksize,
+               25 * (filesize>>8) / time, "KB/s");
     rb->remove(TEST_FILE);
     return true;
 
@@ -292,64 +331,187 @@ static bool file_speed(int chunksize, bool align)
     return false;
 }
 
-static bool test_speed(void)
+/* Reads or overwrites whole chunks at random chunk-aligned positions of the
+ * seek test file; returns the throughput in KB/s or < 0 on failure */
+static long random_speed(int fd, int chunksize, bool dowrite)
+{
+    long bytes = 0;
+    long time = *rb->current_tick;
+
+    while (TIME_BEFORE(*rb->current_tick, time + TEST_TIME*HZ))
+    {
+        long pos = (rb->rand() % (SEEK_TEST_SIZE / chunksize)) *
+                   (long)chunksize;
+        int ret = -1;
+
+        if (rb->lseek(fd, pos, SEEK_SET) == pos)
+        {
+            ret = dowrite ? rb->write(fd, audiobuf, chunksize)
+                        : rb->read(fd, audiobuf, chunksize);
+        }
+
+        if (ret != chunksize)
+        {
+            rb->splashf(0, "random %s failed at %ld",
+                        dowrite ? "write" : "read", pos);
+            return -1;
+        }
+
+        bytes += chunksize;
+    }
+
+    time = *rb->current_tick - time;
+    return (bytes >> 10) * HZ / time;
+}
+
+/* Random and backward seeks, each followed by a single sector read. On a
+ * ramdisk this mostly measures the cluster chain lookup in fat_seek(). */
+static bool seek_speed(void)
 {
     unsigned char text_buf[64];
-    DIR *dir = NULL;
-    struct dirent *entry = NULL;
-    int fd, last_file;
-    int i, n;
-    long time;
+    int fd, ret, chunksize;
+    long size, pos, time;
+    int n;
 
-    rb->memset(audiobuf, 'T', audiobuflen);
-    log_init();
-    log_text("test_disk SPEED TEST", true);
-#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
-    rb->snprintf(text_buf, sizeof(text_buf), "CPU clock: %ld Hz",
-                 *rb->cpu_frequency);
-    log_text(text_buf, true);
-#endif
     log_text("--------------------", true);
 
-    /* File creation speed */
+    fd = rb->creat(TEST_FILE, 0666);
+    if (fd < 0)
+    {
+        rb->splashf(HZ, "creat() failed: %d", fd);
+        goto error;
+    }
+    chunksize = MIN(audiobuflen, 65536);
+    for (size = SEEK_TEST_SIZE; size > 0; size -= chunksize)
+    {
+        ret = rb->write(fd, audiobuf, chunksize);
+        if (chunksize != ret)
+        {
+            rb->splashf(HZ, "write() failed: %d/%d", ret, chunksize);
+            rb->close(fd);
+            goto error;
+        }
+    }
+    rb->close(fd);
+
+    fd = rb->open(TEST_FILE, O_RDONLY);
+    if (fd < 0)
+    {
+        rb->splashf(0, "open() failed: %d", fd);
+        goto error;
+    }
+
+    /* random positions */
     time = *rb->current_tick + TEST_TIME*HZ;
-    for (i = 0; TIME_BEFORE(*rb->current_tick, time); i++)
+    for (n = 0; TIME_BEFORE(*rb->current_tick, time); n++)
     {
-        rb->snprintf(text_buf, sizeof(text_buf), TESTBASEDIR "/%08x.tmp", i);
-        fd = rb->creat(text_buf, 0666);
-        if (fd < 0)
+        pos = (rb->rand() % (SEEK_TEST_SIZE / 512)) * 512L;
+        if (rb->lseek(fd, pos, SEEK_SET) != pos
+            || rb->read(fd, audiobuf, 512) != 512)
         {
-            last_file = i;
-            rb->splashf(HZ, "creat() failed: %d", fd);
+            rb->splashf(0, "seek/read failed at %ld", pos);
+            rb->close(fd);
             goto error;
         }
-        rb->close(fd);
     }
-    last_file = i;
-    rb->snprintf(text_buf, sizeof(text_buf), "Create:  %d files/s",
-                 last_file / TEST_TIME);
+    rb->snprintf(text_buf, sizeof text_buf, "Seek random: %d seeks/s",
+                 n / TEST_TIME);
     log_text(text_buf, true);
-    
-    /* File open speed */
+    csv_result("seek_random", 512, n / TEST_TIME, "seeks/s");
+
+    /* stepping backwards from the end, one 4KB step at a time */
+    pos = SEEK_TEST_SIZE;
     time = *rb->current_tick + TEST_TIME*HZ;
+    for (n = 0; TIME_BEFORE(*rb->current_tick, time); n++)
+    {
+        pos -= 4096;
+        if (pos < 0)
+            pos = SEEK_TEST_SIZE - 4096;
+        if (rb->lseek(fd, pos, SEEK_SET) != pos
+            || rb->read(fd, audiobuf, 512) != 512)
+        {
+            rb->splashf(0, "seek/read failed at %ld", pos);
+            rb->close(fd);
+            goto error;
+        }
+    }
+    rb->close(fd);
+    rb->snprintf(text_buf, sizeof text_buf, "Seek back:   %d seeks/s",
+                 n / TEST_TIME);
+    log_text(text_buf, true);
+    csv_result("seek_back", 512, n / TEST_TIME, "seeks/s");
+
+    /* random whole-chunk reads and overwrites at several sizes */
+    static const int random_sizes[] = { 512, 4096, 65536 };
+    for (unsigned int i = 0; i < ARRAYLEN(random_sizes); i++)
+    {
+        chunksize = random_sizes[i];
+        if ((unsigned)chunksize > audiobuflen)
+            break;
+
+        for (int dowrite = 0; dowrite <= 1; dowrite++)
+        {
+            fd = rb->open(TEST_FILE, dowrite ? O_WRONLY : O_RDONLY);
+            if (fd < 0)
+            {
+                rb->splashf(0, "open() failed: %d", fd);
+                goto error;
+            }
+
+            long speed = random_speed(fd, chunksize, dowrite);
+            rb->close(fd);
+            if (speed < 0)
+                goto error;
+
+            rb->snprintf(text_buf, sizeof text_buf, "Random %s (%d): %ld KB/s",
+                         dowrite ? "wrt" : "rd ", chunksize, speed);
+            log_text(text_buf, true);
+            csv_result(dowrite ? "random_write" : "random_read", chunksize,
+                       speed, "KB/s");
+        }
+    }
+
+    rb->remove(TEST_FILE);
+    return true;
+
+  error:
+    rb->remove(TEST_FILE);
+    return false;
+}
+
+/* Open speed over the files made by test_speed(); returns files/s or < 0 */
+static int open_speed(int last_file)
+{
+    char path[MAX_PATH];
+    long time = *rb->current_tick + TEST_TIME*HZ;
+    int i, n;
+
     for (n = 0, i = 0; TIME_BEFORE(*rb->current_tick, time); n++, i++)
     {
         if (i >= last_file)
             i = 0;
-        rb->snprintf(text_buf, sizeof(text_buf), TESTBASEDIR "/%08x.tmp", i);
-        fd = rb->open(text_buf, O_RDONLY);
+        rb->snprintf(path, sizeof(path), TESTBASEDIR "/%08x.tmp", i);
+        int fd = rb->open(path, O_RDONLY);
         if (fd < 0)
         {
             rb->splashf(HZ, "open() failed: %d", fd);
-            goto error;
+            return -1;
         }
         rb->close(fd);
     }
-    rb->snprintf(text_buf, sizeof(text_buf), "Open:    %d files/s", n / TEST_TIME);
-    log_text(text_buf, true);
 
-    /* Directory scan speed */
-    time = *rb->current_tick + TEST_TIME*HZ;
+    return n / TEST_TIME;
+}
+
+/* Repeated enumeration of the test directory, optionally fetching the
+ * entry info as well; returns entries/s or < 0 */
+static int dirscan_speed(bool info)
+{
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+    long time = *rb->current_tick + TEST_TIME*HZ;
+    int n;
+
     for (n = 0; TIME_BEFORE(*rb->current_tick, time); n++)
     {
         if (entry == NULL)
@@ -360,39 +522,127 @@ static bool test_speed(void)
             if (dir == NULL)
             {
                 rb->splash(HZ, "opendir() failed.");
-                goto error;
+                return -1;
             }
         }
+        else if (info)
+            (void) rb->dir_get_info(dir, entry);
         entry = rb->readdir(dir);
     }
     rb->closedir(dir);
-    rb->snprintf(text_buf, sizeof(text_buf), "Dirscan: %d files/s", n / TEST_TIME);
+
+    return n / TEST_TIME;
+}
+
+/* Path lookup and directory enumeration speed; "suffix" tells the runs with
+ * and without dircache apart in the results */
+static bool dir_speed(int last_file, const char *suffix)
+{
+    unsigned char text_buf[64];
+    char test[32];
+    int n;
+
+    n = open_speed(last_file);
+    if (n < 0)
+        return false;
+    rb->snprintf(text_buf, sizeof(text_buf), "Open%s: %d files/s", suffix, n);
+    log_text(text_buf, true);
+    rb->snprintf(test, sizeof(test), "open%s", suffix);
+    csv_result(test, last_file, n, "files/s");
+
+    n = dirscan_speed(false);
+    if (n < 0)
+        return false;
+    rb->snprintf(text_buf, sizeof(text_buf), "Dirscan%s: %d files/s",
+                 suffix, n);
     log_text(text_buf, true);
+    rb->snprintf(test, sizeof(test), "dirscan%s", suffix);
+    csv_result(test, last_file, n, "files/s");
+
+    n = dirscan_speed(true);
+    if (n < 0)
+        return false;
+    rb->snprintf(text_buf, sizeof(text_buf), "Dirscan w info%s: %d files/s",
+                 suffix, n);
+    log_text(text_buf, true);
+    rb->snprintf(test, sizeof(test), "dirscan_info%s", suffix);
+    csv_result(test, last_file, n, "files/s");
+
+    return true;
+}
+
+#ifdef HAVE_DIRCACHE
+static bool dircache_ready(void)
+{
+    struct dircache_info info;
+    rb->dircache_get_info(&info);
+    return info.status == DIRCACHE_READY;
+}
+
+/* Repeat the directory tests with the cache suspended, then let it rebuild
+ * before going on so the scan doesn't skew the remaining tests */
+static bool dir_speed_nodircache(int last_file)
+{
+    if (!dircache_ready())
+        return true; /* disabled or still building; nothing to compare */
+
+    rb->dircache_suspend();
+    bool ret = dir_speed(last_file, "_nodircache");
+    rb->dircache_resume();
 
-    dir = NULL;
-    entry = NULL;
-    /* Directory scan speed 2 */
+    log_text("Waiting for dircache", false);
+    while (!dircache_ready())
+        rb->sleep(HZ/10);
+
+    return ret;
+}
+#endif /* HAVE_DIRCACHE */
+
+static bool test_speed(void)
+{
+    unsigned char text_buf[64];
+    int fd, last_file;
+    int i;
+    long time;
+
+    rb->memset(audiobuf, 'T', audiobuflen);
+    log_init();
+    csv_init();
+    log_text("test_disk SPEED TEST", true);
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+    rb->snprintf(text_buf, sizeof(text_buf), "CPU clock: %ld Hz",
+                 *rb->cpu_frequency);
+    log_text(text_buf, true);
+#endif
+    log_text("--------------------", true);
+
+    /* File creation speed */
     time = *rb->current_tick + TEST_TIME*HZ;
-    for (n = 0; TIME_BEFORE(*rb->current_tick, time); n++)
+    for (i = 0; TIME_BEFORE(*rb->current_tick, time); i++)
     {
-        if (entry == NULL)
+        rb->snprintf(text_buf, sizeof(text_buf), TESTBASEDIR "/%08x.tmp", i);
+        fd = rb->creat(text_buf, 0666);
+        if (fd < 0)
         {
-            if (dir != NULL)
-                rb->closedir(dir);
-            dir = rb->opendir(testbasedir);
-            if (dir == NULL)
-            {
-                rb->splash(HZ, "opendir() failed.");
-                goto error;
-            }
+            last_file = i;
+            rb->splashf(HZ, "creat() failed: %d", fd);
+            goto error;
         }
-        else
-            (void) rb->dir_get_info(dir, entry);
-        entry = rb->readdir(dir);
+        rb->close(fd);
     }
-    rb->closedir(dir);
-    rb->snprintf(text_buf, sizeof(text_buf), "Dirscan w info: %d files/s", n / TEST_TIME);
+    last_file = i;
+    rb->snprintf(text_buf, sizeof(text_buf), "Create:  %d files/s",
+                 last_file / TEST_TIME);
     log_text(text_buf, true);
+    csv_result("create_files", 0, last_file / TEST_TIME, "files/s");
+
+    if (!dir_speed(last_file, ""))
+        goto error;
+
+#ifdef HAVE_DIRCACHE
+    if (!dir_speed_nodircache(last_file))
+        goto error;
+#endif
 
     /* File delete speed */
     time = *rb->current_tick;
@@ -401,19 +651,24 @@ static bool test_speed(void)
         rb->snprintf(text_buf, sizeof(text_buf), TESTBASEDIR "/%08x.tmp", i);
         rb->remove(text_buf);
     }
+    time = MAX(*rb->current_tick - time, 1);
     rb->snprintf(text_buf, sizeof(text_buf), "Delete:  %ld files/s",
-                 last_file * HZ / (*rb->current_tick - time));
+                 last_file * HZ / time);
     log_text(text_buf, true);
+    csv_result("delete_files", last_file, last_file * HZ / time, "files/s");
     
     if (file_speed(512, true)
         && file_speed(512, false)
         && file_speed(4096, true)
         && file_speed(4096, false)
-        && file_speed(1048576, true))
-        file_speed(1048576, false);
+        && file_speed(65536, true)
+        && file_speed(1048576, true)
+        && file_speed(1048576, false))
+        seek_speed();
 
     log_text("DONE", false);
     log_close();
+    csv_close();
     rb->button_clear_queue();
     rb->button_get(true);
     return false;
@@ -426,6 +681,7 @@ static bool test_speed(void)
     }
     log_text("DONE", false);
     log_close();
+    csv_close();
     rb->button_clear_queue();
     rb->button_get(true);
     return false;
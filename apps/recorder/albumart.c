@@ -30,6 +30,12 @@
 #include "pathfuncs.h"
 #include "settings.h"
 #include "wps.h"
+#ifndef PLUGIN
+#include "bmp.h"
+#include "crc32.h"
+#include "dir.h"
+#include "file.h"
+#endif
 
 /* Define LOGF_ENABLE to enable logf output in this file */
 /*#define LOGF_ENABLE*/
@@ -77,6 +83,141 @@ static char* strip_filename(char* buf, int buf_size, const char* fullpath)
     return (sep + 1);
 }
 
+#ifndef PLUGIN
+/* A track change probes a dozen or more candidate names in a few
+ * directories, and without dircache each probe can go to the disk. Instead
+ * each directory is listed once and the image files in it remembered, which
+ * covers the current and next tracks. */
+#define AA_DIR_SLOTS    4
+#define AA_DIR_NAMESIZE 1024
+
+static struct aa_dir
+{
+    char path[MAX_PATH];    /* directory, with trailing '/' */
+    bool overflow;          /* too many images to list: probe the file */
+    unsigned long age;      /* for replacing the least recently used */
+    size_t used;
+    char names[AA_DIR_NAMESIZE]; /* image files, each 0-terminated */
+} aa_dirs[AA_DIR_SLOTS];
+static unsigned long aa_dir_age;
+/* listing a directory yields, and both playback and plugins look up art */
+static struct mutex aa_dir_mutex;
+
+static bool is_image_name(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    return ext && (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg") ||
+                   !strcasecmp(ext, ".bmp"));
+}
+
+static struct aa_dir * aa_dir_get(const char *dirpath, size_t dirlen)
+{
+    struct aa_dir *d = &aa_dirs[0];
+
+    for (int i = 0; i < AA_DIR_SLOTS; i++)
+    {
+        struct aa_dir *s = &aa_dirs[i];
+        if (s->age && !strncmp(s->path, dirpath, dirlen) && !s->path[dirlen])
+        {
+            s->age = ++aa_dir_age;
+            return s;
+        }
+
+        if (s->age < d->age)
+            d = s;
+    }
+
+    if (dirlen >= sizeof(d->path))
+        return NULL;
+
+    strmemccpy(d->path, dirpath, dirlen + 1);
+    d->overflow = false;
+    d->used = 0;
+    d->age = ++aa_dir_age;
+
+    /* a missing directory is remembered as an empty one */
+    DIR *dir = opendir(d->path);
+    if (!dir)
+        return d;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        if (!is_image_name(entry->d_name))
+            continue;
+
+        size_t len = strlen(entry->d_name) + 1;
+        if (d->used + len > sizeof(d->names))
+        {
+            d->overflow = true;
+            break;
+        }
+
+        memcpy(d->names + d->used, entry->d_name, len);
+        d->used += len;
+    }
+
+    closedir(dir);
+    return d;
+}
+
+/* file_exists() for album art, answered from the directory listings */
+static bool aa_file_exists(const char *path)
+{
+#ifdef HAVE_DIRCACHE
+    /* dircache already answers from memory */
+    struct dircache_info info;
+    dircache_get_info(&info);
+    if (info.status == DIRCACHE_READY)
+        return file_exists(path);
+#endif
+
+    const char *name = strrchr(path, '/');
+    if (!name)
+        return file_exists(path);
+    name++;
+
+    mutex_lock(&aa_dir_mutex);
+
+    int found = -1;
+    struct aa_dir *d = aa_dir_get(path, name - path);
+    if (d && !d->overflow)
+    {
+        found = 0;
+        for (size_t pos = 0; pos < d->used; pos += strlen(d->names + pos) + 1)
+        {
+            if (!strcasecmp(d->names + pos, name))
+            {
+                found = 1;
+                break;
+            }
+        }
+    }
+
+    mutex_unlock(&aa_dir_mutex);
+
+    return found < 0 ? file_exists(path) : found;
+}
+
+/* Forget the listings, e.g. when album art may have been added */
+void albumart_flush_dir_cache(void)
+{
+    mutex_lock(&aa_dir_mutex);
+
+    for (int i = 0; i < AA_DIR_SLOTS; i++)
+        aa_dirs[i].age = 0;
+
+    mutex_unlock(&aa_dir_mutex);
+}
+
+void albumart_init(void)
+{
+    mutex_init(&aa_dir_mutex);
+}
+#else
+#define aa_file_exists file_exists
+#endif /* PLUGIN */
+
 #ifdef USE_JPEG_COVER
 static const char * const extensions[] = { "jpeg", "jpg", "bmp" };
 static const unsigned char extension_lens[] = { 4, 3, 3 };
@@ -91,7 +232,7 @@ static bool try_exts(char *path, int len)
         if (extension_lens[i] + len > MAX_PATH)
             continue;
         strcpy(path + len, extensions[i]);
-        if (file_exists(path))
+        if (aa_file_exists(path))
             return true;
     }
     return false;
@@ -99,7 +240,7 @@ static bool try_exts(char *path, int len)
 #define EXT
 #else
 #define EXT "bmp"
-#define try_exts(path, len) file_exists(path)
+#define try_exts(path, len) aa_file_exists(path)
 #endif
 
 /* Look for the first matching album art bitmap in the following list:
@@ -189,7 +330,7 @@ bool search_albumart_files(const struct mp3entry *id3, const char *size_string,
         if (!found && !*size_string)
         {
             snprintf (path, sizeof(path), "%sfolder.jpg", dir);
-            found = file_exists(path);
+            found = aa_file_exists(path);
         }
 #endif
 
@@ -277,4 +418,119 @@ bool find_albumart(const struct mp3entry *id3, char *buf, int buflen,
     return search_albumart_files(id3, size_string, buf, buflen);
 }
 
+#ifdef USE_JPEG_COVER
+/* Embedded album art has to be decoded and scaled from the full image each
+ * time it is shown. The scaled bitmap is saved to a thumbnail file the first
+ * time, in the display's native format, so later loads are a single read.
+ * Thumbnails are keyed by album (or by file for tracks without one) and by
+ * the size of the embedded image, so a changed picture gets a new entry.
+ */
+#define THUMB_DIR   ROCKBOX_DIR "/albumart/.thumbs"
+#define THUMB_MAGIC 0x52425448 /* RBTH */
+
+struct thumb_header
+{
+    uint32_t magic;
+    uint16_t depth;         /* LCD_DEPTH */
+    uint16_t pixelformat;   /* LCD_PIXELFORMAT */
+    uint16_t width;
+    uint16_t height;
+    uint32_t size;          /* bytes of pixel data that follow */
+};
+
+/* Build the thumbnail filename for the embedded album art of id3 at the
+ * given size. Returns false if the track has no art that can be cached. */
+bool albumart_thumb_path(const struct mp3entry *id3, const struct dim *dim,
+                         char *buf, int buflen)
+{
+    if (!id3 || !id3->has_embedded_albumart ||
+        id3->albumart.type != AA_TYPE_JPG)
+        return false;
+
+    const char *artist = id3->albumartist ? id3->albumartist : id3->artist;
+    uint32_t key = 0xffffffff;
+
+    if (artist && id3->album)
+    {
+        key = crc_32(artist, strlen(artist), key);
+        key = crc_32(id3->album, strlen(id3->album), key);
+    }
+    else
+    {
+        key = crc_32(id3->path, strlen(id3->path), key);
+    }
+
+    uint32_t size = id3->albumart.size;
+    key = crc_32(&size, sizeof(size), key);
+
+    return snprintf(buf, buflen, THUMB_DIR "/%08lx.%dx%d" ALBUMART_THUMB_EXT,
+                    (unsigned long)key, dim->width, dim->height) < buflen;
+}
+
+/* Load a thumbnail into bmp, whose width and height give the largest size
+ * accepted. Returns the size of the pixel data or a negative value if the
+ * file isn't a usable thumbnail. */
+int albumart_thumb_read(int fd, struct bitmap *bmp, int max_size)
+{
+    struct thumb_header hdr;
+
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr.magic != THUMB_MAGIC || hdr.depth != LCD_DEPTH ||
+        hdr.pixelformat != LCD_PIXELFORMAT ||
+        hdr.width > bmp->width || hdr.height > bmp->height ||
+        (int)hdr.size != BM_SIZE(hdr.width, hdr.height, FORMAT_NATIVE, false) ||
+        (int)hdr.size > max_size)
+        return -1;
+
+    if (read(fd, bmp->data, hdr.size) != (ssize_t)hdr.size)
+        return -2;
+
+    bmp->width = hdr.width;
+    bmp->height = hdr.height;
+#if (LCD_DEPTH > 1) || defined(HAVE_REMOTE_LCD) && (LCD_REMOTE_DEPTH > 1)
+    bmp->format = FORMAT_NATIVE;
+    bmp->maskdata = NULL;
+#endif
+#ifdef HAVE_LCD_COLOR
+    bmp->alpha_offset = 0;
+#endif
+    return hdr.size;
+}
+
+/* Save a freshly scaled bitmap as a thumbnail. Failure only means the art
+ * will be decoded again next time, so errors are ignored. */
+void albumart_thumb_write(const char *path, const struct bitmap *bmp)
+{
+    struct thumb_header hdr =
+    {
+        .magic       = THUMB_MAGIC,
+        .depth       = LCD_DEPTH,
+        .pixelformat = LCD_PIXELFORMAT,
+        .width       = bmp->width,
+        .height      = bmp->height,
+        .size        = BM_SIZE(bmp->width, bmp->height, FORMAT_NATIVE, false),
+    };
+
+    int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        /* the directory is made on first use */
+        mkdir(ROCKBOX_DIR "/albumart");
+        mkdir(THUMB_DIR);
+        fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        if (fd < 0)
+            return;
+    }
+
+    bool ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+              write(fd, bmp->data, hdr.size) == (ssize_t)hdr.size;
+    close(fd);
+
+    if (!ok)
+        remove(path);
+    else
+        logf("Album art thumbnail saved: %s", path);
+}
+#endif /* USE_JPEG_COVER */
+
 #endif /* PLUGIN */
@@ -40,6 +40,21 @@ bool search_albumart_files(const struct mp3entry *id3, const char *size_string,
 
 void get_albumart_size(struct bitmap *bmp);
 
+#ifndef PLUGIN
+void albumart_init(void);
+void albumart_flush_dir_cache(void);
+#endif
+
+#if defined(HAVE_JPEG) && !defined(PLUGIN)
+/* Scaled embedded album art kept for the next time it is shown */
+#define ALBUMART_THUMB_EXT ".thb"
+
+bool albumart_thumb_path(const struct mp3entry *id3, const struct dim *dim,
+                         char *buf, int buflen);
+int albumart_thumb_read(int fd, struct bitmap *bmp, int max_size);
+void albumart_thumb_write(const char *path, const struct bitmap *bmp);
+#endif
+
 #endif /* HAVE_ALBUMART */
 
 #endif /* _ALBUMART_H_ */
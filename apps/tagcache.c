@@ -116,7 +116,7 @@
 #define TAGCACHE_MAGIC  0x54434810
 
 /* Dump store/restore header version 'TCSxx'. */
-#define TAGCACHE_STATEFILE_MAGIC 0x54435301
+#define TAGCACHE_STATEFILE_MAGIC 0x54435303
 
 /* How much to allocate extra space for ramcache. */
 #define TAGCACHE_RESERVE 32768
@@ -130,6 +130,23 @@
 /* Used to guess the necessary buffer size at commit. */
 #define TAGFILE_ENTRY_AVG_LENGTH   16
 
+#if defined(APPLICATION) && defined(POSIX_FADV_WILLNEED)
+/*
+ * Hosted builds ask the host kernel to read ahead the metadata of the next
+ * few files in a directory while scanning, so their reads are serviced
+ * concurrently instead of paying the full latency one file at a time.
+ * The metadata parsers themselves are not reentrant and stay serial.
+ */
+#define TAGCACHE_SCAN_PREFETCH
+
+/* How many files to read ahead of the one being parsed. */
+#define TAGCACHE_PREFETCH_DEPTH  8
+
+/* Bytes read ahead from the start and the end of each file. */
+#define TAGCACHE_PREFETCH_HEAD   (128*1024)
+#define TAGCACHE_PREFETCH_TAIL   (4*1024)
+#endif
+
 /* Max events in the internal tagcache command queue. */
 #define TAGCACHE_COMMAND_QUEUE_LENGTH 32
 
@@ -148,6 +165,12 @@
 /* The main database string data. */
 #define TAGCACHE_FILE_INDEX      "database_%d.tcd"
 
+/* Sorted string data being merged with new tags at commit. */
+#define TAGCACHE_FILE_MERGE      "database_%d.tmp"
+
+/* Filename hash index for looking up the master index entry of a file. */
+#define TAGCACHE_FILE_HASH       "database_hash.tcd"
+
 /* ASCII dumpfile of the DB contents. */
 #define TAGCACHE_FILE_CHANGELOG  "database_changelog.txt"
 
@@ -190,6 +213,7 @@ static int tempbuf_handle;
 #endif
 
 #define SORTED_TAGS_COUNT 9
+#define POSTING_TAGS_COUNT 6
 #define TAGCACHE_IS_UNIQUE(tag) (BIT_N(tag) & TAGCACHE_UNIQUE_TAGS)
 #define TAGCACHE_IS_SORTED(tag) (BIT_N(tag) & TAGCACHE_SORTED_TAGS)
 #define TAGCACHE_IS_NUMERIC_OR_NONUNIQUE(tag) \
@@ -206,6 +230,12 @@ static int tempbuf_handle;
     (1LU << tag_albumartist) | (1LU << tag_grouping) | \
     (1LU << tag_virt_canonicalartist))
 
+/* Unique tags with a ramcache posting list (the files using each string). */
+#define TAGCACHE_POSTING_TAGS ((1LU << tag_artist) | (1LU << tag_album) | \
+    (1LU << tag_genre) | (1LU << tag_composer) | (1LU << tag_albumartist) | \
+    (1LU << tag_virt_canonicalartist))
+#define TAGCACHE_HAS_POSTINGS(tag) (BIT_N(tag) & TAGCACHE_POSTING_TAGS)
+
 /* String presentation of the tags defined in tagcache.h. Must be in correct order! */
 static const char * const tags_str[] = { "artist", "album", "genre", "title",
     "filename", "composer", "comment", "albumartist", "grouping", "year",
@@ -300,6 +330,19 @@ struct master_header {
 
 static struct master_header current_tcmh;
 
+/* Filename hash index, an open addressing hash table of filename tag
+ * locations keyed by the crc32 of the path. Same endianness as the tag
+ * files. */
+struct hash_header {
+    struct tagcache_header tch;  /* entry_count is the number of slots */
+    struct tagcache_header ftch; /* Filename tag file it was built from */
+};
+
+struct hash_entry {
+    uint32_t hash;
+    int32_t seek;                /* Filename tag location, < 0 if unused */
+};
+
 #ifdef HAVE_TC_RAMCACHE
 
 #define TC_ALIGN_PTR(p, type, gap_out_p) \
@@ -320,6 +363,8 @@ static struct master_header current_tcmh;
 struct ramcache_header {
     char *tags[TAG_COUNT];       /* Tag file content (dcfrefs if tag_filename) */
     int entry_count[TAG_COUNT];  /* Number of entries in the indices. */
+    int32_t *postings[TAG_COUNT]; /* idx_ids sorted by tag seek */
+    int posting_count[TAG_COUNT]; /* Number of idx_ids in the postings. */
     struct index_entry indices[0]; /* Master index file content */
 };
 
@@ -349,6 +394,177 @@ static inline void tcrc_buffer_unlock(void)
     core_unpin(tcramcache.handle);
 }
 
+/**
+ * The sorted tags are front-coded in ram: entries are grouped in blocks
+ * of TCRC_BLOCK_ENTRIES and every entry only stores the part of the
+ * string that differs from the previous entry of the same block. Each
+ * entry is encoded as
+ *
+ *   varint (prefix length << 1) | TCRC_DELETED
+ *   varint tag_length of the entry in the tag file
+ *   varint idx_id + 1
+ *   suffix, zero terminated
+ *
+ * The block index directly following the tagcache header maps the tag
+ * file offsets used by the master index to the encoded blocks.
+ */
+#define TCRC_BLOCK_ENTRIES 16
+#define TCRC_ENTRY_HDR_MAX 15
+#define TCRC_DELETED       0x01
+
+struct tcrc_block {
+    int32_t seek;       /* Tag file offset of the first entry in block */
+    int32_t offset;     /* Offset of the encoded block from tags[tag] */
+};
+
+#define tcrc_blocks(tag) \
+    ((struct tcrc_block *)(tcramcache.hdr->tags[tag] + \
+                           sizeof (struct tagcache_header)))
+
+static char *tcrc_put_varint(char *p, unsigned long value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+
+    *p++ = value;
+    return p;
+}
+
+static const char *tcrc_get_varint(const char *p, unsigned long *value)
+{
+    unsigned long v = 0;
+    int shift = 0;
+
+    do
+    {
+        v |= (unsigned long)(*p & 0x7f) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+
+    *value = v;
+    return p;
+}
+
+struct tcrc_cursor {
+    const char *p;      /* Next encoded entry */
+    long seek;          /* Tag file offset of the next entry */
+    int left;           /* Entries left in the block */
+};
+
+static void tcrc_open_block(int tag, int block, struct tcrc_cursor *c)
+{
+    const struct tcrc_block *b = &tcrc_blocks(tag)[block];
+    int count = tcramcache.hdr->entry_count[tag] - block * TCRC_BLOCK_ENTRIES;
+
+    c->p = tcramcache.hdr->tags[tag] + b->offset;
+    c->seek = b->seek;
+    c->left = MIN(count, TCRC_BLOCK_ENTRIES);
+}
+
+/**
+ * Decodes the next entry of the block into buf, buf must still contain
+ * the string of the previous entry. Returns the encoded entry or NULL at
+ * the end of the block.
+ */
+static const char *tcrc_next_entry(struct tcrc_cursor *c,
+                                   struct tagfile_entry *tfe,
+                                   char *buf, long bufsz)
+{
+    const char *entry = c->p;
+    const char *p = entry;
+    unsigned long prefix, tag_length, idx;
+
+    if (c->left <= 0)
+        return NULL;
+
+    p = tcrc_get_varint(p, &prefix);
+    p = tcrc_get_varint(p, &tag_length);
+    p = tcrc_get_varint(p, &idx);
+    prefix >>= 1;
+
+    /* Overlong strings are truncated consistently for all entries of
+       the block, so the shared prefix stays valid. */
+    size_t len = strlen(p);
+    if ((long)prefix < bufsz - 1)
+    {
+        size_t n = MIN(len, (size_t)(bufsz - 1 - prefix));
+        memcpy(buf + prefix, p, n);
+        buf[prefix + n] = '\0';
+    }
+
+    tfe->tag_length = tag_length;
+    tfe->idx_id = (long)idx - 1;
+
+    c->p = p + len + 1;
+    c->seek += sizeof(struct tagfile_entry) + tag_length;
+    c->left--;
+
+    return entry;
+}
+
+/* Returns the block that may contain the entry at tag file offset seek */
+static int tcrc_find_block(int tag, long seek)
+{
+    const struct tcrc_block *blocks = tcrc_blocks(tag);
+    int count = tcramcache.hdr->entry_count[tag];
+    int low = 0, high = (count + TCRC_BLOCK_ENTRIES - 1) / TCRC_BLOCK_ENTRIES;
+
+    if (high == 0 || seek < blocks[0].seek)
+        return -1;
+
+    /* Find the last block starting at or before seek. */
+    while (high - low > 1)
+    {
+        int mid = (low + high) / 2;
+        if (blocks[mid].seek <= seek)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/**
+ * Decodes the entry found at tag file offset seek into buf. Returns the
+ * offset of the encoded entry from tags[tag] or -1 if there is no entry
+ * starting at seek. Must not yield, the ramcache may move.
+ */
+static long tcrc_get_entry(int tag, long seek, struct tagfile_entry *tfe,
+                           char *buf, long bufsz)
+{
+    struct tcrc_cursor c;
+    int block = tcrc_find_block(tag, seek);
+
+    if (block < 0)
+        return -1;
+
+    tcrc_open_block(tag, block, &c);
+
+    buf[0] = '\0';
+    while (c.seek <= seek)
+    {
+        long pos = c.seek;
+        const char *entry = tcrc_next_entry(&c, tfe, buf, bufsz);
+
+        if (entry == NULL)
+            break;
+
+        if (pos == seek)
+        {
+            if (*entry & TCRC_DELETED)
+                buf[0] = '\0';
+
+            return entry - tcramcache.hdr->tags[tag];
+        }
+    }
+
+    return -1;
+}
+
 #else /* ndef HAVE_TC_RAMCACHE */
 
 #define IF_TCRCDC(...)
@@ -377,13 +593,22 @@ struct tempbuf_searchidx {
     struct tempbuf_id_list idlist;
 };
 
+/* Seek change of the old entries of a sorted tag file after merging in
+ * new tags, valid from seek up to the next relocation. */
+struct tempbuf_reloc {
+    long seek;
+    long delta;
+};
+
 /* Lookup buffer for fixing messed up index while after sorting. */
 static long commit_entry_count;
 static long lookup_buffer_depth;
 static struct tempbuf_searchidx **lookup;
+static struct tempbuf_reloc *reloc;
+static long reloc_count;
 
 /* Used when building the temporary file. */
-static int cachefd = -1, filenametag_fd;
+static int cachefd = -1, filenametag_fd, filenamehash_fd = -1;
 static int total_entry_count = 0;
 static int data_size = 0;
 static int processed_dir_count;
@@ -393,12 +618,21 @@ static volatile int write_lock;
 static volatile int read_lock;
 
 static bool delete_entry(long idx_id);
+static int compare_tags(const char *str1, const char *str2);
+#ifdef HAVE_TC_RAMCACHE
+static bool allocate_tagcache(void);
+#endif
 
 static inline void str_setlen(char *buf, size_t len)
 {
     buf[len] = '\0';
 }
 
+static inline uint32_t filename_hash(const char *filename, long length)
+{
+    return crc_32(filename, length, 0xffffffff);
+}
+
 const char* tagcache_tag_to_str(int tag)
 {
     return tags_str[tag];
@@ -444,11 +678,31 @@ static void swap_master_header(struct master_header *buf)
         buf->dirty = swap32(buf->dirty);
     }
 }
+
+static void swap_hash_header(struct hash_header *buf)
+{
+    if (tc_stat.econ)
+    {
+        swap_tagcache_header(&buf->tch);
+        swap_tagcache_header(&buf->ftch);
+    }
+}
+
+static void swap_hash_entry(struct hash_entry *buf)
+{
+    if (tc_stat.econ)
+    {
+        buf->hash = swap32(buf->hash);
+        buf->seek = swap32(buf->seek);
+    }
+}
 #else
 static void swap_tagfile_entry(struct tagfile_entry *buf) { (void)buf; }
 static void swap_index_entry(struct index_entry *buf) { (void)buf; }
 static void swap_tagcache_header(struct tagcache_header *buf) { (void)buf; }
 static void swap_master_header(struct master_header *buf) { (void)buf; }
+static void swap_hash_header(struct hash_header *buf) { (void)buf; }
+static void swap_hash_entry(struct hash_entry *buf) { (void)buf; }
 #endif
 
 static ssize_t read_tagfile_entry(int fd, struct tagfile_entry *buf)
@@ -477,6 +731,15 @@ enum e_read_errors {
     e_TAG_SIZEMISMATCH
 };
 
+static ssize_t read_hash_header(int fd, struct hash_header *buf)
+{
+    ssize_t ret = read(fd, buf, sizeof(*buf));
+    if (ret == sizeof(*buf))
+        swap_hash_header(buf);
+
+    return ret;
+}
+
 static enum e_read_errors
 read_tagfile_entry_and_tag(int fd, struct tagfile_entry *tfe,
                            char* buf, int bufsz)
@@ -584,6 +847,19 @@ static int NO_INLINE remove_db_file(const char* filename)
     return remove(buf);
 }
 
+static int NO_INLINE rename_merged_file(int tag)
+{
+    char oldbuf[MAX_PATH];
+    char newbuf[MAX_PATH];
+
+    snprintf(oldbuf, sizeof(oldbuf), "%s/" TAGCACHE_FILE_MERGE,
+             tc_stat.db_path, tag);
+    snprintf(newbuf, sizeof(newbuf), "%s/" TAGCACHE_FILE_INDEX,
+             tc_stat.db_path, tag);
+
+    return rename(oldbuf, newbuf);
+}
+
 static int open_tag_fd(struct tagcache_header *hdr, int tag, bool write)
 {
     int fd;
@@ -670,6 +946,7 @@ static void remove_files(void)
     tc_stat.ramcache = false;
     tc_stat.econ = false;
     remove_db_file(TAGCACHE_FILE_MASTER);
+    remove_db_file(TAGCACHE_FILE_HASH);
     for (i = 0; i < TAG_COUNT; i++)
     {
         if (TAGCACHE_IS_NUMERIC(i))
@@ -844,6 +1121,69 @@ static long find_entry_ram(const char *filename)
 }
 #endif /* defined (HAVE_TC_RAMCACHE) && defined (HAVE_DIRCACHE) */
 
+/**
+ * Look up a filename in the hash index, fd is the open filename tag file.
+ * Returns the idx_id, -4 if the file isn't in the database or -1 if the
+ * hash index is missing or out of date.
+ */
+static long find_entry_hash(int fd, int hashfd, const char *filename,
+                            long tag_length, char *buf)
+{
+    struct tagcache_header tch;
+    struct hash_header hh;
+    struct hash_entry he;
+    struct tagfile_entry tfe;
+    uint32_t hash;
+    long slot;
+
+    if (hashfd < 0)
+        return -1;
+
+    lseek(fd, 0, SEEK_SET);
+    lseek(hashfd, 0, SEEK_SET);
+    if (read_tagcache_header(fd, &tch) != sizeof(tch)
+        || read_hash_header(hashfd, &hh) != sizeof(hh)
+        || hh.tch.magic != TAGCACHE_MAGIC
+        || hh.ftch.entry_count != tch.entry_count
+        || hh.ftch.datasize != tch.datasize)
+    {
+        logf("hash index out of date");
+        return -1;
+    }
+
+    hash = filename_hash(filename, tag_length - 1);
+    slot = hash & (hh.tch.entry_count - 1);
+
+    for (long probes = 0; probes < hh.tch.entry_count; probes++)
+    {
+        lseek(hashfd, sizeof(hh) + slot * sizeof(he), SEEK_SET);
+        if (read(hashfd, &he, sizeof(he)) != sizeof(he))
+            return -1;
+
+        swap_hash_entry(&he);
+        if (he.seek < 0)
+            return -4;
+
+        if (he.hash == hash)
+        {
+            lseek(fd, he.seek, SEEK_SET);
+            if (read_tagfile_entry(fd, &tfe) != sizeof(tfe))
+                return -1;
+
+            if (tfe.tag_length == tag_length
+                && read(fd, buf, tag_length) == tag_length
+                && !strncmp(filename, buf, tag_length))
+            {
+                return tfe.idx_id;
+            }
+        }
+
+        slot = (slot + 1) & (hh.tch.entry_count - 1);
+    }
+
+    return -4;
+}
+
 static long find_entry_disk(const char *filename_raw, bool localfd)
 {
     struct tagfile_entry tfe;
@@ -881,6 +1221,25 @@ static long find_entry_disk(const char *filename_raw, bool localfd)
             return -1;
     }
 
+    long tag_length = strlen(filename) + 1; /* include NULL */
+
+    if (tag_length < bufsz)
+    {
+        int hashfd = localfd ? open_db_fd(TAGCACHE_FILE_HASH, O_RDONLY)
+                             : filenamehash_fd;
+
+        idx = find_entry_hash(fd, hashfd, filename, tag_length, buf);
+
+        if (localfd && hashfd >= 0)
+            close(hashfd);
+
+        if (idx != -1)
+        {
+            found = idx >= 0;
+            goto done;
+        }
+    }
+
     check_again:
 
     if (last_pos > 0) /* pos gets cached to prevent reading from beginning */
@@ -888,8 +1247,6 @@ static long find_entry_disk(const char *filename_raw, bool localfd)
     else /* start back at beginning */
         pos = lseek(fd, sizeof(struct tagcache_header), SEEK_SET);
 
-    long tag_length = strlen(filename) + 1; /* include NULL */
-
     if (tag_length < bufsz)
     {
         while (true)
@@ -948,6 +1305,7 @@ static long find_entry_disk(const char *filename_raw, bool localfd)
         idx = -4;
     }     
 
+done:
     if (fd != filenametag_fd || localfd)
         close(fd);
 
@@ -1144,10 +1502,8 @@ static bool retrieve(struct tagcache_search *tcs, IF_DIRCACHE(int idx_id,)
 #endif /* HAVE_DIRCACHE */
         if (tag != tag_filename)
         {
-            struct tagfile_entry *ep =
-                (struct tagfile_entry *)&tcramcache.hdr->tags[tag][seek];
-            strmemccpy(buf, ep->tag_data, bufsz);
-            success = true;
+            if (tcrc_get_entry(tag, seek, &tfe, buf, bufsz) >= 0)
+                success = true;
         }
     }
 #endif /* HAVE_TC_RAMCACHE */
@@ -1475,7 +1831,7 @@ static bool check_clauses(struct tagcache_search *tcs,
 #ifdef HAVE_TC_RAMCACHE
         if (tcs->ramsearch)
         {
-            struct tagfile_entry *tfe;
+            struct tagfile_entry tfe;
 
             if (!TAGCACHE_IS_NUMERIC(clause->tag))
             {
@@ -1485,13 +1841,10 @@ static bool check_clauses(struct tagcache_search *tcs,
                     retrieve(tcs, IF_DIRCACHE(tcs->idx_id,) idx, clause->tag,
                              buf, bufsz);
                 }
-                else
+                else if (tcrc_get_entry(clause->tag, seek, &tfe, buf, bufsz) < 0)
                 {
-                    tfe = (struct tagfile_entry *)
-                                        &tcramcache.hdr->tags[clause->tag][seek];
-                    /* str points to movable data, but no locking required here,
-                     * as no yield() is following */
-                    str = tfe->tag_data;
+                    logf("read error #14");
+                    return false;
                 }
             }
         }
@@ -1605,6 +1958,199 @@ static bool add_uniqbuf(struct tagcache_search *tcs, uint32_t id)
     return true;
 }
 
+#ifdef HAVE_TC_RAMCACHE
+/**
+ * Looks up str in the sorted tag. Returns the tag file offset of the only
+ * entry matching it case-insensitively, -1 if there is none and -2 if
+ * several entries match. Must not yield.
+ */
+static long tcrc_find_string(int tag, const char *str, char *buf, long bufsz)
+{
+    int count = tcramcache.hdr->entry_count[tag];
+    int low = 0, high = (count + TCRC_BLOCK_ENTRIES - 1) / TCRC_BLOCK_ENTRIES;
+    struct tagfile_entry tfe;
+    struct tcrc_cursor c;
+    long found = -1;
+
+    /* Find the last block starting with a string before str. */
+    while (high - low > 1)
+    {
+        int mid = (low + high) / 2;
+        tcrc_open_block(tag, mid, &c);
+        tcrc_next_entry(&c, &tfe, buf, bufsz);
+        if (compare_tags(buf, str) < 0)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    /* Matches may continue into the following blocks. */
+    for (int block = low; block * TCRC_BLOCK_ENTRIES < count; block++)
+    {
+        const char *entry;
+
+        tcrc_open_block(tag, block, &c);
+        buf[0] = '\0';
+        while (true)
+        {
+            long pos = c.seek;
+
+            if ((entry = tcrc_next_entry(&c, &tfe, buf, bufsz)) == NULL)
+                break;
+
+            /* The tag is sorted by compare_tags() but a match is decided
+               as check_clauses() decides it. */
+            if (compare_tags(buf, str) > 0)
+                return found;
+
+            if (!strcasecmp(buf, str) && !(*entry & TCRC_DELETED))
+            {
+                if (found >= 0)
+                    return -2;
+                found = pos;
+            }
+        }
+    }
+
+    return found;
+}
+
+static int posting_sort_tag;
+
+static int posting_compare(const void *p1, const void *p2)
+{
+    do_timed_yield();
+
+    const struct index_entry *indices = tcramcache.hdr->indices;
+    int32_t e1 = *(const int32_t *)p1, e2 = *(const int32_t *)p2;
+    int32_t s1 = indices[e1].tag_seek[posting_sort_tag];
+    int32_t s2 = indices[e2].tag_seek[posting_sort_tag];
+
+    if (s1 != s2)
+        return s1 < s2 ? -1 : 1;
+    return e1 - e2;
+}
+
+/* Returns the first position in the postings of tag with a seek >= seek */
+static int posting_lower_bound(int tag, long seek)
+{
+    const int32_t *postings = tcramcache.hdr->postings[tag];
+    int low = 0, high = tcramcache.hdr->posting_count[tag];
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (tcramcache.hdr->indices[postings[mid]].tag_seek[tag] < seek)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/* Drops a deleted file from the postings before its tag seeks change */
+static void posting_remove(int idx_id)
+{
+    for (int tag = 0; tag < TAG_COUNT; tag++)
+    {
+        int32_t *postings = tcramcache.hdr->postings[tag];
+        int count = tcramcache.hdr->posting_count[tag];
+
+        if (postings == NULL)
+            continue;
+
+        long seek = tcramcache.hdr->indices[idx_id].tag_seek[tag];
+        for (int i = posting_lower_bound(tag, seek); i < count; i++)
+        {
+            if (postings[i] == idx_id)
+            {
+                memmove(&postings[i], &postings[i + 1],
+                        (count - i - 1) * sizeof(int32_t));
+                tcramcache.hdr->posting_count[tag]--;
+                break;
+            }
+
+            if (tcramcache.hdr->indices[postings[i]].tag_seek[tag] != seek)
+                break;
+        }
+    }
+}
+
+/**
+ * Picks the filter or "is" clause on a tag with postings that matches the
+ * fewest files. Returns that tag and the range of its postings to scan,
+ * or -1 if the whole master index must be scanned. Must not yield.
+ */
+static int plan_lookup(struct tagcache_search *tcs, int *start, int *end)
+{
+    /* the size check_clauses() reads entries with; never yields so the
+       buffer can be static */
+    static char buf[256];
+    int best = -1;
+    int best_count = current_tcmh.tch.entry_count;
+    bool logical_or = false;
+    int i;
+
+    for (i = 0; i < tcs->clause_count; i++)
+    {
+        if (tcs->clause[i]->type == clause_logical_or)
+            logical_or = true;
+    }
+
+    for (i = 0; i < tcs->filter_count + tcs->clause_count; i++)
+    {
+        int tag;
+        long seek;
+
+        if (i < tcs->filter_count)
+        {
+            tag = tcs->filter_tag[i];
+            seek = tcs->filter_seek[i];
+            if (!TAGCACHE_HAS_POSTINGS(tag))
+                continue;
+        }
+        else
+        {
+            struct tagcache_search_clause *clause =
+                                        tcs->clause[i - tcs->filter_count];
+
+            /* Only a plain "is" on a posting tag narrows the result when all
+               clauses must match. */
+            tag = clause->tag;
+            if (logical_or || clause->type != clause_is || clause->numeric
+                || !TAGCACHE_HAS_POSTINGS(tag) || clause->str == NULL
+                || strlen(clause->str) >= sizeof(buf) - 1
+                || !strcasecmp(clause->str, UNTAGGED))
+                continue;
+
+            seek = tcrc_find_string(tag, clause->str, buf, sizeof(buf));
+            if (seek == -2)
+                continue;
+
+            if (seek == -1)
+            {
+                /* No file can match. */
+                *start = *end = 0;
+                return tag;
+            }
+        }
+
+        int first = posting_lower_bound(tag, seek);
+        int last = posting_lower_bound(tag, seek + 1);
+        if (last - first < best_count)
+        {
+            best = tag;
+            best_count = last - first;
+            *start = first;
+            *end = last;
+        }
+    }
+
+    return best;
+}
+#endif /* HAVE_TC_RAMCACHE */
+
 static bool build_lookup_list(struct tagcache_search *tcs)
 {
     struct index_entry entry;
@@ -1617,11 +2163,19 @@ static bool build_lookup_list(struct tagcache_search *tcs)
     {
         tcrc_buffer_lock(); /* lock because below makes a pointer to movable data */
 
-        for (i = tcs->seek_pos; i < current_tcmh.tch.entry_count; i++)
+        /* Only visit the files of the most selective posting list, if any.
+           seek_pos is then the position within that list. */
+        int start = 0, end = current_tcmh.tch.entry_count;
+        int plan = plan_lookup(tcs, &start, &end);
+        const int32_t *postings = plan >= 0 ?
+                                  tcramcache.hdr->postings[plan] : NULL;
+
+        for (i = tcs->seek_pos; i < end - start; i++)
         {
             struct tagcache_seeklist_entry *seeklist;
+            int idx_id = postings ? postings[start + i] : i;
             /* idx points to movable data, don't yield or reload */
-            struct index_entry *idx = &tcramcache.hdr->indices[i];
+            struct index_entry *idx = &tcramcache.hdr->indices[idx_id];
             if (tcs->seek_list_count == SEEK_LIST_SIZE)
                 break ;
 
@@ -1652,7 +2206,7 @@ static bool build_lookup_list(struct tagcache_search *tcs)
             seeklist = &tcs->seeklist[tcs->seek_list_count];
             seeklist->seek = idx->tag_seek[tcs->type];
             seeklist->flag = idx->flag;
-            seeklist->idx_id = i;
+            seeklist->idx_id = idx_id;
             tcs->seek_list_count++;
         }
 
@@ -1938,17 +2492,20 @@ static bool get_next(struct tagcache_search *tcs, bool is_numeric, char *buf, lo
 
         if (tcs->type != tag_filename)
         {
-            struct tagfile_entry *ep;
+            if (tcrc_get_entry(tcs->type, tcs->position, &entry, buf, bufsz) < 0)
+            {
+                logf("read error #14.5");
+                tcs->valid = false;
+                return false;
+            }
 
-            ep = (struct tagfile_entry *)&tcramcache.hdr->tags[tcs->type][tcs->position];
-            /* don't return ep->tag_data directly as it may move */
-            tcs->result_len = strlcpy(buf, ep->tag_data, bufsz) + 1;
+            tcs->result_len = strlen(buf) + 1;
             tcs->result = buf;
-            tcs->idx_id = ep->idx_id;
-            tcs->ramresult = false; /* was true before we copied to buf too */
+            tcs->idx_id = entry.idx_id;
+            tcs->ramresult = false; /* strings are front-coded, always copied */
 
             /* Increase position for the next run. This may get overwritten. */
-            tcs->position += sizeof(struct tagfile_entry) + ep->tag_length;
+            tcs->position += sizeof(struct tagfile_entry) + entry.tag_length;
 
             return true;
         }
@@ -2060,20 +2617,18 @@ void tagcache_search_finish(struct tagcache_search *tcs)
 }
 
 #if defined(HAVE_TC_RAMCACHE) && defined(HAVE_DIRCACHE)
-static struct tagfile_entry *get_tag(const struct index_entry *entry, int tag)
-{
-    return (struct tagfile_entry *)&tcramcache.hdr->tags[tag][entry->tag_seek[tag]];
-}
-
 static long get_tag_numeric(const struct index_entry *entry, int tag, int idx_id)
 {
     return check_virtual_tags(tag, idx_id, entry);
 }
 
-static char* get_tag_string(const struct index_entry *entry, int tag)
+static char* get_tag_string(const struct index_entry *entry, int tag,
+                            char *buf, long bufsz)
 {
-    char* s = get_tag(entry, tag)->tag_data;
-    return strcmp(s, UNTAGGED) ? s : NULL;
+    struct tagfile_entry tfe;
+    if (tcrc_get_entry(tag, entry->tag_seek[tag], &tfe, buf, bufsz) < 0)
+        return NULL;
+    return strcmp(buf, UNTAGGED) ? buf : NULL;
 }
 
 bool tagcache_fill_tags(struct mp3entry *id3, const char *filename)
@@ -2100,12 +2655,11 @@ bool tagcache_fill_tags(struct mp3entry *id3, const char *filename)
     {                                                                          \
         if (remaining > 0)                                                     \
         {                                                                      \
-            x          = NULL; /* initialize with null if tag doesn't exist */ \
-            char* src = get_tag_string(entry, y);                              \
-            if (src)                                                           \
+            /* null if tag doesn't exist, decoded straight into id3v2buf */ \
+            x = get_tag_string(entry, y, buf, remaining);                      \
+            if (x)                                                             \
             {                                                                  \
-                x = buf;                                                       \
-                size_t len = strlcpy(buf, src, remaining) +1;                  \
+                size_t len = strlen(x) + 1;                                    \
                 buf += len; remaining -= len;                                  \
             }                                                                  \
         }                                                                      \
@@ -2438,31 +2992,35 @@ static bool tempbuf_insert(char *str, int id, int idx_id, bool unique)
     return true;
 }
 
-static int compare(const void *p1, const void *p2)
+/* Sort order of the sorted tag files, UNTAGGED always comes first. */
+static int compare_tags(const char *str1, const char *str2)
 {
-    do_timed_yield();
-
-    struct tempbuf_searchidx *e1 = (struct tempbuf_searchidx *)p1;
-    struct tempbuf_searchidx *e2 = (struct tempbuf_searchidx *)p2;
-
-    if (strcmp(e1->str, UNTAGGED) == 0)
+    if (strcmp(str1, UNTAGGED) == 0)
     {
-        if (strcmp(e2->str, UNTAGGED) == 0)
+        if (strcmp(str2, UNTAGGED) == 0)
             return 0;
         return -1;
     }
-    else if (strcmp(e2->str, UNTAGGED) == 0)
+    else if (strcmp(str2, UNTAGGED) == 0)
         return 1;
 
-    return strncasecmp(e1->str, e2->str, TAG_MAXLEN);
+    return strncasecmp(str1, str2, TAG_MAXLEN);
 }
 
-static int tempbuf_sort(int fd)
+static int compare(const void *p1, const void *p2)
+{
+    do_timed_yield();
+
+    struct tempbuf_searchidx *e1 = (struct tempbuf_searchidx *)p1;
+    struct tempbuf_searchidx *e2 = (struct tempbuf_searchidx *)p2;
+
+    return compare_tags(e1->str, e2->str);
+}
+
+static bool tempbuf_sort_entries(void)
 {
     struct tempbuf_searchidx *index = (struct tempbuf_searchidx *)tempbuf;
-    struct tagfile_entry fe;
     int i;
-    int length;
 
     /* Generate reverse lookup entries. */
     for (i = 0; i < lookup_buffer_depth; i++)
@@ -2482,65 +3040,289 @@ static int tempbuf_sort(int fd)
         ALIGN_BUFFER(tempbuf_pos, tempbuf_left, alignof(struct tempbuf_id_list));
         tempbuf_left -= sizeof(struct tempbuf_id_list);
         if (tempbuf_left < 0)
-            return -1;
+            return false;
+
+        idlist->next = (struct tempbuf_id_list *)&tempbuf[tempbuf_pos];
+        tempbuf_pos += sizeof(struct tempbuf_id_list);
+
+        idlist = idlist->next;
+        idlist->id = i;
+        idlist->next = NULL;
+
+        do_timed_yield();
+    }
+
+    qsort(index, tempbufidx, sizeof(struct tempbuf_searchidx), compare);
+    memset(lookup, 0, lookup_buffer_depth * sizeof(struct tempbuf_searchidx **));
+
+    return true;
+}
+
+/* Point all ids of a sorted tempbuf entry at its final location in the tag
+ * file. */
+static void tempbuf_set_location(struct tempbuf_searchidx *entry, long seek)
+{
+    struct tempbuf_id_list *idlist = &entry->idlist;
+
+    /* Fix the lookup list. */
+    while (idlist != NULL)
+    {
+        if (idlist->id >= 0)
+            lookup[idlist->id] = entry;
+        idlist = idlist->next;
+    }
+
+    entry->seek = seek;
+}
+
+static int tempbuf_write_entry(int fd, struct tempbuf_searchidx *entry)
+{
+    struct tagfile_entry fe;
+    int length;
+
+    tempbuf_set_location(entry, lseek(fd, 0, SEEK_CUR));
+    length = strlen(entry->str) + 1;
+    fe.tag_length = length;
+    fe.idx_id = entry->idx_id;
+
+    /* Check the chunk alignment. */
+    if ((fe.tag_length + sizeof(struct tagfile_entry))
+        % TAGFILE_ENTRY_CHUNK_LENGTH)
+    {
+        fe.tag_length += TAGFILE_ENTRY_CHUNK_LENGTH -
+            ((fe.tag_length + sizeof(struct tagfile_entry))
+             % TAGFILE_ENTRY_CHUNK_LENGTH);
+    }
+
+    if (write_tagfile_entry(fd, &fe) != sizeof(struct tagfile_entry))
+    {
+        logf("tempbuf_sort: write error #1");
+        return -1;
+    }
+
+    if (write(fd, entry->str, length) != length)
+    {
+        logf("tempbuf_sort: write error #2");
+        return -2;
+    }
+
+    /* Write some padding. */
+    if (fe.tag_length - length > 0)
+        write(fd, "XXXXXXXX", fe.tag_length - length);
+
+    return 1;
+}
+
+static int tempbuf_sort(int fd)
+{
+    struct tempbuf_searchidx *index = (struct tempbuf_searchidx *)tempbuf;
+    int i, rc;
+
+    if (!tempbuf_sort_entries())
+        return -1;
+
+    for (i = 0; i < tempbufidx; i++)
+    {
+        rc = tempbuf_write_entry(fd, &index[i]);
+        if (rc < 0)
+            return rc;
+    }
+
+    return i;
+}
+
+/* Start the merged copy of a sorted tag file once it is known to differ
+ * from the old one. Everything before pos is copied over unchanged. */
+static int tempbuf_merge_open(int fd, int index_type, long pos)
+{
+    int mergefd = open_pathfmt(build_idx_buf, build_idx_bufsz,
+                               O_WRONLY | O_CREAT | O_TRUNC,
+                               "%s/" TAGCACHE_FILE_MERGE,
+                               tc_stat.db_path, index_type);
+    if (mergefd < 0)
+    {
+        logf(TAGCACHE_FILE_MERGE " open fail", index_type);
+        return -1;
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    while (pos > 0)
+    {
+        long len = MIN(pos, build_idx_bufsz);
+
+        if (read(fd, build_idx_buf, len) != len
+            || write(mergefd, build_idx_buf, len) != len)
+        {
+            logf("tempbuf_merge: copy error");
+            close(mergefd);
+            return -2;
+        }
+
+        pos -= len;
+        do_timed_yield();
+    }
+
+    return mergefd;
+}
+
+/**
+ * Merge the new tags in the tempbuf into the already sorted tag file fd.
+ * Only a read pass is done as long as nothing changes, e.g. when every new
+ * unique tag is already known. Otherwise the merged file is written into
+ * *mergefd_out and the seek changes of the old entries are recorded in the
+ * relocation table (see tempbuf_relocate()).
+ *
+ * Returns the number of entries in the resulting tag file or < 0 on error.
+ */
+static int tempbuf_merge(int fd, int index_type, int old_count,
+                         int *mergefd_out)
+{
+    struct tempbuf_searchidx *index = (struct tempbuf_searchidx *)tempbuf;
+    struct tagfile_entry fe;
+    bool unique = TAGCACHE_IS_UNIQUE(index_type);
+    long pos = sizeof(struct tagcache_header);
+    long delta = 0;
+    long reloc_max;
+    int mergefd = -1;
+    int count = 0;
+    int i = 0, n;
+
+    *mergefd_out = -1;
+
+    if (!tempbuf_sort_entries())
+        return -1;
+
+    ALIGN_BUFFER(tempbuf_pos, tempbuf_left, alignof(struct tempbuf_reloc));
+    reloc = (struct tempbuf_reloc *)&tempbuf[tempbuf_pos];
+    reloc_count = 0;
+    reloc_max = tempbuf_left / (long)sizeof(struct tempbuf_reloc);
+
+    lseek(fd, pos, SEEK_SET);
+    for (n = 0; n < old_count; n++)
+    {
+        long entry_len;
+
+        if (read_tagfile_entry_and_tag(fd, &fe, build_idx_buf,
+                                       build_idx_bufsz) > e_SUCCESS_LEN_ZERO)
+        {
+            logf("tempbuf_merge: read error");
+            goto error;
+        }
+
+        entry_len = sizeof(struct tagfile_entry) + fe.tag_length;
+
+        /* Deleted entries are dropped from the merged file. */
+        if (build_idx_buf[0] == '\0')
+        {
+            if (mergefd < 0 && (mergefd = tempbuf_merge_open(fd, index_type, pos)) < 0)
+                goto error;
+
+            lseek(fd, pos + entry_len, SEEK_SET);
+            pos += entry_len;
+            continue;
+        }
+
+        /* Write all new tags sorting before the current one. */
+        while (i < tempbufidx)
+        {
+            int cmp = compare_tags(index[i].str, build_idx_buf);
+            if (cmp > 0)
+                break;
+
+            if (cmp == 0 && unique)
+            {
+                /* Already in the tag file, just point to it. */
+                tempbuf_set_location(&index[i++],
+                        mergefd >= 0 ? lseek(mergefd, 0, SEEK_CUR) : pos);
+                continue;
+            }
+
+            if (mergefd < 0)
+            {
+                if ((mergefd = tempbuf_merge_open(fd, index_type, pos)) < 0)
+                    goto error;
+
+                /* build_idx_buf got clobbered by the copy, read it again. */
+                lseek(fd, pos, SEEK_SET);
+                if (read_tagfile_entry_and_tag(fd, &fe, build_idx_buf,
+                                               build_idx_bufsz) > e_SUCCESS_LEN_ZERO)
+                {
+                    logf("tempbuf_merge: read error #2");
+                    goto error;
+                }
+            }
+
+            if (tempbuf_write_entry(mergefd, &index[i++]) < 0)
+                goto error;
+            count++;
+        }
+
+        if (mergefd >= 0)
+        {
+            long newpos = lseek(mergefd, 0, SEEK_CUR);
+            if (newpos - pos != delta)
+            {
+                if (reloc_count >= reloc_max)
+                {
+                    logf("tempbuf_merge: reloc buf overf.");
+                    goto error;
+                }
 
-        idlist->next = (struct tempbuf_id_list *)&tempbuf[tempbuf_pos];
-        tempbuf_pos += sizeof(struct tempbuf_id_list);
+                delta = newpos - pos;
+                reloc[reloc_count].seek = pos;
+                reloc[reloc_count].delta = delta;
+                reloc_count++;
+            }
 
-        idlist = idlist->next;
-        idlist->id = i;
-        idlist->next = NULL;
+            if (write_tagfile_entry(mergefd, &fe) != sizeof(struct tagfile_entry)
+                || write(mergefd, build_idx_buf, fe.tag_length) != fe.tag_length)
+            {
+                logf("tempbuf_merge: write error");
+                goto error;
+            }
+        }
 
+        pos += entry_len;
+        count++;
         do_timed_yield();
     }
 
-    qsort(index, tempbufidx, sizeof(struct tempbuf_searchidx), compare);
-    memset(lookup, 0, lookup_buffer_depth * sizeof(struct tempbuf_searchidx **));
+    /* Anything left sorts after the last old entry. */
+    if (i < tempbufidx && mergefd < 0
+        && (mergefd = tempbuf_merge_open(fd, index_type, pos)) < 0)
+        goto error;
 
-    for (i = 0; i < tempbufidx; i++)
+    for (; i < tempbufidx; i++)
     {
-        struct tempbuf_id_list *idlist = &index[i].idlist;
-
-        /* Fix the lookup list. */
-        while (idlist != NULL)
-        {
-            if (idlist->id >= 0)
-                lookup[idlist->id] = &index[i];
-            idlist = idlist->next;
-        }
-
-        index[i].seek = lseek(fd, 0, SEEK_CUR);
-        length = strlen(index[i].str) + 1;
-        fe.tag_length = length;
-        fe.idx_id = index[i].idx_id;
+        if (tempbuf_write_entry(mergefd, &index[i]) < 0)
+            goto error;
+        count++;
+    }
 
-        /* Check the chunk alignment. */
-        if ((fe.tag_length + sizeof(struct tagfile_entry))
-            % TAGFILE_ENTRY_CHUNK_LENGTH)
-        {
-            fe.tag_length += TAGFILE_ENTRY_CHUNK_LENGTH -
-                ((fe.tag_length + sizeof(struct tagfile_entry))
-                 % TAGFILE_ENTRY_CHUNK_LENGTH);
-        }
+    *mergefd_out = mergefd;
+    return count;
 
-        if (write_tagfile_entry(fd, &fe) != sizeof(struct tagfile_entry))
-        {
-            logf("tempbuf_sort: write error #1");
-            return -1;
-        }
+error:
+    if (mergefd >= 0)
+        close(mergefd);
+    return -2;
+}
 
-        if (write(fd, index[i].str, length) != length)
-        {
-            logf("tempbuf_sort: write error #2");
-            return -2;
-        }
+/* Find the new location of an old tag file entry after tempbuf_merge(). */
+static long tempbuf_relocate(long seek)
+{
+    long lo = 0, hi = reloc_count;
 
-        /* Write some padding. */
-        if (fe.tag_length - length > 0)
-            write(fd, "XXXXXXXX", fe.tag_length - length);
+    while (lo < hi)
+    {
+        long mid = (lo + hi) / 2;
+        if (reloc[mid].seek <= seek)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    return i;
+    return lo > 0 ? seek + reloc[lo - 1].delta : seek;
 }
 
 inline static struct tempbuf_searchidx* tempbuf_locate(int id)
@@ -2812,21 +3594,20 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     struct index_entry idxbuf[IDX_BUF_DEPTH];
     int idxbuf_pos;
     int fd = -1, masterfd;
+    int mergefd = -1;
     bool error = false;
     int init;
     int masterfd_pos;
+    int old_count = 0;
 
     logf("Building index: %d", index_type);
 
-    /* Check the number of entries we need to allocate ram for. */
+    /* Only the new tags need to be kept in ram. */
     commit_entry_count = h->entry_count + 1;
 
     masterfd = open_master_fd(&tcmh, false);
     if (masterfd >= 0)
-    {
-        commit_entry_count += tcmh.tch.entry_count;
         close(masterfd);
-    }
     else
         remove_files(); /* Just to be sure we are clean. */
 
@@ -2835,46 +3616,32 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     if (fd >= 0)
     {
         logf("tch.datasize=%ld", tch.datasize);
-        lookup_buffer_depth = 1 +
-        /* First part */ commit_entry_count +
-        /* Second part */ (tch.datasize / TAGFILE_ENTRY_CHUNK_LENGTH);
-    }
-    else
-    {
-        lookup_buffer_depth = 1 +
-        /* First part */ commit_entry_count +
-        /* Second part */ 0;
+        old_count = tch.entry_count;
     }
 
+    lookup_buffer_depth = commit_entry_count;
+    reloc_count = 0;
+
     logf("lookup_buffer_depth=%ld", lookup_buffer_depth);
     logf("commit_entry_count=%ld", commit_entry_count);
 
-    /* Allocate buffer for all index entries from both old and new
-     * tag files. */
+    /* Allocate buffer for the index entries of the new tags. */
     tempbufidx = 0;
     tempbuf_pos = commit_entry_count * sizeof(struct tempbuf_searchidx);
 
-    /* Allocate lookup buffer. The first portion of commit_entry_count
-     * contains the new tags in the temporary file and the second
-     * part for locating entries already in the db.
-     *
-     *  New tags  Old tags
-     * +---------+---------------------------+
-     * |  index  | position/ENTRY_CHUNK_SIZE |  lookup buffer
-     * +---------+---------------------------+
+    /* Allocate lookup buffer for the new tags in the temporary file.
      *
-     * Old tags are inserted to a temporary buffer with position:
-     *     tempbuf_insert(position/ENTRY_CHUNK_SIZE, ...);
-     * And new tags with index:
+     * New tags are inserted to a temporary buffer with index:
      *     tempbuf_insert(idx, ...);
      *
-     * The buffer is sorted and written into tag file:
-     *     tempbuf_sort(...);
-     * leaving master index locations messed up.
+     * The buffer is sorted and merged into the already sorted tag file:
+     *     tempbuf_merge(...);
+     * which moves the old entries around, so master index locations
+     * get messed up.
      *
-     * That is fixed using the lookup buffer for old tags:
-     *     new_seek = tempbuf_find_location(old_seek, ...);
-     * and for new tags:
+     * That is fixed using the relocation table for old tags:
+     *     new_seek = tempbuf_relocate(old_seek);
+     * and the lookup buffer for new tags:
      *     new_seek = tempbuf_find_location(idx);
      */
     lookup = (struct tempbuf_searchidx **)&tempbuf[tempbuf_pos];
@@ -2894,56 +3661,10 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     if (fd >= 0)
     {
         /**
-         * If tag file contains unique tags (sorted index), we will load
-         * it entirely into memory so we can resort it later for use with
-         * chunked browsing.
+         * A sorted tag file stays on disk, the new tags get merged into
+         * it once they have been sorted.
          */
-        if (TAGCACHE_IS_SORTED(index_type))
-        {
-            logf("loading tags...");
-            for (i = 0; i < tch.entry_count && !USR_CANCEL; i++)
-            {
-                struct tagfile_entry entry;
-                int loc = lseek(fd, 0, SEEK_CUR);
-                bool ret;
-                switch (read_tagfile_entry_and_tag(fd, &entry, build_idx_buf, build_idx_bufsz))
-                {
-                    case e_SUCCESS_LEN_ZERO: /* Skip deleted entries. */
-                        continue;
-                    case e_SUCCESS:
-                         break;
-                    case e_ENTRY_SIZEMISMATCH:
-                        logf("read error #7");
-                        close(fd);
-                        return -2;
-                    case e_TAG_TOOLONG:
-                        logf("too long tag #3");
-                        close(fd);
-                        return -2;
-                    case e_TAG_SIZEMISMATCH:
-                        logf("read error #8");
-                        close(fd);
-                        return -2;
-                }
-
-                /**
-                 * Save the tag and tag id in the memory buffer. Tag id
-                 * is saved so we can later reindex the master lookup
-                 * table when the index gets resorted.
-                 */
-                ret = tempbuf_insert(build_idx_buf, loc/TAGFILE_ENTRY_CHUNK_LENGTH
-                                     + commit_entry_count, entry.idx_id,
-                                     TAGCACHE_IS_UNIQUE(index_type));
-                if (!ret)
-                {
-                    close(fd);
-                    return -3;
-                }
-                do_timed_yield();
-            }
-            logf("done");
-        }
-        else
+        if (!TAGCACHE_IS_SORTED(index_type))
             tempbufidx = tch.entry_count;
     }
     else
@@ -3099,28 +3820,52 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
         }
         logf("done");
 
-        /* Sort the buffer data and write it to the index file. */
-        lseek(fd, sizeof(struct tagcache_header), SEEK_SET);
-        /**
-         * We need to truncate the index file now. There can be junk left
-         * at the end of file (however, we _should_ always follow the
-         * entry_count and don't crash with that).
-         */
-        ftruncate(fd, lseek(fd, 0, SEEK_CUR));
+        if (old_count == 0)
+        {
+            /* Sort the buffer data and write it to the index file. */
+            lseek(fd, sizeof(struct tagcache_header), SEEK_SET);
+            /**
+             * We need to truncate the index file now. There can be junk left
+             * at the end of file (however, we _should_ always follow the
+             * entry_count and don't crash with that).
+             */
+            ftruncate(fd, lseek(fd, 0, SEEK_CUR));
+
+            i = tempbuf_sort(fd);
+            if (i < 0)
+                goto error_exit;
+            logf("sorted %d tags", i);
+        }
+        else
+        {
+            /* Merge the sorted buffer data with the current index file. */
+            i = tempbuf_merge(fd, index_type, old_count, &mergefd);
+            if (i < 0)
+            {
+                error = true;
+                goto error_exit;
+            }
+            logf("merged %d tags (%ld relocs)", i, reloc_count);
 
-        i = tempbuf_sort(fd);
-        if (i < 0)
-            goto error_exit;
-        logf("sorted %d tags", i);
+            if (mergefd >= 0)
+            {
+                close(fd);
+                fd = mergefd;
+            }
+            tempbufidx = i;
+        }
 
         /**
-         * Now update all indexes in the master lookup file.
+         * Now update all indexes in the master lookup file that point
+         * behind an inserted or dropped tag.
          */
         logf("updating indices...");
         lseek(masterfd, sizeof(struct master_header), SEEK_SET);
-        for (i = 0; i < tcmh.tch.entry_count && !USR_CANCEL; i += idxbuf_pos)
+        for (i = 0; i < tcmh.tch.entry_count && reloc_count > 0 && !USR_CANCEL;
+             i += idxbuf_pos)
         {
             int j;
+            bool changed = false;
             int loc = lseek(masterfd, 0, SEEK_CUR);
 
             idxbuf_pos = MIN(tcmh.tch.entry_count - i, IDX_BUF_DEPTH);
@@ -3136,6 +3881,8 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
 
             for (j = 0; j < idxbuf_pos; j++)
             {
+                long seek;
+
                 if (idxbuf[j].flag & FLAG_DELETED)
                 {
                     /* We can just ignore deleted entries. */
@@ -3143,21 +3890,23 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
                     continue;
                 }
 
-                idxbuf[j].tag_seek[index_type] = tempbuf_find_location(
-                    idxbuf[j].tag_seek[index_type]/TAGFILE_ENTRY_CHUNK_LENGTH
-                    + commit_entry_count);
-
-                if (idxbuf[j].tag_seek[index_type] < 0)
+                seek = tempbuf_relocate(idxbuf[j].tag_seek[index_type]);
+                if (seek != idxbuf[j].tag_seek[index_type])
                 {
-                    logf("update error: %ld/%d/%ld",
-                         idxbuf[j].flag, i+j, tcmh.tch.entry_count);
-                    error = true;
-                    goto error_exit;
+                    idxbuf[j].tag_seek[index_type] = seek;
+                    changed = true;
                 }
 
                 do_timed_yield();
             }
 
+            if (!changed)
+            {
+                lseek(masterfd, loc + idxbuf_pos * sizeof(struct index_entry),
+                      SEEK_SET);
+                continue;
+            }
+
             /* Write back the updated index. */
             if (write_index_entries(masterfd, idxbuf, idxbuf_pos) !=
                 (ssize_t)sizeof(struct index_entry) * idxbuf_pos)
@@ -3291,12 +4040,117 @@ static int build_index(int index_type, struct tagcache_header *h, int tmpfd)
     close(fd);
     close(masterfd);
 
+    /* Replace the old tag file with the merged one. */
+    if (mergefd >= 0 && !error && rename_merged_file(index_type) < 0)
+    {
+        logf("merge rename failed: %d", index_type);
+        error = true;
+    }
+
     if (error)
         return -2;
 
     return 1;
 }
 
+/**
+ * Rebuild the filename hash index from the filename tag file, using the
+ * tempbuf for the table. Without a valid hash index lookups fall back to
+ * scanning the filename tag file.
+ */
+static bool build_filename_hash(void)
+{
+    struct hash_header hh;
+    struct hash_entry *table = (struct hash_entry *)tempbuf;
+    struct tagfile_entry tfe;
+    long slots = 64;
+    long pos;
+    int fd, hashfd;
+    bool ret = false;
+
+    remove_db_file(TAGCACHE_FILE_HASH);
+
+    fd = open_tag_fd(&hh.ftch, tag_filename, false);
+    if (fd < 0)
+        return false;
+
+    /* Keep the table at most half full. */
+    while (slots < hh.ftch.entry_count * 2)
+        slots *= 2;
+
+    if (slots * sizeof(struct hash_entry) > tempbuf_size)
+    {
+        logf("no room for hash index: %ld", slots);
+        goto exit;
+    }
+
+    logf("building hash index: %ld slots", slots);
+    memset(table, 0xff, slots * sizeof(struct hash_entry));
+
+    pos = sizeof(struct tagcache_header);
+    for (int i = 0; i < hh.ftch.entry_count; i++)
+    {
+        switch (read_tagfile_entry_and_tag(fd, &tfe, build_idx_buf,
+                                           build_idx_bufsz))
+        {
+            case e_SUCCESS:
+            case e_SUCCESS_LEN_ZERO:
+                break;
+            default:
+                logf("hash index: read error");
+                goto exit;
+        }
+
+        /* Deleted entries have no name left. */
+        if (build_idx_buf[0] != '\0')
+        {
+            uint32_t hash = filename_hash(build_idx_buf,
+                                          strlen(build_idx_buf));
+            long slot = hash & (slots - 1);
+
+            while (table[slot].seek >= 0)
+                slot = (slot + 1) & (slots - 1);
+
+            table[slot].hash = hash;
+            table[slot].seek = pos;
+        }
+
+        pos += sizeof(struct tagfile_entry) + tfe.tag_length;
+        do_timed_yield();
+    }
+
+    hashfd = open_db_fd(TAGCACHE_FILE_HASH, O_WRONLY | O_CREAT | O_TRUNC);
+    if (hashfd < 0)
+        goto exit;
+
+    hh.tch.magic = TAGCACHE_MAGIC;
+    hh.tch.datasize = slots * sizeof(struct hash_entry);
+    hh.tch.entry_count = slots;
+
+    /* Written in the byte order of the tag files it indexes. */
+    ssize_t datasize = hh.tch.datasize;
+    swap_hash_header(&hh);
+    if (tc_stat.econ)
+    {
+        for (long i = 0; i < slots; i++)
+            swap_hash_entry(&table[i]);
+    }
+
+    ret = write(hashfd, &hh, sizeof(hh)) == sizeof(hh)
+       && write(hashfd, table, datasize) == datasize;
+    close(hashfd);
+
+    if (!ret)
+    {
+        logf("hash index: write error");
+        remove_db_file(TAGCACHE_FILE_HASH);
+    }
+
+exit:
+    close(fd);
+    return ret;
+}
+
 static bool commit(void)
 {
     struct tagcache_header tch;
@@ -3471,23 +4325,11 @@ static bool commit(void)
         write_master_header(masterfd, &tcmh);
         close(masterfd);
 
+        build_filename_hash();
+
         logf("tagcache committed");
         tagcache_commit_finalize();
 
-#if defined(HAVE_TC_RAMCACHE)
-        if (ramcache_buffer_stolen)
-        {
-            tempbuf = NULL;
-            tempbuf_size = 0;
-            ramcache_buffer_stolen = false;
-            tcrc_buffer_unlock();
-        }
-
-        /* Reload tagcache. */
-        if (tc_stat.ramcache_allocated > 0)
-            tagcache_start_scan();
-#endif /* HAVE_TC_RAMCACHE */
-
         rc = true;
     } /*!USR_CANCEL*/
 
@@ -3512,6 +4354,19 @@ commit_error:
     }
 #endif /* HAVE_DIRCACHE */
 
+#ifdef HAVE_TC_RAMCACHE
+    /* The ram copy is unloaded and may have been overwritten as the temp
+       buffer, and its allocation was shrunk to fit the old database. Start
+       over with one sized for the database on disk; if that can't be had,
+       allocate_tagcache() leaves the ramcache off without a buffer. */
+    if (tc_stat.ramcache_allocated > 0)
+    {
+        core_free(tcramcache.handle);
+        if (allocate_tagcache() && rc)
+            tagcache_start_scan();
+    }
+#endif /* HAVE_TC_RAMCACHE */
+
     return rc;
 }
 
@@ -4014,7 +4869,10 @@ static bool delete_entry(long idx_id)
 #ifdef HAVE_TC_RAMCACHE
     /* At first mark the entry removed from ram cache. */
     if (tc_stat.ramcache)
+    {
         tcramcache.hdr->indices[idx_id].flag |= FLAG_DELETED;
+        posting_remove(idx_id);
+    }
 #endif
 
     if ( (masterfd = open_master_fd(&myhdr, true) ) < 0)
@@ -4095,12 +4953,14 @@ static bool delete_entry(long idx_id)
 #ifdef HAVE_TC_RAMCACHE
         if (tc_stat.ramcache && tag != tag_filename)
         {
-            struct tagfile_entry *tfe;
+            struct tagfile_entry tfe;
             int32_t *seek = &tcramcache.hdr->indices[idx_id].tag_seek[tag];
 
             /* crc_32 is assumed not to yield (why would it...?) */
-            tfe = (struct tagfile_entry *)&tcramcache.hdr->tags[tag][*seek];
-            *seek = crc_32(tfe->tag_data, strlen(tfe->tag_data), 0xffffffff);
+            if (tcrc_get_entry(tag, *seek, &tfe,
+                               build_idx_buf, build_idx_bufsz) < 0)
+                str_setlen(build_idx_buf, 0);
+            *seek = crc_32(build_idx_buf, strlen(build_idx_buf), 0xffffffff);
             myidx.tag_seek[tag] = *seek;
         }
         else
@@ -4153,9 +5013,13 @@ static bool delete_entry(long idx_id)
         /* Delete from ram. */
         if (tc_stat.ramcache && tag != tag_filename)
         {
-            struct tagfile_entry *tagentry =
-                    (struct tagfile_entry *)&tcramcache.hdr->tags[tag][oldseek];
-            str_setlen(tagentry->tag_data, 0); 
+            struct tagfile_entry tfe;
+            long offset = tcrc_get_entry(tag, oldseek, &tfe,
+                                         build_idx_buf, build_idx_bufsz);
+
+            /* The string itself stays, later entries share its prefix. */
+            if (offset >= 0)
+                tcramcache.hdr->tags[tag][offset] |= TCRC_DELETED;
         }
 #endif /* HAVE_TC_RAMCACHE */
 
@@ -4237,7 +5101,12 @@ static void fix_ramcache(void* old_addr, void* new_addr)
 {
     ptrdiff_t offpos = new_addr - old_addr;
     for (int i = 0; i < TAG_COUNT; i++)
+    {
         tcramcache.hdr->tags[i] += offpos;
+        if (tcramcache.hdr->postings[i])
+            tcramcache.hdr->postings[i] = (void *)tcramcache.hdr->postings[i]
+                                            + offpos;
+    }
 }
 
 static int move_cb(int handle, void* current, void* new)
@@ -4276,6 +5145,8 @@ static bool allocate_tagcache(void)
 #ifdef HAVE_DIRCACHE
     alloc_size += tcmh.tch.entry_count*sizeof(struct dircache_fileref);
 #endif
+    alloc_size += POSTING_TAGS_COUNT *
+        (tcmh.tch.entry_count*sizeof(int32_t) + sizeof(int32_t));
 
     int handle = core_alloc_ex(alloc_size, &ops);
     if (handle <= 0)
@@ -4471,6 +5342,22 @@ static bool load_tagcache(void)
         if (rc < 0)
             goto failure;
 
+        /* Reserve the block index of the front-coded entries */
+        struct tcrc_block *blocks = (struct tcrc_block *)p;
+        if (tag != tag_filename)
+        {
+            str_setlen(build_idx_buf, 0);
+            rc = (tch->entry_count + TCRC_BLOCK_ENTRIES - 1) / TCRC_BLOCK_ENTRIES
+                    * sizeof (struct tcrc_block);
+            p += rc;
+            bytesleft -= rc;
+            if (bytesleft < 0)
+            {
+                logf("Too big tagcache #10.6");
+                goto failure;
+            }
+        }
+
         /* Load the entries for this tag */
         for (tcramcache.hdr->entry_count[tag] = 0;
              tcramcache.hdr->entry_count[tag] < tch->entry_count;
@@ -4480,26 +5367,18 @@ static bool load_tagcache(void)
             if (do_timed_yield() && check_event_queue())
                 goto failure;
 
-            p = TC_ALIGN_PTR(p, struct tagfile_entry, &rc);
-            bytesleft -= rc;
-            if (bytesleft < (ssize_t)sizeof(struct tagfile_entry))
-            {
-                logf("Too big tagcache #10.75");
-                goto failure;
-            }
-
-            struct tagfile_entry *fe = (struct tagfile_entry *)p;
+            struct tagfile_entry fe;
             off_t pos = lseek(fd, 0, SEEK_CUR);
 
             /* Load the header for the tag itself */
-            if (read_tagfile_entry(fd, fe) != sizeof(struct tagfile_entry))
+            if (read_tagfile_entry(fd, &fe) != sizeof(struct tagfile_entry))
             {
                 /* End of lookup table. */
                 logf("read error #11");
                 goto failure;
             }
 
-            int idx_id = fe->idx_id; /* dircache reference clobbers *fe */
+            int idx_id = fe.idx_id;
             struct index_entry *idx = &tcramcache.hdr->indices[idx_id];
 
             if (idx_id != -1 || tag == tag_filename) /* filename NOT optional */
@@ -4534,10 +5413,15 @@ static bool load_tagcache(void)
 
                 p += sizeof (struct dircache_fileref);
                 bytesleft -= sizeof (struct dircache_fileref);
+                if (bytesleft < 0)
+                {
+                    logf("Too big tagcache #10.75");
+                    goto failure;
+                }
             #endif /* HAVE_DIRCACHE */
 
                 char filename[TAGCACHE_BUFSZ];
-                if (fe->tag_length >= (long)sizeof(filename)-1)
+                if (fe.tag_length >= (long)sizeof(filename)-1)
                 {
                     read(fd, filename, 10);
                     str_setlen(filename, 10);
@@ -4550,7 +5434,7 @@ static bool load_tagcache(void)
                     IFN_DIRCACHE( || !global_settings.tagcache_autoupdate ))
                 {
                     /* seek over tag data instead of reading */
-                    if (lseek(fd, fe->tag_length, SEEK_CUR) < 0)
+                    if (lseek(fd, fe.tag_length, SEEK_CUR) < 0)
                     {
                         logf("read error #11.5");
                         goto failure;
@@ -4559,7 +5443,7 @@ static bool load_tagcache(void)
                     continue;
                 }
 
-                if (read(fd, filename, fe->tag_length) != fe->tag_length)
+                if (read(fd, filename, fe.tag_length) != fe.tag_length)
                 {
                     logf("read error #12");
                     goto failure;
@@ -4567,28 +5451,88 @@ static bool load_tagcache(void)
                 continue;
             }
 
-            bytesleft -= sizeof(struct tagfile_entry) + fe->tag_length;
+            if (fe.tag_length >= build_idx_bufsz)
+            {
+                logf("too long tag #7");
+                goto failure;
+            }
+
+            ssize_t reserved = TCRC_ENTRY_HDR_MAX + fe.tag_length + 1;
+            bytesleft -= reserved;
             if (bytesleft < 0)
             {
                 logf("too big tagcache #2");
-                logf("tl: %ld", fe->tag_length);
+                logf("tl: %ld", fe.tag_length);
                 logf("bl: %ld", bytesleft);
                 goto failure;
             }
 
-            p = fe->tag_data;
-            rc = read(fd, p, fe->tag_length);
-            p += rc;
+            /* Read the string behind the space reserved for the entry
+               header, then front-code it against the previous string of
+               the block kept in build_idx_buf. */
+            char *str = p + TCRC_ENTRY_HDR_MAX;
+            rc = read(fd, str, fe.tag_length);
 
-            if (rc != fe->tag_length)
+            if (rc != fe.tag_length)
             {
                 logf("read error #13");
                 logf("rc=0x%04x", (unsigned int)rc); // 0x431
-                logf("len=0x%04lx", fe->tag_length); // 0x4000
+                logf("len=0x%04lx", fe.tag_length); // 0x4000
                 logf("pos=0x%04lx", lseek(fd, 0, SEEK_CUR)); // 0x433
                 logf("tag=0x%02x", tag); // 0x00
                 goto failure;
             }
+
+            str_setlen(str, fe.tag_length);
+            const char *src = str;
+            size_t len = strlen(src);
+            size_t prefix = 0;
+            unsigned long flags = 0;
+
+            /* Entries deleted from the tag file are empty. Store them as a
+               copy of the previous string to keep the strings sorted. */
+            if (len == 0)
+            {
+                src = build_idx_buf;
+                len = strlen(src);
+                flags = TCRC_DELETED;
+
+                if ((long)len > fe.tag_length)
+                {
+                    reserved += len - fe.tag_length;
+                    bytesleft -= len - fe.tag_length;
+                    if (bytesleft < 0)
+                    {
+                        logf("too big tagcache #2.5");
+                        goto failure;
+                    }
+                }
+            }
+
+            int entry = tcramcache.hdr->entry_count[tag];
+            if (entry % TCRC_BLOCK_ENTRIES == 0)
+            {
+                struct tcrc_block *b = &blocks[entry / TCRC_BLOCK_ENTRIES];
+                b->seek = pos;
+                b->offset = p - tcramcache.hdr->tags[tag];
+            }
+            else
+            {
+                while (prefix < len && src[prefix] == build_idx_buf[prefix])
+                    prefix++;
+            }
+
+            if (src != build_idx_buf)
+                memcpy(build_idx_buf + prefix, src + prefix, len - prefix + 1);
+
+            char *q = tcrc_put_varint(p, (prefix << 1) | flags);
+            q = tcrc_put_varint(q, fe.tag_length);
+            q = tcrc_put_varint(q, idx_id + 1);
+            memmove(q, src + prefix, len - prefix + 1);
+            q += len - prefix + 1;
+
+            bytesleft += reserved - (q - p);
+            p = q;
         }
 
     #ifdef HAVE_DIRCACHE
@@ -4599,7 +5543,51 @@ static bool load_tagcache(void)
         close(fd);
     }
 
+    /* Build the postings of the unique tags */
+    for (int tag = 0; tag < TAG_COUNT; tag++)
+    {
+        ssize_t rc;
+
+        if (!TAGCACHE_HAS_POSTINGS(tag))
+            continue;
+
+        p = TC_ALIGN_PTR(p, int32_t, &rc);
+        bytesleft -= rc + tcmh.tch.entry_count * sizeof(int32_t);
+        if (bytesleft < 0)
+        {
+            logf("too big tagcache #3");
+            goto failure;
+        }
+
+        int32_t *postings = (int32_t *)p;
+        int count = 0;
+
+        for (int i = 0; i < tcmh.tch.entry_count; i++)
+        {
+            if (!(tcramcache.hdr->indices[i].flag & FLAG_DELETED))
+                postings[count++] = i;
+        }
+
+        posting_sort_tag = tag;
+        qsort(postings, count, sizeof(int32_t), posting_compare);
+
+        tcramcache.hdr->postings[tag] = postings;
+        tcramcache.hdr->posting_count[tag] = count;
+        p += count * sizeof(int32_t);
+        bytesleft += (tcmh.tch.entry_count - count) * sizeof(int32_t);
+    }
+
     tc_stat.ramcache_used = tc_stat.ramcache_allocated - bytesleft;
+
+    /* The allocation is sized for the tag files, front-coding needs less.
+       Return the rest but keep the reserve for the next commit. */
+    size_t size = ALIGN_UP(tc_stat.ramcache_used + TAGCACHE_RESERVE, 4);
+    if (size < (size_t)tc_stat.ramcache_allocated
+        && core_shrink(tcramcache.handle, tcramcache.hdr, size))
+    {
+        tc_stat.ramcache_allocated = size;
+    }
+
     logf("tagcache loaded into ram!");
     logf("utilization: %d%%", 100*tc_stat.ramcache_used / tc_stat.ramcache_allocated);
 
@@ -4861,6 +5849,64 @@ static int free_search_roots(struct search_roots_ll * start)
 #define free_search_roots(a) do {} while(0)
 #endif
 
+#ifdef TAGCACHE_SCAN_PREFETCH
+/* Second cursor on the directory being scanned, running ahead of it. */
+struct scan_prefetch
+{
+    DIR *dir;
+    int ahead; /* Files hinted but not added yet */
+};
+
+static void scan_prefetch_file(const char *dirname, const char *name)
+{
+    static char path[TAGCACHE_BUFSZ];
+
+    if (path_append(path, dirname, name, sizeof(path)) >= sizeof(path))
+        return;
+
+    if (probe_file_format(path) == AFMT_UNKNOWN)
+        return;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    /* Starts the reads in the background, closing the file doesn't stop
+     * them. Tags can be found at either end of the file. */
+    off_t size = filesize(fd);
+    posix_fadvise(fd, 0, TAGCACHE_PREFETCH_HEAD, POSIX_FADV_WILLNEED);
+    if (size > TAGCACHE_PREFETCH_HEAD + TAGCACHE_PREFETCH_TAIL)
+        posix_fadvise(fd, size - TAGCACHE_PREFETCH_TAIL,
+                      TAGCACHE_PREFETCH_TAIL, POSIX_FADV_WILLNEED);
+
+    close(fd);
+}
+
+static void scan_prefetch(struct scan_prefetch *pf, const char *dirname)
+{
+    while (pf->dir && pf->ahead < TAGCACHE_PREFETCH_DEPTH)
+    {
+        struct dirent *entry = readdir(pf->dir);
+        if (entry == NULL)
+        {
+            closedir(pf->dir);
+            pf->dir = NULL;
+            break;
+        }
+
+        struct dirinfo info = dir_get_info(pf->dir, entry);
+        if (is_dotdir_name(entry->d_name) || (info.attribute & ATTR_DIRECTORY))
+            continue;
+
+        scan_prefetch_file(dirname, entry->d_name);
+        pf->ahead++;
+    }
+
+    /* One for the file about to be added. */
+    pf->ahead--;
+}
+#endif /* TAGCACHE_SCAN_PREFETCH */
+
 static bool check_dir(const char *dirname, int add_files)
 {
     int success = false;
@@ -4880,6 +5926,11 @@ static bool check_dir(const char *dirname, int add_files)
     if (ignore != unignore)
         add_files = unignore;
 
+#ifdef TAGCACHE_SCAN_PREFETCH
+    struct scan_prefetch pf = { .dir = add_files ? opendir(dirname) : NULL,
+                                .ahead = 0 };
+#endif
+
     /* Recursively scan the dir. */
     while (!check_event_queue())
     {
@@ -4912,6 +5963,9 @@ static bool check_dir(const char *dirname, int add_files)
         }
         else if (add_files)
         {
+#ifdef TAGCACHE_SCAN_PREFETCH
+            scan_prefetch(&pf, dirname);
+#endif
             tc_stat.curentry = curpath;
 
             /* Add a new entry to the temporary db file. */
@@ -4927,6 +5981,10 @@ static bool check_dir(const char *dirname, int add_files)
         str_setlen(curpath, len);
     }
 
+#ifdef TAGCACHE_SCAN_PREFETCH
+    if (pf.dir)
+        closedir(pf.dir);
+#endif
     closedir(dir);
 
     return success;
@@ -4978,6 +6036,7 @@ void do_tagcache_build(const char *path[])
     }
 
     filenametag_fd = open_tag_fd(&header, tag_filename, false);
+    filenamehash_fd = open_db_fd(TAGCACHE_FILE_HASH, O_RDONLY);
 
     cpu_boost(true);
 
@@ -5072,6 +6131,12 @@ void do_tagcache_build(const char *path[])
         filenametag_fd = -1;
     }
 
+    if (filenamehash_fd >= 0)
+    {
+        close(filenamehash_fd);
+        filenamehash_fd = -1;
+    }
+
     if (!ret)
     {
         logf("Aborted.");
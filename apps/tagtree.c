@@ -2108,6 +2108,7 @@ static bool insert_all_playlist(struct tree_context *c,
                                 int position, bool queue)
 {
     struct tagcache_search tcs;
+    struct playlist_insert_context context;
     int i, n;
     int fd = -1;
     unsigned long last_tick;
@@ -2145,6 +2146,17 @@ static bool insert_all_playlist(struct tree_context *c,
         }
     }
 
+    /* one context for all tracks so they are inserted as a batch */
+    if (playlist == NULL &&
+        playlist_insert_context_create(NULL, &context, position, queue,
+                                       false) < 0)
+    {
+        playlist_insert_context_release(&context);
+        tagcache_search_finish(&tcs);
+        cpu_boost(false);
+        return false;
+    }
+
     last_tick = current_tick + HZ/2; /* Show splash after 0.5 seconds have passed */
     splash_progress_set_delay(HZ / 2); /* wait 1/2 sec before progress */
     n = c->filesindir;
@@ -2167,9 +2179,9 @@ static bool insert_all_playlist(struct tree_context *c,
 
         if (playlist == NULL)
         {
-            if (playlist_insert_track(NULL, buf, position, queue, false) < 0)
+            if (playlist_insert_context_add(&context, buf) < 0)
             {
-                logf("playlist_insert_track failed");
+                logf("playlist_insert_context_add failed");
                 break;
             }
         }
@@ -2177,14 +2189,9 @@ static bool insert_all_playlist(struct tree_context *c,
                 break;
 
         yield();
-
-        if (playlist == NULL && position == PLAYLIST_INSERT_FIRST)
-        {
-            position = PLAYLIST_INSERT;
-        }
     }
     if (playlist == NULL)
-        playlist_sync(NULL);
+        playlist_insert_context_release(&context);
     else
         close(fd);
     tagcache_search_finish(&tcs);
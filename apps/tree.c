@@ -1148,7 +1148,8 @@ bool bookmark_play(char *resume_file, int index, unsigned long elapsed,
     bool started = false;
 
     if (suffix != NULL &&
-        (!strcasecmp(suffix, ".m3u") || !strcasecmp(suffix, ".m3u8")))
+        (!strcasecmp(suffix, ".m3u") || !strcasecmp(suffix, ".m3u8") ||
+         !strcasecmp(suffix, PLAYLIST_BIN_EXT)))
     {
         /* Playlist playback */
         char* slash;
@@ -1274,9 +1275,6 @@ void tree_flush(void)
 
 #ifdef HAVE_DIRCACHE
     int old_val = global_status.dircache_size;
-#ifdef HAVE_EEPROM_SETTINGS
-    bool savecache = false;
-#endif
 
     if (global_settings.dircache)
     {
@@ -1286,9 +1284,6 @@ void tree_flush(void)
         dircache_get_info(&info);
 
         global_status.dircache_size = info.last_size;
-    #ifdef HAVE_EEPROM_SETTINGS
-        savecache = firmware_settings.initialized;
-    #endif
     }
     else
     {
@@ -1297,11 +1292,6 @@ void tree_flush(void)
 
     if (old_val != global_status.dircache_size)
         status_save();
-
-    #ifdef HAVE_EEPROM_SETTINGS
-        if (savecache)
-            dircache_save();
-    #endif
 #endif /* HAVE_DIRCACHE */
 }
 
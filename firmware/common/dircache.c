@@ -25,6 +25,7 @@
 #include "string-extra.h"
 #include <stdbool.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include "debug.h"
 #include "system.h"
 #include "logf.h"
@@ -203,6 +204,10 @@ static struct event_queue dircache_queue SHAREDBSS_ATTR;
 static uintptr_t dircache_stack[DIRCACHE_STACK_SIZE / sizeof (uintptr_t)];
 static const char dircache_thread_name[] = "dircache";
 
+/* name hash tables have DIRCACHE_HASH_MIN slots doubled up to this many
+   times less one, which covers the 0xffff entries a directory may have */
+#define HASH_ORDERS 12
+
 /* struct that is both used during run time and for persistent storage */
 static struct dircache
 {
@@ -212,7 +217,7 @@ static struct dircache
     size_t       sizeused;            /* bytes of .size bytes actually used */
     union {
     unsigned int numentries;          /* entry count (including holes) */
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
     size_t       sizeentries;         /* used when persisting */
 #endif
     };
@@ -220,6 +225,14 @@ static struct dircache
     size_t       sizenames;           /* size of all names (including holes) */
     size_t       namesfree;           /* amount of wasted name space */
     int          nextnamefree;        /* hint of next free name in buffer */
+    /* name hashes of large directories (most recently used first) */
+    struct dircache_hashdir
+    {
+        int            idx;           /* directory index (0 = unused) */
+        int            tbl;           /* first table block (0 = unhashable) */
+        unsigned int   mask;          /* table slot count - 1 */
+    } hashdirs[DIRCACHE_HASH_DIRS];
+    int          hashfree[HASH_ORDERS]; /* freed tables, by order of size */
     /* per-volume data */
     struct dircache_volume            /* per volume cache data */
     {
@@ -294,7 +307,7 @@ static struct dircache_runinfo
 #define DIRCACHE_STUFFED(reserve_used) \
     ((reserve_used) > 3*DIRCACHE_RESERVE / 4)
 
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
 /**
  * remove the snapshot file
  */
@@ -310,7 +323,7 @@ static int open_dircache_file(int oflag)
 {
     return open(DIRCACHE_FILE, oflag, 0666);
 }
-#endif /* HAVE_EEPROM_SETTINGS */
+#endif /* DIRCACHE_SNAPSHOT */
 
 #ifdef DIRCACHE_DUMPSTER
 /**
@@ -1042,6 +1055,232 @@ static int create_entry(const char *basename,
     return idx;
 }
 
+/** Name hashing for lookups in large directories **/
+
+/* hash tables are stored in place of runs of cache entries; each block holds
+   as many slots as fit ahead of the serial number, which is left at zero so
+   that the block is seen as free by the cache-wide iterators; a freed table
+   is kept whole for the next table of its size, linked through its first
+   slot */
+#define HASHBLK_SLOTS \
+    (offsetof(struct dircache_entry, serialnum) / sizeof (int))
+
+/**
+ * hash a name in the same way that strcasecmp() compares it
+ */
+static uint32_t name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (unsigned char c; (c = *name); name++)
+        hash = (hash ^ tolower(c)) * 16777619u;
+
+    return hash;
+}
+
+/**
+ * return the number of blocks used by a hash table of mask + 1 slots
+ */
+static inline unsigned int hash_table_blocks(unsigned int mask)
+{
+    return (mask + HASHBLK_SLOTS) / HASHBLK_SLOTS;
+}
+
+/**
+ * return the size order of a hash table of mask + 1 slots
+ */
+static unsigned int hash_table_order(unsigned int mask)
+{
+    unsigned int order = 0;
+    for (unsigned int n = (mask + 1) / DIRCACHE_HASH_MIN; n > 1; n >>= 1)
+        order++;
+
+    return order;
+}
+
+/**
+ * return a pointer to a slot in a hash table
+ */
+static int * get_hash_slotp(int tbl, unsigned int slot)
+{
+    int *blk = (int *)get_entry(tbl + slot / HASHBLK_SLOTS);
+    return &blk[slot % HASHBLK_SLOTS];
+}
+
+/**
+ * find the hash registration of a directory
+ */
+static struct dircache_hashdir * hash_dir_find(int diridx)
+{
+    for (int i = 0; i < DIRCACHE_HASH_DIRS; i++)
+    {
+        struct dircache_hashdir *hdp = &dircache.hashdirs[i];
+        if (hdp->idx == diridx)
+            return hdp;
+
+        if (hdp->idx == 0)
+            break;
+    }
+
+    return NULL;
+}
+
+/**
+ * move a hash registration to the front of the list, shifting down the
+ * ones ahead of it
+ */
+static struct dircache_hashdir * hash_dir_touch(struct dircache_hashdir *hdp)
+{
+    struct dircache_hashdir hd = *hdp;
+    memmove(&dircache.hashdirs[1], &dircache.hashdirs[0],
+            (hdp - dircache.hashdirs) * sizeof (*hdp));
+    dircache.hashdirs[0] = hd;
+    return &dircache.hashdirs[0];
+}
+
+/**
+ * release a hash table and clear its registration
+ */
+static void hash_dir_free(struct dircache_hashdir *hdp)
+{
+    if (hdp->tbl > 0)
+    {
+        int *freep = &dircache.hashfree[hash_table_order(hdp->mask)];
+        *get_hash_slotp(hdp->tbl, 0) = *freep;
+        *freep = hdp->tbl;
+
+        dircache.sizeused -= hash_table_blocks(hdp->mask) * ENTRYSIZE;
+    }
+
+    hdp->idx = 0;
+    hdp->tbl = 0;
+}
+
+/**
+ * forget the hash of a directory whose contents are changing
+ */
+static void hash_dir_changed(int diridx)
+{
+    struct dircache_hashdir *hdp = hash_dir_find(diridx);
+    if (!hdp)
+        return;
+
+    hash_dir_free(hdp);
+
+    /* keep the ones in use together at the front */
+    struct dircache_hashdir *endp = &dircache.hashdirs[DIRCACHE_HASH_DIRS];
+    memmove(hdp, hdp + 1, (endp - (hdp + 1)) * sizeof (*hdp));
+    endp[-1].idx = 0;
+}
+
+/**
+ * hash the names in a directory if it has enough entries to be worth it;
+ * the table is a freed one of at least the size needed or else comes from
+ * fresh entry space so as not to fragment it
+ *
+ * returns the new registration or NULL if the directory is too small
+ */
+static struct dircache_hashdir * hash_dir_build(int diridx)
+{
+    int *downp = get_downidxp(diridx);
+    if (!downp)
+        return NULL;
+
+    unsigned int count = 0;
+    for (int idx = *downp; idx; idx = get_entry(idx)->next)
+        count++;
+
+    if (count < DIRCACHE_HASH_MIN)
+        return NULL;
+
+    /* keep it under 2/3 full */
+    unsigned int mask = DIRCACHE_HASH_MIN - 1;
+    while (mask < count + count / 2)
+        mask = mask*2 + 1;
+
+    /* take the least recently used registration */
+    struct dircache_hashdir *hdp = &dircache.hashdirs[DIRCACHE_HASH_DIRS-1];
+    hash_dir_free(hdp);
+    hdp = hash_dir_touch(hdp);
+
+    hdp->idx  = diridx;
+    hdp->tbl  = 0;
+    hdp->mask = mask;
+
+    /* a larger table only makes for fewer collisions */
+    int tbl = 0;
+    for (unsigned int order = hash_table_order(mask);
+         order < HASH_ORDERS; order++, mask = mask*2 + 1)
+    {
+        int *freep = &dircache.hashfree[order];
+        if (*freep)
+        {
+            tbl = *freep;
+            *freep = *get_hash_slotp(tbl, 0);
+            break;
+        }
+    }
+
+    size_t size;
+
+    if (tbl)
+    {
+        hdp->mask = mask;
+        size = hash_table_blocks(mask) * ENTRYSIZE;
+    }
+    else
+    {
+        /* leave at least half the reserve for new entries; if there isn't
+           room, it stays registered as unhashable until something changes */
+        mask = hdp->mask;
+        size = hash_table_blocks(mask) * ENTRYSIZE;
+        if (dircache_buf_remaining() < size + DIRCACHE_RESERVE / 2)
+            return hdp;
+
+        tbl = dircache.numentries + 1;
+        dircache.numentries += size / ENTRYSIZE;
+        dircache.size       += size;
+    }
+
+    dircache.sizeused += size;
+    memset(get_entry(tbl), 0, size);
+    hdp->tbl = tbl;
+
+    for (int idx = *downp; idx;)
+    {
+        struct dircache_entry *ce = get_entry(idx);
+        char name[MAX_COMPNAME+1];
+        entry_name_copy(name, ce);
+
+    #ifdef DIRCACHE_NATIVE
+        if (ce->direntries == 1)
+        {
+            /* a short name is compared after decoding it from the OEM
+               codepage, which only ASCII is guaranteed to survive as is */
+            for (const unsigned char *p = name; *p; p++)
+            {
+                if (*p >= 0x80)
+                {
+                    hash_dir_free(hdp);
+                    hdp->idx = diridx;
+                    return hdp;
+                }
+            }
+        }
+    #endif /* DIRCACHE_NATIVE */
+
+        unsigned int slot = name_hash(name) & mask;
+        int *slotp;
+        while (*(slotp = get_hash_slotp(tbl, slot)))
+            slot = (slot + 1) & mask;
+
+        *slotp = idx;
+        idx = ce->next;
+    }
+
+    return hdp;
+}
+
 /**
  * unlink the entry at *prevp and adjust the scanner if needed
  */
@@ -1050,6 +1289,7 @@ static void remove_entry(struct dircache_runinfo_volume *dcrivolp,
 {
     /* unlink it from its list */
     *prevp = ce->next;
+    hash_dir_changed(ce->up);
 
     if (dcrivolp)
     {
@@ -1144,6 +1384,7 @@ static void insert_file_entry(struct file_base_info *dirinfop,
     ce->up   = diridx;
     ce->next = *nextp;
     *nextp   = get_index(ce);
+    hash_dir_changed(diridx);
 }
 
 /**
@@ -1318,6 +1559,7 @@ static void sab_process_sub(struct sab *sabp)
             ce->next = prev;
             *compp->prevp = idx;
             compp->prevp = &ce->next;
+            hash_dir_changed(compp->idx);
 
             if (!(fatentp->attr & ATTR_DIRECTORY))
                 ce->filesize = fatentp->filesize;
@@ -1548,6 +1790,35 @@ void dircache_rewinddir_dirent(struct dirscan_info *scanp)
     dircache_dcfile_init(&scanp->dcscan);
 }
 
+/**
+ * fill in the FS entry and scan information for a cache entry in the same way
+ * that reading it from the directory would
+ */
+static int read_cache_entry(int idx, struct file_base_info *infop,
+                            struct fat_direntry *fatent)
+{
+    struct dircache_entry *ce = get_entry(idx);
+
+    /* FS entry information that we maintain */
+    entry_name_copy(fatent->name, ce);
+    fatent->shortname[0]     = '\0';
+    fatent->attr             = ce->attr;
+    /* file code file scanning does not need time information */
+    fatent->filesize         = (ce->attr & ATTR_DIRECTORY) ? 0 : ce->filesize;
+    fatent->firstcluster     = ce->firstcluster;
+
+    /* FS entry directory information */
+    infop->fatfile.e.entry   = ce->direntry;
+    infop->fatfile.e.entries = ce->direntries;
+
+    /* dircache file binding information */
+    infop->dcfile.idx        = idx;
+    infop->dcfile.serialnum  = ce->serialnum;
+
+    /* return whether this needs decoding */
+    return ce->direntries == 1 ? 2 : 1;
+}
+
 /**
  * this function is the back end to file API internal scanning, which requires
  * much more detail about the directory entries; this is allowed to make
@@ -1606,24 +1877,7 @@ int dircache_readdir_internal(struct filestr_base *stream,
         goto read_eod;
     }
 
-    /* FS entry information that we maintain */
-    entry_name_copy(fatent->name, ce);
-    fatent->shortname[0]     = '\0';
-    fatent->attr             = ce->attr;
-    /* file code file scanning does not need time information */
-    fatent->filesize         = (ce->attr & ATTR_DIRECTORY) ? 0 : ce->filesize;
-    fatent->firstcluster     = ce->firstcluster;
-
-    /* FS entry directory information */
-    infop->fatfile.e.entry   = ce->direntry;
-    infop->fatfile.e.entries = ce->direntries;
-
-    /* dircache file binding information */
-    infop->dcfile.idx        = idx;
-    infop->dcfile.serialnum  = ce->serialnum;
-
-    /* return whether this needs decoding */
-    int rc = ce->direntries == 1 ? 2 : 1;
+    int rc = read_cache_entry(idx, infop, fatent);
 
     if (frontier == FRONTIER_SETTLED)
     {
@@ -1643,6 +1897,59 @@ read_eod:
     return 0;    
 }
 
+/**
+ * look up a name directly in a directory that is hashed, hashing it first if
+ * it's large enough; results are as dircache_readdir_internal() returns them
+ * for the entry found
+ *
+ * returns: < 0 if the directory must be scanned for the name instead
+ */
+int dircache_findname_internal(struct filestr_base *stream,
+                               struct file_base_info *infop,
+                               struct fat_direntry *fatent,
+                               const char *name)
+{
+    /* call with writer exclusion */
+    struct file_base_info *dirinfop = stream->infop;
+
+    if (!dirinfop->dcfile.serialnum)
+        return -1; /* parent isn't cached */
+
+    int diridx = dirinfop->dcfile.idx;
+    uint32_t frontier = get_frontier(diridx);
+    if (frontier & FRONTIER_NEW)
+        return -1; /* still being built */
+
+    struct dircache_hashdir *hdp = hash_dir_find(diridx);
+    if (hdp)
+        hdp = hash_dir_touch(hdp);
+    else
+        hdp = hash_dir_build(diridx);
+
+    if (!hdp || !hdp->tbl)
+        return -1;
+
+    for (unsigned int slot = name_hash(name) & hdp->mask;;
+         slot = (slot + 1) & hdp->mask)
+    {
+        int idx = *get_hash_slotp(hdp->tbl, slot);
+        if (!idx)
+            break;
+
+        entry_name_copy(fatent->name, get_entry(idx));
+        if (!strcasecmp(name, fatent->name))
+            return read_cache_entry(idx, infop, fatent);
+    }
+
+    /* if anything is missing from the cache, it might be there anyway */
+    if (frontier != FRONTIER_SETTLED)
+        return -1;
+
+    fat_empty_fat_direntry(fatent);
+    infop->fatfile.e.entries = 0;
+    return 0;
+}
+
 /**
  * rewind the scan position for an internal scan
  */
@@ -1825,6 +2132,8 @@ static void reset_cache(void)
     dircache.sizenames    = 0;
     dircache.namesfree    = 0;
     dircache.nextnamefree = 0;
+    memset(dircache.hashdirs, 0, sizeof (dircache.hashdirs));
+    memset(dircache.hashfree, 0, sizeof (dircache.hashfree));
     *get_name(dircache.names - 1) = 0;
     /* dircache.last_serialnum stays */
     /* dircache.reserve_used stays */
@@ -1897,7 +2206,7 @@ static int prepare_build(bool *realloced)
     /* called holding dircache lock */
     size_t size = dircache.last_size;
 
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
     if (realloced)
     {
         dircache_unlock();
@@ -1907,7 +2216,7 @@ static int prepare_build(bool *realloced)
         if (dircache_runinfo.suspended)
             return -1;
     }
-#endif /* HAVE_EEPROM_SETTINGS */
+#endif /* DIRCACHE_SNAPSHOT */
 
     bool stuffed = DIRCACHE_STUFFED(dircache.reserve_used);
     if (dircache_runinfo.bufsize > size && !stuffed)
@@ -2768,6 +3077,99 @@ file_error:
     return rc;    
 }
 
+/**
+ * Look up a name in a directory given by a file reference without walking the
+ * path from the root again; meant for resolving many files that share a
+ * directory. Only the cache is consulted.
+ *
+ * returns:
+ *   success: 0 = not cached (indecisive)
+ *            3 = name is valid; reference updated
+ *   failure: a negative value
+ *
+ * errors:
+ *   EFAULT  - Bad address
+ *   ENOENT  - No such file or directory
+ *   ENOTDIR - Not a directory
+ */
+int dircache_search_name(const struct dircache_fileref *dirrefp,
+                         const char *name, struct dircache_fileref *dcfrefp)
+{
+    if (!dirrefp || !name || !dcfrefp)
+        FILE_ERROR_RETURN(EFAULT, -1);
+
+    int rc = 0;
+
+    dircache_lock();
+
+    if (!dircache_runinfo.handle)
+        FILE_ERROR(ERRNO, RC);  /* cache not enabled; not cached */
+
+    if (check_file_serialnum(&dirrefp->dcfile) < 0)
+        FILE_ERROR(ERRNO, RC);  /* directory reference is stale */
+
+    int diridx = dirrefp->dcfile.idx;
+    if (diridx > 0 && !(get_entry(diridx)->attr & ATTR_DIRECTORY))
+        FILE_ERROR(ENOTDIR, -2);
+
+    uint32_t frontier = get_frontier(diridx);
+    if (frontier & FRONTIER_NEW)
+        FILE_ERROR(ERRNO, RC);  /* still being built */
+
+    char entname[MAX_COMPNAME+1];
+    int idx = 0;
+
+    struct dircache_hashdir *hdp = hash_dir_find(diridx);
+    if (hdp)
+        hdp = hash_dir_touch(hdp);
+    else
+        hdp = hash_dir_build(diridx);
+
+    if (hdp && hdp->tbl)
+    {
+        for (unsigned int slot = name_hash(name) & hdp->mask;;
+             slot = (slot + 1) & hdp->mask)
+        {
+            idx = *get_hash_slotp(hdp->tbl, slot);
+            if (!idx)
+                break;
+
+            entry_name_copy(entname, get_entry(idx));
+            if (!strcasecmp(name, entname))
+                break;
+        }
+    }
+    else
+    {
+        for (idx = *get_downidxp(diridx); idx; idx = get_entry(idx)->next)
+        {
+            entry_name_copy(entname, get_entry(idx));
+            if (!strcasecmp(name, entname))
+                break;
+        }
+    }
+
+    if (idx)
+    {
+        dcfrefp->dcfile.idx       = idx;
+        dcfrefp->dcfile.serialnum = get_entry(idx)->serialnum;
+        dcfrefp->serialhash       = get_file_serialhash(&dcfrefp->dcfile);
+        rc = 3;
+    }
+    else if (frontier == FRONTIER_SETTLED)
+    {
+        FILE_ERROR(ENOENT, -3); /* directory is complete; absent */
+    }
+    /* else directory is incomplete: indecisive */
+
+file_error:
+    if (rc <= 0)
+        dircache_fileref_init(dcfrefp);
+
+    dircache_unlock();
+    return rc;
+}
+
 /**
  * Compare dircache file references (no validity check is made)
  *
@@ -2984,35 +3386,51 @@ void dircache_dcfile_init(struct dircache_file *dcfilep)
     dcfilep->serialnum = 0;
 }
 
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
 
-#ifdef HAVE_HOTSWAP
-/* NOTE: This is hazardous to the filesystem of any sort of removable
-         storage unless it may be determined that the filesystem from save
-         to load is identical. If it's not possible to do so in a timely
-         manner, it's not worth persisting the cache. */
-  #warning "Don't do this; you'll find the consequences unpleasant."
-#endif
+/* NOTE: The snapshot is never trusted blindly. At load, every directory is
+         reread and its entries are brought up to date. A directory's own
+         entry can't vouch for its contents: FAT doesn't touch a directory's
+         write time when files in it are created, replaced or rewritten.
+         Whatever turns up that wasn't saved is left to a background build of
+         just those directories. */
 
-/* dircache persistence file header magic */
-#define DIRCACHE_MAGIC  0x00d0c0a1
+/* dircache persistence file header magic; changes with the format */
+#define DIRCACHE_MAGIC  0x00d0c0a4
 
 /* dircache persistence file header */
 struct dircache_maindata
 {
     uint32_t        magic;      /* DIRCACHE_MAGIC */
+    uint32_t        entrysize;  /* ENTRYSIZE when saved */
     struct dircache dircache;   /* metadata of the cache! */
     uint32_t        datacrc;    /* CRC32 of data */
     uint32_t        hdrcrc;     /* CRC32 of header through datacrc */
 } __attribute__((packed, aligned (4)));
 
+/* snapshot validation data */
+struct dcsnap
+{
+    struct filestr_base   stream;   /* directory stream */
+    struct file_base_info info;     /* directory/scanned entry info */
+};
+
 /**
  * verify that the clean status is A-ok
  */
 static bool dircache_is_clean(bool saving)
 {
     if (saving)
+    {
+        /* a volume still being built can't be saved */
+        FOR_EACH_VOLUME(-1, volume)
+        {
+            if (DCVOL(volume)->status == DIRCACHE_SCANNING)
+                return false;
+        }
+
         return dircache.dcvol[0].status == DIRCACHE_READY;
+    }
     else
     {
         return dircache.dcvol[0].status == DIRCACHE_IDLE &&
@@ -3020,9 +3438,236 @@ static bool dircache_is_clean(bool saving)
     }
 }
 
+/**
+ * drop a loaded entry (and its subtree) that is not on the volume anymore
+ */
+static void snapshot_drop_entry(struct dircache_runinfo_volume *dcrivolp,
+                                struct dircache_entry *ce, int *prevp)
+{
+    if ((ce->attr & ATTR_DIRECTORY) && ce->down)
+        free_subentries(dcrivolp, &ce->down);
+
+    remove_entry(dcrivolp, ce, prevp);
+    free_orphan_entry(dcrivolp, ce, get_index(ce));
+}
+
+/**
+ * bring a loaded entry up to date with what was just read from the volume
+ *
+ * returns: < 0 if it isn't the same entry anymore
+ *          0 if it's up to date
+ *          > 0 if it is a directory whose contents must be checked again
+ */
+static int snapshot_update_entry(struct dircache_runinfo_volume *dcrivolp,
+                                 struct dircache_entry *ce,
+                                 const struct file_base_info *infop,
+                                 const struct fat_direntry *fatentp)
+{
+    if (ce->direntries != infop->fatfile.e.entries ||
+        ((ce->attr ^ fatentp->attr) & ATTR_DIRECTORY))
+        return -1;
+
+    char name[MAX_COMPNAME+1];
+    entry_name_copy(name, ce);
+    if (strcmp(name, fatentp->name))
+        return -1;
+
+    int rc = 0;
+
+    if (!(ce->attr & ATTR_DIRECTORY))
+        ce->filesize = fatentp->filesize;
+    else if (!is_dotdir_name(name))
+    {
+        if (ce->firstcluster != fatentp->firstcluster)
+        {
+            /* a different directory by the same name */
+            if (ce->down)
+                free_subentries(dcrivolp, &ce->down);
+
+            rc = 1;
+        }
+        else if (ce->wrtdate != fatentp->wrtdate ||
+                 ce->wrttime != fatentp->wrttime)
+        {
+            rc = 1;
+        }
+
+        if (rc > 0)
+            establish_frontier(get_index(ce), FRONTIER_NEW);
+    }
+
+    ce->attr         = fatentp->attr;
+    ce->firstcluster = fatentp->firstcluster;
+    ce->wrtdate      = fatentp->wrtdate;
+    ce->wrttime      = fatentp->wrttime;
+
+    return rc;
+}
+
+/**
+ * check the loaded contents of the directory in snapp->info against the
+ * volume and descend into the subdirectories that need it; entries that
+ * vanished are removed while changed or new ones are left to the build
+ *
+ * returns true if nothing here or below needs building
+ */
+static bool snapshot_validate_dir(struct dcsnap *snapp, int depth)
+{
+    struct fat_direntry *const fatentp = get_dir_fatent();
+    struct filestr_base *const streamp = &snapp->stream;
+    struct file_base_info *const infop = &snapp->info;
+    struct dircache_runinfo_volume *const dcrivolp = DCRIVOL(infop);
+
+    int idx = infop->dcfile.idx;
+    int *downp = get_downidxp(idx);
+    if (!downp)
+        return false;
+
+    bool valid = true;
+
+    filestr_base_init(streamp);
+    fileobj_fileop_open(streamp, infop, FO_DIRECTORY);
+    fat_rewind(&streamp->fatstr);
+    uncached_rewinddir_internal(infop);
+
+    const long dircluster = streamp->infop->fatfile.firstcluster;
+
+    /* first pass: both lists are in directory order so walk them together */
+    int *prevp = downp;
+    int rc;
+
+    while ((rc = uncached_readdir_internal(streamp, infop, fatentp)) > 0)
+    {
+        unsigned int direntry = infop->fatfile.e.entry;
+        struct dircache_entry *ce;
+
+        /* anything ahead of this one is gone */
+        while ((ce = get_entry(*prevp)) && ce->direntry < direntry)
+            snapshot_drop_entry(dcrivolp, ce, prevp);
+
+        if (ce && ce->direntry == direntry &&
+            snapshot_update_entry(dcrivolp, ce, infop, fatentp) >= 0)
+        {
+            prevp = &ce->next;
+            continue;
+        }
+
+        if (ce && ce->direntry == direntry)
+            snapshot_drop_entry(dcrivolp, ce, prevp);
+
+        valid = false; /* new here; the build will insert it */
+    }
+
+    close_stream_internal(streamp);
+
+    if (rc < 0)
+    {
+        /* can't tell what's there; have it all read again */
+        free_subentries(dcrivolp, downp);
+        establish_frontier(idx, FRONTIER_NEW);
+        return false;
+    }
+
+    /* anything after the last one read is gone */
+    for (struct dircache_entry *ce; (ce = get_entry(*prevp));)
+        snapshot_drop_entry(dcrivolp, ce, prevp);
+
+    /* second pass: check every subdirectory */
+    for (int next = *downp; next && depth < DIRCACHE_MAX_DEPTH;)
+    {
+        struct dircache_entry *ce = get_entry(next);
+        next = ce->next;
+
+        if (!(ce->attr & ATTR_DIRECTORY))
+            continue;
+
+        char name[MAX_COMPNAME+1];
+        entry_name_copy(name, ce);
+        if (is_dotdir_name(name))
+            continue;
+
+        /* IF_MV: "volume" was set when validation began */
+        infop->fatfile.firstcluster = ce->firstcluster;
+        infop->fatfile.dircluster   = dircluster;
+        infop->fatfile.e.entry      = ce->direntry;
+        infop->fatfile.e.entries    = ce->direntries;
+        infop->dcfile.idx           = get_index(ce);
+        infop->dcfile.serialnum     = ce->serialnum;
+
+        /* it's settled unless found otherwise */
+        establish_frontier(infop->dcfile.idx, FRONTIER_SETTLED);
+
+        if (!snapshot_validate_dir(snapp, depth + 1))
+            valid = false;
+    }
+
+    /* the build must come through here to reach anything changed below */
+    if (!valid)
+        establish_frontier(idx, FRONTIER_NEW);
+
+    return valid;
+}
+
+/**
+ * check the loaded tree of each volume; volumes found changed are set to be
+ * built again, keeping what is still valid
+ *
+ * returns true if a build is needed
+ */
+static bool snapshot_validate_volumes(void)
+{
+    bool needbuild = false;
+
+    for (int i = 0; i < NUM_VOLUMES; i++)
+    {
+        struct dircache_volume *dcvolp = DCVOL(i);
+
+        if (dcvolp->status != DIRCACHE_READY)
+        {
+            /* nothing was there when saved */
+            dcvolp->status   = DIRCACHE_IDLE;
+            dcvolp->frontier = FRONTIER_NEW;
+            needbuild = true;
+            continue;
+        }
+
+        struct dcsnap snap;
+        int rc = fat_open_rootdir(IF_MV(i,) &snap.info.fatfile);
+        if (rc < 0)
+        {
+            /* not mounted now; whatever was cached is of no use */
+            logf("dircache: no root %d: %d", i, rc);
+            free_subentries(DCRIVOL(i), &dcvolp->root_down);
+            dcvolp->status   = DIRCACHE_IDLE;
+            dcvolp->frontier = FRONTIER_NEW;
+            needbuild = true;
+            continue;
+        }
+
+        long start_tick = current_tick;
+
+        snap.info.dcfile.idx       = -i - 1;
+        snap.info.dcfile.serialnum = dcvolp->serialnum;
+
+        if (!snapshot_validate_dir(&snap, 0))
+        {
+            logf("dircache: volume %d changed", i);
+            dcvolp->status = DIRCACHE_IDLE;
+            needbuild = true;
+        }
+        else
+        {
+            dcvolp->build_ticks = current_tick - start_tick;
+        }
+    }
+
+    return needbuild;
+}
+
 /**
  * function to load the internal cache structure from disk to initialize
- * the dircache really fast with little disk access.
+ * the dircache really fast with little disk access; only what changed since
+ * it was saved is built again, in the background
  */
 int dircache_load(void)
 {
@@ -3047,7 +3692,7 @@ int dircache_load(void)
     }
 
     /* sanity check the header */
-    if (maindata.magic != DIRCACHE_MAGIC)
+    if (maindata.magic != DIRCACHE_MAGIC || maindata.entrysize != ENTRYSIZE)
     {
         logf("dircache: invalid header magic");
         goto error_nolock;
@@ -3139,9 +3784,19 @@ int dircache_load(void)
 
     dircache.reserve_used = 0;
 
-    /* enable the cache but do not try to build it */
+    /* the file must be closed before anything is checked */
+    close(fd);
+    fd = -1;
+
+    bool needbuild = snapshot_validate_volumes();
+
+    /* enable the cache but do not try to build it... */
     dircache_enable_internal(false);
 
+    /* ...except for what changed, which can be done in the background */
+    if (needbuild)
+        dircache_thread_post(NULL);
+
     /* cache successfully loaded */
     core_unpin(handle);
     logf("Done, %ld KiB used", dircache.size / 1024);
@@ -3189,8 +3844,9 @@ int dircache_save(void)
     uint32_t crc;
     struct dircache_maindata maindata =
     {
-        .magic    = DIRCACHE_MAGIC,
-        .dircache = dircache,
+        .magic     = DIRCACHE_MAGIC,
+        .entrysize = ENTRYSIZE,
+        .dircache  = dircache,
     };
 
     /* store the size since it better detects an invalid header */
@@ -3255,7 +3911,7 @@ error:
     close(fd);
     return rc;
 }
-#endif /* HAVE_EEPROM_SETTINGS */
+#endif /* DIRCACHE_SNAPSHOT */
 
 /**
  * main one-time initialization function that must be called before any other
@@ -424,6 +424,10 @@ int disk_unmount(int drive)
         {
             mark_free_volume(vi); /* FIXME: should do this after unmount? */
             volume_onunmount_internal(IF_MV(i));
+        #ifdef HAVE_HOTSWAP
+            if (storage_present(drive))
+        #endif
+                fat_flush(IF_MV(i)); /* write the real FSInfo */
             fat_unmount(IF_MV(i));
             unmounted++;
         }
@@ -453,6 +457,29 @@ int disk_unmount_all(void)
     return unmounted;
 }
 
+/* write back what is cached for the volumes on drives that are present */
+void disk_flush_all(void)
+{
+    disk_writer_lock();
+
+    for (int i = 0; i < NUM_VOLUMES; i++)
+    {
+        struct volumeinfo *vi = &volumes[i];
+
+        if (is_free_volume(vi))
+            continue;
+
+    #ifdef HAVE_HOTSWAP
+        if (!storage_present(vi->drive))
+            continue;
+    #endif
+
+        fat_flush(IF_MV(i));
+    }
+
+    disk_writer_unlock();
+}
+
 bool disk_present(IF_MD_NONVOID(int drive))
 {
     int rc = -1;
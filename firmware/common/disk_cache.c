@@ -21,6 +21,7 @@
 #include "config.h"
 #include "debug.h"
 #include "system.h"
+#include <string.h>
 #include "linked_list.h"
 #include "disk_cache.h"
 #include "fs_defines.h"
@@ -28,16 +29,15 @@
 
 /* Cache: LRU cache with separately-chained hashtable
  *
- * Each entry of the map is the mapped location of the hashed sector value
- * where each bit in each map entry indicates which corresponding cache
- * entries are occupied by sector values that collide in that map entry.
+ * Each volume has a map of DC_MAP_NUM_ENTRIES chain heads. A sector hashes
+ * to one map entry, and the cache entries holding sectors that hash there
+ * are linked into its chain by index.
  *
- * Each volume is given its own bit map.
- *
- * To probe for a specific key, each bit in the map entry must be examined,
- * its position used as an index into the cache_entry array and the actual
- * sector information compared for that cache entry. If the search exhausts
- * all bits, the sector is not cached.
+ * To probe for a specific key, the chain is walked and the actual sector
+ * information compared for each cache entry on it. If the search reaches the
+ * end of the chain, the sector is not cached. The cost depends only on the
+ * chain length and not on the total number of entries, so the cache can be
+ * made large on targets with the memory to spare.
  *
  * To avoid long chains, the map entry count should be much greater than the
  * number of cache entries. Since the cache is an LRU design, no buffer entry
@@ -45,25 +45,28 @@
  * or volume.
  *
  * Example 6-sector cache with 8-entry map:
- * cache entry 543210
- * cache map   100000 <- sector number hashes into map
- *             000000
- *             000100
- *             000000
- *             010000
- *             000000
- *             001001 <- collision
- *             000000
- * volume map  111101 <- entry usage by the volume (OR of all map entries)
+ * cache map   0: 5 -> 0 <- collision
+ *             1: -
+ *             2: 2
+ *             3: -
+ *             4: 4
+ *             5: -
+ *             6: 3
+ *             7: 1
+ * volume map  111111 <- entry usage by the volume
  */
 
 enum dce_flags /* flags for each cache entry */
 {
-    DCE_INUSE = 0x01, /* entry in use and valid */
-    DCE_DIRTY = 0x02, /* entry is dirty in need of writeback */
-    DCE_BUF   = 0x04, /* entry is being used as a general buffer */
+    DCE_INUSE    = 0x01, /* entry in use and valid */
+    DCE_DIRTY    = 0x02, /* entry is dirty in need of writeback */
+    DCE_BUF      = 0x04, /* entry is being used as a general buffer */
+    DCE_PREFETCH = 0x08, /* entry was read ahead and not yet used */
 };
 
+/* ends a map chain */
+#define DC_MAP_END 0xffff
+
 struct disk_cache_entry
 {
     struct lldc_node node;  /* LRU list links */
@@ -71,6 +74,7 @@ struct disk_cache_entry
 #ifdef HAVE_MULTIVOLUME
     unsigned char volume;   /* volume of sector */
 #endif
+    uint16_t mapnext;       /* next entry in the same map chain */
     unsigned long sector;   /* cached disk sector number */
 };
 
@@ -84,13 +88,14 @@ static inline unsigned int map_sector(unsigned long sector)
 
 static struct lldc_head cache_lru; /* LRU cache list (head = LRU item) */
 static struct disk_cache_entry cache_entry[DC_NUM_ENTRIES];
-static cache_map_entry_t cache_map_entry[NUM_VOLUMES][DC_MAP_NUM_ENTRIES];
+static uint16_t cache_map_head[NUM_VOLUMES][DC_MAP_NUM_ENTRIES];
 static cache_map_entry_t cache_vol_map[NUM_VOLUMES] IBSS_ATTR;
 static uint8_t cache_buffer[DC_NUM_ENTRIES][DC_CACHE_BUFSIZE] CACHEALIGN_ATTR;
+static struct dc_stats cache_stats;
 struct mutex disk_cache_mutex SHAREDBSS_ATTR;
 
-#define CACHE_MAP_ENTRY(volume, mapnum) \
-    cache_map_entry[IF_MV_VOL(volume)][mapnum]
+#define CACHE_MAP_HEAD(volume, mapnum) \
+    cache_map_head[IF_MV_VOL(volume)][mapnum]
 #define CACHE_VOL_MAP(volume) \
     cache_vol_map[IF_MV_VOL(volume)]
 
@@ -105,24 +110,45 @@ struct mutex disk_cache_mutex SHAREDBSS_ATTR;
 #define DCIDX_FROM_DCE(dce) \
     ((dce) - cache_entry)
 
-/* set the in-use bit in the map */
-static inline void cache_bitmap_set_bit(int volume, unsigned int mapnum,
-                                        unsigned int bitnum)
+/* link the entry into its map chain */
+static inline void cache_map_insert(int volume, unsigned int mapnum,
+                                    unsigned int index)
 {
-    cache_map_set_bit(&CACHE_MAP_ENTRY(volume, mapnum), bitnum);
-    cache_map_set_bit(&CACHE_VOL_MAP(volume), bitnum);
+    cache_entry[index].mapnext = CACHE_MAP_HEAD(volume, mapnum);
+    CACHE_MAP_HEAD(volume, mapnum) = index;
+    cache_map_set_bit(&CACHE_VOL_MAP(volume), index);
     (void)volume;
 }
 
-/* clear the in-use bit in the map */
-static inline void cache_bitmap_clear_bit(int volume, unsigned int mapnum,
-                                          unsigned int bitnum)
+/* unlink the entry from its map chain */
+static inline void cache_map_remove(int volume, unsigned int mapnum,
+                                    unsigned int index)
 {
-    cache_map_clear_bit(&CACHE_MAP_ENTRY(volume, mapnum), bitnum);
-    cache_map_clear_bit(&CACHE_VOL_MAP(volume), bitnum);
+    uint16_t *linkp = &CACHE_MAP_HEAD(volume, mapnum);
+
+    while (*linkp != index)
+        linkp = &cache_entry[*linkp].mapnext;
+
+    *linkp = cache_entry[index].mapnext;
+    cache_map_clear_bit(&CACHE_VOL_MAP(volume), index);
     (void)volume;
 }
 
+/* find the entry caching the sector, if any */
+static inline struct disk_cache_entry *
+    cache_map_find(IF_MV(int volume,) unsigned int mapnum, unsigned long sector)
+{
+    for (unsigned int index = CACHE_MAP_HEAD(volume, mapnum);
+         index != DC_MAP_END; index = cache_entry[index].mapnext)
+    {
+        struct disk_cache_entry *dce = &cache_entry[index];
+        if (dce->sector == sector)
+            return dce;
+    }
+
+    return NULL;
+}
+
 /* make entry MRU by moving it to the list tail */
 static inline void touch_cache_entry(struct disk_cache_entry *which)
 {
@@ -164,65 +190,115 @@ static void cache_return_lru_entry(struct disk_cache_entry *fce)
 static inline void cache_discard_entry(struct disk_cache_entry *dce,
                                        unsigned int index)
 {
-    cache_bitmap_clear_bit(IF_MV_VOL(dce->volume), map_sector(dce->sector),
-                           index);
+    cache_map_remove(IF_MV_VOL(dce->volume), map_sector(dce->sector), index);
     dce->flags = 0;
 }
 
-/* search the cache for the specified sector, returning a buffer, either
-   to the specified sector, if it exists, or a new/evicted entry that must
-   be filled */
-void * dc_cache_probe(IF_MV(int volume,) unsigned long sector,
-                      unsigned int *flagsp)
+/* evict the LRU entry, make it the MRU and assign it to the sector; the
+   buffer contents are left for the caller to fill */
+static struct disk_cache_entry *
+    cache_evict_lru(IF_MV(int volume,) unsigned int mapnum,
+                    unsigned long sector)
 {
-    unsigned int mapnum = map_sector(sector);
-
-    FOR_EACH_BITARRAY_SET_BIT(&CACHE_MAP_ENTRY(volume, mapnum), index)
-    {
-        struct disk_cache_entry *dce = &cache_entry[index];
-
-        if (dce->sector == sector)
-        {
-            *flagsp = DCE_INUSE;
-            touch_cache_entry(dce);
-            return cache_buffer[index];
-        }
-    }
-
-    /* sector not found so the LRU is the victim */
     struct disk_cache_entry *dce = DCE_LRU();
     cache_lru.head = dce->node.next;
 
     unsigned int index = DCIDX_FROM_DCE(dce);
-    void *buf = cache_buffer[index];
-    unsigned int old_flags = dce->flags;
 
-    if (old_flags)
+    if (dce->flags)
     {
         int old_volume = IF_MV_VOL(dce->volume);
-        unsigned long sector = dce->sector;
-        unsigned int old_mapnum = map_sector(sector);
-
-        if (old_flags & DCE_DIRTY)
-            dc_writeback_callback(IF_MV(old_volume,) sector, buf);
+        unsigned long old_sector = dce->sector;
 
-        if (mapnum == old_mapnum IF_MV( && volume == old_volume ))
-            goto finish_setup;
+        if (dce->flags & DCE_DIRTY)
+        {
+            void *buf = cache_buffer[index];
+            dc_writeback_callback(IF_MV(old_volume,) old_sector, 1, &buf);
+        }
 
-        cache_bitmap_clear_bit(old_volume, old_mapnum, index);
+        cache_map_remove(old_volume, map_sector(old_sector), index);
     }
 
-    cache_bitmap_set_bit(IF_MV_VOL(volume), mapnum, index);
+    cache_map_insert(IF_MV_VOL(volume), mapnum, index);
 
-finish_setup:
     dce->flags  = DCE_INUSE;
 #ifdef HAVE_MULTIVOLUME
     dce->volume = volume;
 #endif
     dce->sector = sector;
 
+    return dce;
+}
+
+/* search the cache for the specified sector, returning a buffer, either
+   to the specified sector, if it exists, or a new/evicted entry that must
+   be filled */
+void * dc_cache_probe(IF_MV(int volume,) unsigned long sector,
+                      unsigned int *flagsp)
+{
+    unsigned int mapnum = map_sector(sector);
+    struct disk_cache_entry *dce = cache_map_find(IF_MV(volume,) mapnum,
+                                                  sector);
+    if (dce)
+    {
+        if (dce->flags & DCE_PREFETCH)
+        {
+            dce->flags &= ~DCE_PREFETCH;
+            cache_stats.prefetch_hits++;
+        }
+
+        cache_stats.hits++;
+        *flagsp = DCE_INUSE;
+        touch_cache_entry(dce);
+        return cache_buffer[DCIDX_FROM_DCE(dce)];
+    }
+
+    /* sector not found so the LRU is the victim */
+    cache_stats.misses++;
+    dce = cache_evict_lru(IF_MV(volume,) mapnum, sector);
+
     *flagsp = 0;
-    return buf;
+    return cache_buffer[DCIDX_FROM_DCE(dce)];
+}
+
+/* add consecutive sectors the client read ahead; any of them cached already
+   keep their cached copy, which may be newer than what was read */
+void dc_cache_fill(IF_MV(int volume,) unsigned long sector, unsigned int count,
+                   const void *buf)
+{
+    const uint8_t *src = buf;
+    uint32_t cached = 0;
+
+    if (count > 32)
+        count = 32;
+
+    /* check them all first; evicting an entry below writes it back and then
+       the data read for it would look like the newer copy */
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (cache_map_find(IF_MV(volume,) map_sector(sector + i), sector + i))
+            cached |= 1ul << i;
+    }
+
+    for (unsigned int i = 0; i < count; i++, src += DC_CACHE_BUFSIZE)
+    {
+        if (cached & (1ul << i))
+            continue;
+
+        struct disk_cache_entry *dce =
+            cache_evict_lru(IF_MV(volume,) map_sector(sector + i), sector + i);
+        memcpy(cache_buffer[DCIDX_FROM_DCE(dce)], src, DC_CACHE_BUFSIZE);
+        dce->flags |= DCE_PREFETCH;
+        cache_stats.prefetched++;
+    }
+}
+
+/* copy out the hit/miss counters */
+void dc_get_stats(struct dc_stats *stats)
+{
+    dc_lock_cache();
+    *stats = cache_stats;
+    dc_unlock_cache();
 }
 
 /* mark in-use cache entry as dirty by buffer */
@@ -252,22 +328,47 @@ void dc_discard_buf(void *buf)
         cache_discard_entry(dce, index);
 }
 
-/* commit all dirty cache entries to storage for a specified volume */
+/* commit all dirty cache entries to storage for a specified volume; the
+   entries are written in sector order and runs of consecutive sectors are
+   handed to the client together so it can write them in one transfer */
 void dc_commit_all(IF_MV_NONVOID(int volume))
 {
     DEBUGF("dc_commit_all()\n");
 
+    /* only touched with the cache locked */
+    static uint16_t dirty[DC_NUM_ENTRIES];
+    static void *runbufs[DC_NUM_ENTRIES];
+    unsigned int count = 0;
+
     FOR_EACH_BITARRAY_SET_BIT(&CACHE_VOL_MAP(volume), index)
     {
-        struct disk_cache_entry *dce = &cache_entry[index];
-        unsigned int flags = dce->flags;
+        if (!(cache_entry[index].flags & DCE_DIRTY))
+            continue;
+
+        /* insertion sort by sector; there are few dirty entries */
+        unsigned long sector = cache_entry[index].sector;
+        unsigned int i = count++;
 
-        if (flags & DCE_DIRTY)
+        for (; i > 0 && cache_entry[dirty[i-1]].sector > sector; i--)
+            dirty[i] = dirty[i-1];
+
+        dirty[i] = index;
+    }
+
+    for (unsigned int i = 0; i < count;)
+    {
+        unsigned long sector = cache_entry[dirty[i]].sector;
+        unsigned int n = 0;
+
+        do
         {
-            dc_writeback_callback(IF_MV(volume,) dce->sector,
-                                  cache_buffer[index]);
-            dce->flags = flags & ~DCE_DIRTY;
+            struct disk_cache_entry *dce = &cache_entry[dirty[i]];
+            runbufs[n++] = cache_buffer[dirty[i]];
+            dce->flags &= ~DCE_DIRTY;
         }
+        while (++i < count && cache_entry[dirty[i]].sector == sector + n);
+
+        dc_writeback_callback(IF_MV(volume,) sector, n, runbufs);
     }
 }
 
@@ -299,7 +400,8 @@ void * dc_get_buffer(void)
         {
             /* must first commit this sector if dirty */
             if (flags & DCE_DIRTY)
-                dc_writeback_callback(IF_MV(dce->volume,) dce->sector, buf);
+                dc_writeback_callback(IF_MV(dce->volume,) dce->sector, 1,
+                                      &buf);
 
             cache_discard_entry(dce, index);
         }
@@ -337,6 +439,7 @@ void dc_release_buffer(void *buf)
 void dc_init(void)
 {
     mutex_init(&disk_cache_mutex);
+    memset(cache_map_head, 0xff, sizeof (cache_map_head)); /* DC_MAP_END */
     lldc_init(&cache_lru);
     for (unsigned int i = 0; i < DC_NUM_ENTRIES; i++)
         lldc_insert_last(&cache_lru, &cache_entry[i].node);
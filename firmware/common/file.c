@@ -28,6 +28,7 @@
 #include "file.h"
 #include "fileobj_mgr.h"
 #include "disk_cache.h"
+#include "storage.h"
 #include "rb_namespace.h"
 #include "string-extra.h"
 
@@ -50,6 +51,7 @@ static struct filestr_desc
     struct filestr_base stream; /* basic stream info (first!) */
     file_size_t         offset; /* current offset for stream */
     file_size_t         *sizep; /* shortcut to file size in fileobj */
+    struct fat_extents  extents; /* cluster runs remembered for seeking */
 } open_streams[MAX_OPEN_FILES];
 
 /* check and return a struct filestr_desc* from a file descriptor number */
@@ -422,6 +424,7 @@ static int open_internal_inner2(const char *path,
     }
 
     fat_rewind(&file->stream.fatstr);
+    fat_filestr_set_extents(&file->stream.fatstr, &file->extents);
     file->sizep = fileobj_get_sizep(&file->stream);
     file->offset = 0;
 
@@ -547,7 +550,7 @@ static int readwrite_fill_cache(struct filestr_desc *file, unsigned long sector,
            was previously needed for a different sector */
         rc = fat_readwrite(&file->stream.fatstr, 1, cachep->buffer, false);
         if (rc < 0)
-            FILE_ERROR(rc == FAT_RC_ENOSPC ? ENOSPC : EIO, rc * 10 - 3);
+            FILE_ERROR(FAT_RC_ERRNO(rc), rc * 10 - 3);
     }
     else
     {
@@ -723,8 +726,7 @@ static ssize_t readwrite(struct filestr_desc *file, void *buf, size_t nbyte,
             {
                 DEBUGF("I/O error %sing %ld sectors\n",
                        write ? "writ" : "read", runlen);
-                FILE_ERROR(rc == FAT_RC_ENOSPC ? ENOSPC : EIO,
-                           rc * 10 - 6);
+                FILE_ERROR(FAT_RC_ERRNO(rc), rc * 10 - 6);
             }
             else
             {
@@ -905,6 +907,12 @@ int fsync(int fildes)
     if (rc < 0)
         FILE_ERROR(ERRNO, rc * 10 - 3);
 
+#ifdef HAVE_STORAGE_FLUSH
+    /* commit what a flash translation layer holds back, so that everything
+       written so far has reached the medium */
+    storage_flush();
+#endif
+
 file_error:
     RELEASE_FILESTR(WRITER, file);
     return rc;
@@ -955,6 +963,54 @@ file_error:
     return rc;
 }
 
+/* read from a file into several buffers; the stream is held for the whole
+   vector so the data is contiguous in the file even with other readers */
+ssize_t readv(int fildes, const struct iovec *iov, int iovcnt)
+{
+    struct filestr_desc * const file = GET_FILESTR(READER, fildes);
+    if (!file)
+        FILE_ERROR_RETURN(ERRNO, -1);
+
+    ssize_t rc;
+
+    if (file->stream.flags & FD_WRONLY)
+    {
+        DEBUGF("readv(fd=%d,iov=%p,cnt=%d) - "
+               "descriptor is write-only mode\n",
+               fildes, iov, iovcnt);
+        FILE_ERROR(EBADF, -2);
+    }
+
+    if (iovcnt < 0 || iovcnt > IOV_MAX)
+        FILE_ERROR(EINVAL, -3);
+
+    ssize_t total = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        rc = readwrite(file, iov[i].iov_base, iov[i].iov_len, false);
+        if (rc < 0)
+        {
+            /* report what made it in if anything did */
+            if (total > 0)
+                break;
+
+            FILE_ERROR(ERRNO, rc * 10 - 4);
+        }
+
+        total += rc;
+
+        if ((size_t)rc < iov[i].iov_len)
+            break; /* EOF */
+    }
+
+    rc = total;
+
+file_error:
+    RELEASE_FILESTR(READER, file);
+    return rc;
+}
+
 /* write on a file */
 ssize_t write(int fildes, const void *buf, size_t nbyte)
 {
@@ -1100,7 +1156,7 @@ int rename(const char *old, const char *new)
     if (rc < 0)
     {
         DEBUGF("I/O error renaming file: %d\n", rc);
-        FILE_ERROR(rc == FAT_RC_ENOSPC ? ENOSPC : EIO, rc * 10 - 7);
+        FILE_ERROR(FAT_RC_ERRNO(rc), rc * 10 - 7);
     }
 
     if (is_overwrite)
@@ -271,7 +271,8 @@ int uncached_readdir_dirent(struct filestr_base *stream,
     /* FAT driver clears the struct fat_dirent if nothing is returned */
     strcpy(entry->d_name, fatent.name);
     entry->info.attr    = fatent.attr;
-    entry->info.size    = fatent.filesize;
+    /* exFAT directories have a length but FAT ones don't */
+    entry->info.size    = (fatent.attr & ATTR_DIRECTORY) ? 0 : fatent.filesize;
     entry->info.wrtdate = fatent.wrtdate;
     entry->info.wrttime = fatent.wrttime;
 
@@ -454,13 +455,18 @@ static NO_INLINE int open_path_component(struct pathwalk *walkp,
     fat_filestr_init(&stream->fatstr, &parentp->info.fatfile);
     rewinddir_internal(&compp->info);
 
-    while ((rc = readdir_internal(stream, &compp->info, &dir_fatent)) > 0)
+    /* large cached directories may be looked up directly */
+    rc = findname_internal(stream, &compp->info, &dir_fatent, compname);
+    if (rc < 0)
     {
-        if (rc > 1 && !(callflags & FF_NOISO))
-            iso_decode_d_name(dir_fatent.name);
+        while ((rc = readdir_internal(stream, &compp->info, &dir_fatent)) > 0)
+        {
+            if (rc > 1 && !(callflags & FF_NOISO))
+                iso_decode_d_name(dir_fatent.name);
 
-        if (!strcasecmp(compname, dir_fatent.name))
-            break;
+            if (!strcasecmp(compname, dir_fatent.name))
+                break;
+        }
     }
 
     if (rc == 0)
@@ -474,7 +480,7 @@ static NO_INLINE int open_path_component(struct pathwalk *walkp,
         return -EIO;
     }
 
-    rc = fat_open(stream->fatstr.fatfilep, dir_fatent.firstcluster,
+    rc = fat_open(stream->fatstr.fatfilep, &dir_fatent,
                   &compp->info.fatfile);
     if (rc < 0)
     {
@@ -679,7 +685,7 @@ int create_stream_internal(struct file_base_info *parentinfop,
     if (rc < 0)
     {
         DEBUGF("Create failed: %d\n", rc);
-        FILE_ERROR(rc == FAT_RC_ENOSPC ? ENOSPC : EIO, rc * 10 - 1);
+        FILE_ERROR(FAT_RC_ERRNO(rc), rc * 10 - 1);
     }
 
     /* dir_fatent is implicit arg */
@@ -726,7 +732,7 @@ int remove_stream_internal(const char *path, struct filestr_base *stream,
     if (rc < 0)
     {
         DEBUGF("I/O error removing dir entries: %d\n", rc);
-        FILE_ERROR(EIO, rc * 10 - 3);
+        FILE_ERROR(FAT_RC_ERRNO(rc), rc * 10 - 3);
     }
 
     fileop_onremove_internal(stream, &oldinfo);
@@ -44,7 +44,8 @@ void core_allocator_init(void)
 {
     unsigned char *start = ALIGN_UP(audiobuffer, sizeof(intptr_t));
 
-#if defined(IPOD_VIDEO) && !defined(BOOTLOADER) && !defined(SIMULATOR)
+#if defined(IPOD_VIDEO) && !defined(BOOTLOADER) && \
+    (CONFIG_PLATFORM & PLATFORM_NATIVE) && !defined(__PCTOOL__)
     audiobufend=(unsigned char *)audiobufend_lds;
     if(MEMORYSIZE==64 && probed_ramsize!=64)
     {
@@ -101,6 +101,68 @@
 
 #define BPB_LAST_WORD       510
 
+#ifdef HAVE_EXFATSUPPORT
+/* exFAT boot sector; the BPB fields above are all zero */
+#define EXFAT_OEMNAME           "EXFAT   "
+#define EXFAT_VOLUMELENGTH      72
+#define EXFAT_FATOFFSET         80
+#define EXFAT_FATLENGTH         84
+#define EXFAT_CLUSTERHEAPOFFSET 88
+#define EXFAT_CLUSTERCOUNT      92
+#define EXFAT_ROOTCLUSTER       96
+#define EXFAT_BYTSPERSECSHIFT   108
+#define EXFAT_SECPERCLUSSHIFT   109
+#define EXFAT_NUMFATS           110
+
+/* exFAT directory entry types */
+#define EXFAT_ENTRY_EOD         0x00 /* end of directory */
+#define EXFAT_ENTRY_INUSE       0x80 /* type bit cleared on deleted entries */
+#define EXFAT_ENTRY_SECONDARY   0x40 /* type bit set on secondary entries */
+#define EXFAT_ENTRY_BITMAP      0x81
+#define EXFAT_ENTRY_FILE        0x85
+#define EXFAT_ENTRY_STREAM      0xc0
+#define EXFAT_ENTRY_NAME        0xc1
+
+/* exFAT file entry offsets */
+#define EXFAT_FILE_SECONDARYCOUNT   1
+#define EXFAT_FILE_SETCHECKSUM      2
+#define EXFAT_FILE_ATTRIBUTES       4
+#define EXFAT_FILE_CRTTIME          8
+#define EXFAT_FILE_WRTTIME          12
+#define EXFAT_FILE_ACCTIME          16
+#define EXFAT_FILE_CRT10MS          20
+
+/* exFAT stream extension, and allocation bitmap, entry offsets */
+#define EXFAT_STREAM_FLAGS          1
+#define EXFAT_STREAM_NAMELENGTH     3
+#define EXFAT_STREAM_FIRSTCLUSTER   20
+#define EXFAT_STREAM_DATALENGTH     24
+
+#define EXFAT_STREAM_F_ALLOC        0x01 /* clusters are allocated */
+#define EXFAT_STREAM_F_NOFATCHAIN   0x02 /* clusters are contiguous */
+
+#define EXFAT_NAME_CHARS            15   /* UTF-16 units per name entry */
+#define EXFAT_NAME_OFFSET           2
+
+/* a stream extension and the name entries of a 255 character name; sets with
+   more secondary entries than that are skipped */
+#define EXFAT_MAX_SECONDARY         18
+
+/* exFAT files whose clusters are contiguous have no FAT chain; this flag in
+   the first cluster number handed out for them lets them be walked without
+   any FAT lookups, up to the length from their stream entry. */
+#define EXFAT_CONTIG_FLAG           0x40000000
+#define IS_CONTIG_CLUSTER(c) \
+    ((c) > 0 && ((c) & EXFAT_CONTIG_FLAG))
+#define CLUSTER_NUM(c) \
+    (IS_CONTIG_CLUSTER(c) ? (c) & ~EXFAT_CONTIG_FLAG : (c))
+#define IS_EXFAT(bpb)               ((bpb)->is_exfat)
+#else /* !HAVE_EXFATSUPPORT */
+#define IS_CONTIG_CLUSTER(c)        ((void)(c), false)
+#define CLUSTER_NUM(c)              (c)
+#define IS_EXFAT(bpb)               false
+#endif /* HAVE_EXFATSUPPORT */
+
 /* Short and long name directory entry template */
 union raw_dirent
 {
@@ -171,6 +233,10 @@ union raw_dirent
 #define FAT16_BAD_MARK              0xfff7
 #define FAT16_EOF_MARK              0xfff8
 
+/* FAT sectors read past the first free cluster while looking for a run long
+   enough for the write */
+#define FREE_RUN_SCAN_SECTORS       128
+
 struct fsinfo
 {
     unsigned long freecount; /* last known free cluster count */
@@ -184,28 +250,30 @@ struct fsinfo
 
 #define FSINFO_SIGNATURE_VAL 0x41615252
 
-#ifdef HAVE_FAT16SUPPORT
+#if defined(HAVE_FAT16SUPPORT) || defined(HAVE_EXFATSUPPORT)
+#define HAVE_FAT_FN_TABLE
 #define BPB_FN_SET16(bpb, fn)      (bpb)->fn##__ = fn##16
 #define BPB_FN_SET32(bpb, fn)      (bpb)->fn##__ = fn##32
+#define BPB_FN_SETEX(bpb, fn)      (bpb)->fn##__ = fn##_exfat
 #define BPB_FN_DECL(fn, args...)   (*fn##__)(struct bpb *bpb , ##args)
 #define BPB_CALL(fn, bpb, args...) ((bpb)->fn##__(bpb , ##args))
 
 #define get_next_cluster(bpb, cluster) \
     BPB_CALL(get_next_cluster, (bpb), (cluster))
-#define find_free_cluster(bpb, startcluster) \
-    BPB_CALL(find_free_cluster, (bpb), (startcluster))
+#define find_free_cluster(bpb, startcluster, count, append) \
+    BPB_CALL(find_free_cluster, (bpb), (startcluster), (count), (append))
 #define update_fat_entry(bpb, entry, value) \
     BPB_CALL(update_fat_entry, (bpb), (entry), (value))
 #define fat_recalc_free_internal(bpb) \
     BPB_CALL(fat_recalc_free_internal, (bpb))
-#else  /* !HAVE_FAT16SUPPORT */
+#else  /* !HAVE_FAT_FN_TABLE */
 #define get_next_cluster            get_next_cluster32
 #define find_free_cluster           find_free_cluster32
 #define update_fat_entry            update_fat_entry32
 #define fat_recalc_free_internal    fat_recalc_free_internal32
-#endif /* HAVE_FAT16SUPPORT */
+#endif /* HAVE_FAT_FN_TABLE */
 struct bpb;
-static void update_fsinfo32(struct bpb *fat_bpb);
+static void update_fsinfo32(struct bpb *fat_bpb, bool flush);
 
 /* Note: This struct doesn't hold the raw values after mounting if
  * bpb_bytspersec isn't 512. All sector counts are normalized to 512 byte
@@ -237,7 +305,10 @@ static struct bpb
     unsigned long dataclusters;
     unsigned long fatrgnstart;
     unsigned long fatrgnend;
+    unsigned long maxtransfer;      /* most sectors per storage request */
+    unsigned long freemapshift;     /* log2 of FAT sectors per freemap bit */
     struct fsinfo fsinfo;
+    struct fsinfo fsinfo_disk;      /* values last written to FSInfo */
 #ifdef HAVE_FAT16SUPPORT
     unsigned int bpb_rootentcnt;    /* Number of dir entries in the root */
     /* internals for FAT16 support */
@@ -249,6 +320,9 @@ static struct bpb
 #ifdef HAVE_FAT16SUPPORT
     uint8_t is_fat16; /* true if we mounted a FAT16 partition, false if FAT32 */
 #endif
+#ifdef HAVE_EXFATSUPPORT
+    uint8_t is_exfat; /* true if we mounted an exFAT partition (read-only) */
+#endif
 #ifdef HAVE_MULTIDRIVE
     uint8_t drive;    /* on which physical device is this located */
 #endif
@@ -256,13 +330,13 @@ static struct bpb
     uint8_t volume;   /* on which volume is this located (shortcut) */
 #endif
     uint8_t mounted;  /* true if volume is mounted, false otherwise */
-#ifdef HAVE_FAT16SUPPORT
+#ifdef HAVE_FAT_FN_TABLE
     /* some functions are different for different FAT types */
     long BPB_FN_DECL(get_next_cluster, long);
-    long BPB_FN_DECL(find_free_cluster, long);
+    long BPB_FN_DECL(find_free_cluster, long, unsigned long, bool);
     int  BPB_FN_DECL(update_fat_entry, unsigned long, unsigned long);
     void BPB_FN_DECL(fat_recalc_free_internal);
-#endif /* HAVE_FAT16SUPPORT */
+#endif /* HAVE_FAT_FN_TABLE */
 
 } fat_bpbs[NUM_VOLUMES]; /* mounted partition info */
 
@@ -273,6 +347,12 @@ static uint8_t fat_bounce_buffers[NUM_VOLUMES][SECTOR_SIZE*FAT_BOUNCE_SECTORS] S
     (fat_bounce_buffers[IF_MV_VOL((bpb)->volume)])
 #endif
 
+/* one bit per group of FAT sectors, set once the group is known to contain no
+   free cluster so the allocator can skip it without reading it */
+static uint8_t fat_freemaps[NUM_VOLUMES][FAT_FREEMAP_SIZE];
+#define FAT_FREEMAP(bpb) \
+    (fat_freemaps[IF_MV_VOL((bpb)->volume)])
+
 #define IS_FAT_SECTOR(bpb, sector) \
     (!((sector) >= (bpb)->fatrgnend || (sector) < (bpb)->fatrgnstart))
 
@@ -310,13 +390,13 @@ struct fatlong_parse_state
     uint8_t chksum;
 };
 
-static void cache_commit(struct bpb *fat_bpb)
+static void cache_commit(struct bpb *fat_bpb, bool flush)
 {
     dc_lock_cache();
 #ifdef HAVE_FAT16SUPPORT
     if (!fat_bpb->is_fat16)
 #endif
-        update_fsinfo32(fat_bpb);
+        update_fsinfo32(fat_bpb, flush);
     dc_commit_all(IF_MV(fat_bpb->volume));
     dc_unlock_cache();
 }
@@ -328,6 +408,56 @@ static void cache_discard(IF_MV_NONVOID(struct bpb *fat_bpb))
     dc_unlock_cache();
 }
 
+#if DC_READAHEAD_SECTORS > 1
+/* staging for multi-sector cache reads and writes; used with the cache
+   locked */
+static uint8_t fat_readahead_buffer[DC_READAHEAD_SECTORS][SECTOR_SIZE]
+    STORAGE_ALIGN_ATTR;
+
+/* returns how many sectors from secnum on are worth reading in one go: FAT
+   sectors up to the end of the FAT and directory sectors up to the end of
+   their cluster */
+static unsigned long readahead_count(struct bpb *fat_bpb, unsigned long secnum)
+{
+    unsigned long end;
+
+    if (IS_FAT_SECTOR(fat_bpb, secnum))
+        end = fat_bpb->fatrgnend;
+    else if (secnum >= fat_bpb->firstdatasector)
+        end = secnum + fat_bpb->bpb_secperclus -
+              (secnum - fat_bpb->firstdatasector) % fat_bpb->bpb_secperclus;
+#ifdef HAVE_FAT16SUPPORT
+    else if (fat_bpb->is_fat16 && secnum >= fat_bpb->rootdirsector)
+        end = fat_bpb->firstdatasector;
+#endif
+    else
+        return 1;
+
+    return MIN(end - secnum, DC_READAHEAD_SECTORS);
+}
+
+/* reads secnum and the sectors after it, filling buf with the first and the
+   cache with the rest */
+static int cache_readahead(struct bpb *fat_bpb, unsigned long secnum,
+                           unsigned long count, void *buf)
+{
+    dc_lock_cache();
+
+    int rc = storage_read_sectors(IF_MD(fat_bpb->drive,)
+                                  secnum + fat_bpb->startsector, count,
+                                  fat_readahead_buffer);
+    if (rc >= 0)
+    {
+        memcpy(buf, fat_readahead_buffer[0], SECTOR_SIZE);
+        dc_cache_fill(IF_MV(fat_bpb->volume,) secnum + 1, count - 1,
+                      fat_readahead_buffer[1]);
+    }
+
+    dc_unlock_cache();
+    return rc;
+}
+#endif /* DC_READAHEAD_SECTORS > 1 */
+
 /* caches a FAT or data area sector */
 static void * cache_sector(struct bpb *fat_bpb, unsigned long secnum)
 {
@@ -336,8 +466,16 @@ static void * cache_sector(struct bpb *fat_bpb, unsigned long secnum)
 
     if (!flags)
     {
+#if DC_READAHEAD_SECTORS > 1
+        unsigned long count = readahead_count(fat_bpb, secnum);
+        int rc = count > 1 ?
+            cache_readahead(fat_bpb, secnum, count, buf) :
+            storage_read_sectors(IF_MD(fat_bpb->drive,)
+                                 secnum + fat_bpb->startsector, 1, buf);
+#else
         int rc = storage_read_sectors(IF_MD(fat_bpb->drive,)
                                       secnum + fat_bpb->startsector, 1, buf);
+#endif
         if (UNLIKELY(rc < 0))
         {
             DEBUGF("%s() - Could not read sector %ld"
@@ -360,10 +498,10 @@ static void * cache_sector_buffer(IF_MV(struct bpb *fat_bpb,)
     return dc_cache_probe(IF_MV(fat_bpb->volume,) secnum, &flags);
 }
 
-/* flush a cache buffer to storage */
-void dc_writeback_callback(IF_MV(int volume,) unsigned long sector, void *buf)
+/* write a run of sectors to every copy they have */
+static void writeback_sectors(struct bpb *fat_bpb, unsigned long sector,
+                              unsigned int count, void *buf)
 {
-    struct bpb * const fat_bpb = &fat_bpbs[IF_MV_VOL(volume)];
     unsigned int copies = !IS_FAT_SECTOR(fat_bpb, sector) ?
                                 1 : fat_bpb->bpb_numfats;
 
@@ -371,7 +509,8 @@ void dc_writeback_callback(IF_MV(int volume,) unsigned long sector, void *buf)
 
     while (1)
     {
-        int rc = storage_write_sectors(IF_MD(fat_bpb->drive,) sector, 1, buf);
+        int rc = storage_write_sectors(IF_MD(fat_bpb->drive,) sector, count,
+                                       buf);
         if (rc < 0)
         {
             panicf("%s() - Could not write sector %ld"
@@ -386,6 +525,44 @@ void dc_writeback_callback(IF_MV(int volume,) unsigned long sector, void *buf)
     }
 }
 
+/* flush a run of cache buffers to storage */
+void dc_writeback_callback(IF_MV(int volume,) unsigned long sector,
+                           unsigned int count, void * const *bufs)
+{
+    struct bpb * const fat_bpb = &fat_bpbs[IF_MV_VOL(volume)];
+
+#if DC_READAHEAD_SECTORS > 1
+    while (count > 1)
+    {
+        /* gather as much as fits into one transfer without crossing the
+           end of the FAT, which is written to each copy */
+        unsigned int n = MIN(count, DC_READAHEAD_SECTORS);
+        bool isfat = IS_FAT_SECTOR(fat_bpb, sector);
+
+        for (unsigned int i = 1; i < n; i++)
+        {
+            if (IS_FAT_SECTOR(fat_bpb, sector + i) != isfat)
+            {
+                n = i;
+                break;
+            }
+        }
+
+        for (unsigned int i = 0; i < n; i++)
+            memcpy(fat_readahead_buffer[i], bufs[i], SECTOR_SIZE);
+
+        writeback_sectors(fat_bpb, sector, n, fat_readahead_buffer);
+
+        sector += n;
+        count -= n;
+        bufs += n;
+    }
+#endif /* DC_READAHEAD_SECTORS > 1 */
+
+    for (; count > 0; count--)
+        writeback_sectors(fat_bpb, sector++, 1, *bufs++);
+}
+
 static void raw_dirent_set_fstclus(union raw_dirent *ent, long fstclus)
 {
     ent->fstclushi = htole16(fstclus >> 16);
@@ -810,6 +987,83 @@ static unsigned long cluster2sec(struct bpb *fat_bpb, long cluster)
             + fat_bpb->firstdatasector;
 }
 
+static void freemap_init(struct bpb *fat_bpb)
+{
+    unsigned long shift = 0;
+    while ((fat_bpb->fatsize - 1) >> shift >= FAT_FREEMAP_SIZE*8)
+        shift++;
+
+    fat_bpb->freemapshift = shift;
+    memset(FAT_FREEMAP(fat_bpb), 0, FAT_FREEMAP_SIZE);
+}
+
+static inline bool freemap_is_full(struct bpb *fat_bpb, unsigned long fatsec)
+{
+    unsigned long bit = fatsec >> fat_bpb->freemapshift;
+    return FAT_FREEMAP(fat_bpb)[bit / 8] & (1 << (bit % 8));
+}
+
+static inline void freemap_set_full(struct bpb *fat_bpb, unsigned long fatsec,
+                                    bool full)
+{
+    unsigned long bit = fatsec >> fat_bpb->freemapshift;
+    if (full)
+        FAT_FREEMAP(fat_bpb)[bit / 8] |= 1 << (bit % 8);
+    else
+        FAT_FREEMAP(fat_bpb)[bit / 8] &= ~(1 << (bit % 8));
+}
+
+/* call after scanning FAT sector 'fatsec'; 'fullsecs' counts the sectors
+   scanned in a row, up to and including this one, without a free cluster */
+static inline void freemap_sector_done(struct bpb *fat_bpb,
+                                       unsigned long fatsec,
+                                       unsigned long fullsecs)
+{
+    unsigned long mask = (1ul << fat_bpb->freemapshift) - 1;
+
+    /* last sector of its group and the whole group was full? */
+    if (((fatsec & mask) == mask || fatsec + 1 == fat_bpb->fatsize) &&
+        fullsecs > (fatsec & mask))
+        freemap_set_full(fat_bpb, fatsec, true);
+}
+
+/* state of a search for a run of free clusters */
+struct free_scan
+{
+    unsigned long want;     /* clusters wanted in a row */
+    unsigned long first;    /* first free cluster seen, 0 if none yet */
+    unsigned long start;    /* start of the current run of free clusters */
+    unsigned long len;      /*  and its length */
+    unsigned long best;     /* start of the longest run seen */
+    unsigned long bestlen;  /*  and its length */
+};
+
+/* feed the next cluster in order to the scan; returns true once the current
+   run is long enough */
+static inline bool free_scan_add(struct free_scan *scan, unsigned long c,
+                                 bool isfree)
+{
+    if (!isfree)
+    {
+        scan->len = 0;
+        return false;
+    }
+
+    if (!scan->first)
+        scan->first = c;
+
+    if (!scan->len++)
+        scan->start = c;
+
+    if (scan->len > scan->bestlen)
+    {
+        scan->best    = scan->start;
+        scan->bestlen = scan->len;
+    }
+
+    return scan->len >= scan->want;
+}
+
 #ifdef HAVE_FAT16SUPPORT
 static long get_next_cluster16(struct bpb *fat_bpb, long startcluster)
 {
@@ -841,43 +1095,78 @@ static long get_next_cluster16(struct bpb *fat_bpb, long startcluster)
     return next;
 }
 
-static long find_free_cluster16(struct bpb *fat_bpb, long startcluster)
+/* find the first run of 'count' free clusters at or after startcluster,
+   wrapping around; if there is none close by, the longest run seen is used.
+   With 'append', a free startcluster is taken as is since it continues the
+   caller's chain. Returns 0 if the volume is full. */
+static long find_free_cluster16(struct bpb *fat_bpb, long startcluster,
+                                unsigned long count, bool append)
 {
     unsigned long entry = startcluster;
     unsigned long sector = entry / CLUSTERS_PER_FAT16_SECTOR;
     unsigned long offset = entry % CLUSTERS_PER_FAT16_SECTOR;
+    unsigned long scanlimit = FREE_RUN_SCAN_SECTORS;
+    unsigned long fullsecs = 0;
+    struct free_scan scan = { .want = count ? count : 1 };
+    long c = 0;
 
-    for (unsigned long i = 0; i < fat_bpb->fatsize; i++)
+    /* the extra round at the end covers the entries in front of
+       startcluster in its own sector */
+    for (unsigned long i = 0; i <= fat_bpb->fatsize; i++)
     {
         unsigned long nr = (i + sector) % fat_bpb->fatsize;
+        unsigned long j = i ? 0 : offset;
+        unsigned long end = i < fat_bpb->fatsize ?
+                                CLUSTERS_PER_FAT16_SECTOR : offset;
+
+        if (nr == 0)
+            scan.len = 0; /* wrapped around */
+
+        if (freemap_is_full(fat_bpb, nr))
+        {
+            scan.len = 0;
+            continue;
+        }
+
+        if (scan.first && !scanlimit--)
+            break;
+
         uint16_t *sec = cache_sector(fat_bpb, nr + fat_bpb->fatrgnstart);
         if (!sec)
             break;
 
-        for (unsigned long j = 0; j < CLUSTERS_PER_FAT16_SECTOR; j++)
-        {
-            unsigned long k = (j + offset) % CLUSTERS_PER_FAT16_SECTOR;
+        bool full = j == 0 && end == CLUSTERS_PER_FAT16_SECTOR;
 
-            if (letoh16(sec[k]) == 0x0000)
-            {
-                unsigned long c = nr * CLUSTERS_PER_FAT16_SECTOR + k;
-                 /* Ignore the reserved clusters 0 & 1, and also
-                    cluster numbers out of bounds */
-                if (c < 2 || c > fat_bpb->dataclusters + 1)
-                    continue;
+        for (; j < end; j++)
+        {
+            unsigned long k = nr * CLUSTERS_PER_FAT16_SECTOR + j;
+            /* Ignore the reserved clusters 0 & 1, and also
+               cluster numbers out of bounds */
+            bool isfree = letoh16(sec[j]) == 0x0000 &&
+                          k >= 2 && k <= fat_bpb->dataclusters + 1;
 
-                DEBUGF("%s(%lx) == %lx\n", __func__, startcluster, c);
+            if (isfree)
+                full = false;
 
-                fat_bpb->fsinfo.nextfree = c;
-                return c;
+            if (free_scan_add(&scan, k, isfree) ||
+                (append && scan.start == entry && scan.len))
+            {
+                c = scan.start;
+                goto found;
             }
         }
 
-        offset = 0;
+        fullsecs = full ? fullsecs + 1 : 0;
+        freemap_sector_done(fat_bpb, nr, fullsecs);
     }
 
-    DEBUGF("%s(%lx) == 0\n", __func__, startcluster);
-    return 0; /* 0 is an illegal cluster number */
+    c = scan.best;
+found:
+    if (scan.first)
+        fat_bpb->fsinfo.nextfree = scan.first;
+
+    DEBUGF("%s(%lx,%lu) == %lx\n", __func__, startcluster, count, c);
+    return c; /* 0 is an illegal cluster number */
 }
 
 static int update_fat_entry16(struct bpb *fat_bpb, unsigned long entry,
@@ -919,6 +1208,8 @@ static int update_fat_entry16(struct bpb *fat_bpb, unsigned long entry,
         /* being freed */
         if (curval != 0x0000)
             fat_bpb->fsinfo.freecount++;
+
+        freemap_set_full(fat_bpb, sector, false);
     }
 
     DEBUGF("%lu free clusters\n", (unsigned long)fat_bpb->fsinfo.freecount);
@@ -933,6 +1224,9 @@ static int update_fat_entry16(struct bpb *fat_bpb, unsigned long entry,
 static void fat_recalc_free_internal16(struct bpb *fat_bpb)
 {
     unsigned long free = 0;
+    unsigned long fullsecs = 0;
+
+    memset(FAT_FREEMAP(fat_bpb), 0, FAT_FREEMAP_SIZE);
 
     for (unsigned long i = 0; i < fat_bpb->fatsize; i++)
     {
@@ -940,6 +1234,8 @@ static void fat_recalc_free_internal16(struct bpb *fat_bpb)
         if (!sec)
             break;
 
+        unsigned long secfree = free;
+
         for (unsigned long j = 0; j < CLUSTERS_PER_FAT16_SECTOR; j++)
         {
             unsigned long c = i * CLUSTERS_PER_FAT16_SECTOR + j;
@@ -954,14 +1250,38 @@ static void fat_recalc_free_internal16(struct bpb *fat_bpb)
             if (fat_bpb->fsinfo.nextfree == 0xffffffff)
                 fat_bpb->fsinfo.nextfree = c;
         }
+
+        fullsecs = free == secfree ? fullsecs + 1 : 0;
+        freemap_sector_done(fat_bpb, i, fullsecs);
     }
 
     fat_bpb->fsinfo.freecount = free;
 }
 #endif /* HAVE_FAT16SUPPORT */
 
-static void update_fsinfo32(struct bpb *fat_bpb)
+/* FSInfo only holds hints, so instead of being rewritten with every commit
+   the first change after a flush marks the free count unknown on disk and
+   the real values are written by a flush, which happens whenever a file that
+   was written is synced or closed and when the volume is unmounted; a volume
+   that goes away before that gets its free count recalculated when next
+   mounted */
+static void update_fsinfo32(struct bpb *fat_bpb, bool flush)
 {
+    struct fsinfo info = fat_bpb->fsinfo;
+    struct fsinfo *disk = &fat_bpb->fsinfo_disk;
+
+    if (info.freecount == disk->freecount &&
+        (info.nextfree == disk->nextfree || !flush))
+        return; /* a stale next free hint is harmless */
+
+    if (!flush)
+    {
+        if (disk->freecount == 0xffffffff)
+            return; /* already marked */
+
+        info.freecount = 0xffffffff;
+    }
+
     uint8_t *fsinfo = cache_sector(fat_bpb, fat_bpb->bpb_fsinfo);
     if (!fsinfo)
     {
@@ -969,9 +1289,10 @@ static void update_fsinfo32(struct bpb *fat_bpb)
         return;
     }
 
-    INT322BYTES(fsinfo, FSINFO_FREECOUNT, fat_bpb->fsinfo.freecount);
-    INT322BYTES(fsinfo, FSINFO_NEXTFREE, fat_bpb->fsinfo.nextfree);
+    INT322BYTES(fsinfo, FSINFO_FREECOUNT, info.freecount);
+    INT322BYTES(fsinfo, FSINFO_NEXTFREE, info.nextfree);
     dc_dirty_buf(fsinfo);
+    *disk = info;
 }
 
 static long get_next_cluster32(struct bpb *fat_bpb, long startcluster)
@@ -1000,43 +1321,78 @@ static long get_next_cluster32(struct bpb *fat_bpb, long startcluster)
     return next;
 }
 
-static long find_free_cluster32(struct bpb *fat_bpb, long startcluster)
+/* find the first run of 'count' free clusters at or after startcluster,
+   wrapping around; if there is none close by, the longest run seen is used.
+   With 'append', a free startcluster is taken as is since it continues the
+   caller's chain. Returns 0 if the volume is full. */
+static long find_free_cluster32(struct bpb *fat_bpb, long startcluster,
+                                unsigned long count, bool append)
 {
     unsigned long entry = startcluster;
     unsigned long sector = entry / CLUSTERS_PER_FAT_SECTOR;
     unsigned long offset = entry % CLUSTERS_PER_FAT_SECTOR;
+    unsigned long scanlimit = FREE_RUN_SCAN_SECTORS;
+    unsigned long fullsecs = 0;
+    struct free_scan scan = { .want = count ? count : 1 };
+    long c = 0;
 
-    for (unsigned long i = 0; i < fat_bpb->fatsize; i++)
+    /* the extra round at the end covers the entries in front of
+       startcluster in its own sector */
+    for (unsigned long i = 0; i <= fat_bpb->fatsize; i++)
     {
         unsigned long nr = (i + sector) % fat_bpb->fatsize;
+        unsigned long j = i ? 0 : offset;
+        unsigned long end = i < fat_bpb->fatsize ?
+                                CLUSTERS_PER_FAT_SECTOR : offset;
+
+        if (nr == 0)
+            scan.len = 0; /* wrapped around */
+
+        if (freemap_is_full(fat_bpb, nr))
+        {
+            scan.len = 0;
+            continue;
+        }
+
+        if (scan.first && !scanlimit--)
+            break;
+
         uint32_t *sec = cache_sector(fat_bpb, nr + fat_bpb->fatrgnstart);
         if (!sec)
             break;
 
-        for (unsigned long j = 0; j < CLUSTERS_PER_FAT_SECTOR; j++)
-        {
-            unsigned long k = (j + offset) % CLUSTERS_PER_FAT_SECTOR;
+        bool full = j == 0 && end == CLUSTERS_PER_FAT_SECTOR;
 
-            if (!(letoh32(sec[k]) & 0x0fffffff))
-            {
-                unsigned long c = nr * CLUSTERS_PER_FAT_SECTOR + k;
-                 /* Ignore the reserved clusters 0 & 1, and also
-                    cluster numbers out of bounds */
-                if (c < 2 || c > fat_bpb->dataclusters + 1)
-                    continue;
+        for (; j < end; j++)
+        {
+            unsigned long k = nr * CLUSTERS_PER_FAT_SECTOR + j;
+            /* Ignore the reserved clusters 0 & 1, and also
+               cluster numbers out of bounds */
+            bool isfree = !(letoh32(sec[j]) & 0x0fffffff) &&
+                          k >= 2 && k <= fat_bpb->dataclusters + 1;
 
-                DEBUGF("%s(%lx) == %lx\n", __func__, startcluster, c);
+            if (isfree)
+                full = false;
 
-                fat_bpb->fsinfo.nextfree = c;
-                return c;
+            if (free_scan_add(&scan, k, isfree) ||
+                (append && scan.start == entry && scan.len))
+            {
+                c = scan.start;
+                goto found;
             }
         }
 
-        offset = 0;
+        fullsecs = full ? fullsecs + 1 : 0;
+        freemap_sector_done(fat_bpb, nr, fullsecs);
     }
 
-    DEBUGF("%s(%lx) == 0\n", __func__, startcluster);
-    return 0; /* 0 is an illegal cluster number */
+    c = scan.best;
+found:
+    if (scan.first)
+        fat_bpb->fsinfo.nextfree = scan.first;
+
+    DEBUGF("%s(%lx,%lu) == %lx\n", __func__, startcluster, count, c);
+    return c; /* 0 is an illegal cluster number */
 }
 
 static int update_fat_entry32(struct bpb *fat_bpb, unsigned long entry,
@@ -1076,6 +1432,8 @@ static int update_fat_entry32(struct bpb *fat_bpb, unsigned long entry,
         /* being freed */
         if (curval & 0x0fffffff)
             fat_bpb->fsinfo.freecount++;
+
+        freemap_set_full(fat_bpb, sector, false);
     }
 
     DEBUGF("%lu free clusters\n", (unsigned long)fat_bpb->fsinfo.freecount);
@@ -1091,6 +1449,9 @@ static int update_fat_entry32(struct bpb *fat_bpb, unsigned long entry,
 static void fat_recalc_free_internal32(struct bpb *fat_bpb)
 {
     unsigned long free = 0;
+    unsigned long fullsecs = 0;
+
+    memset(FAT_FREEMAP(fat_bpb), 0, FAT_FREEMAP_SIZE);
 
     for (unsigned long i = 0; i < fat_bpb->fatsize; i++)
     {
@@ -1098,6 +1459,8 @@ static void fat_recalc_free_internal32(struct bpb *fat_bpb)
         if (!sec)
             break;
 
+        unsigned long secfree = free;
+
         for (unsigned long j = 0; j < CLUSTERS_PER_FAT_SECTOR; j++)
         {
             unsigned long c = i * CLUSTERS_PER_FAT_SECTOR + j;
@@ -1112,12 +1475,219 @@ static void fat_recalc_free_internal32(struct bpb *fat_bpb)
             if (fat_bpb->fsinfo.nextfree == 0xffffffff)
                 fat_bpb->fsinfo.nextfree = c;
         }
+
+        fullsecs = free == secfree ? fullsecs + 1 : 0;
+        freemap_sector_done(fat_bpb, i, fullsecs);
+    }
+
+    fat_bpb->fsinfo.freecount = free;
+    update_fsinfo32(fat_bpb, true);
+}
+
+#ifdef HAVE_EXFATSUPPORT
+static long get_next_cluster_exfat(struct bpb *fat_bpb, long startcluster)
+{
+    unsigned long entry = startcluster;
+    unsigned long sector = entry / CLUSTERS_PER_FAT_SECTOR;
+    unsigned long offset = entry % CLUSTERS_PER_FAT_SECTOR;
+
+    dc_lock_cache();
+
+    uint32_t *sec = cache_sector(fat_bpb, sector + fat_bpb->fatrgnstart);
+    if (!sec)
+    {
+        dc_unlock_cache();
+        DEBUGF("%s: Could not cache sector %lu\n", __func__, sector);
+        return -1;
+    }
+
+    unsigned long next = letoh32(sec[offset]);
+
+    /* end of chain or bad cluster; exFAT uses all 32 bits */
+    if (next < 2 || next > fat_bpb->dataclusters + 1)
+        next = 0;
+
+    dc_unlock_cache();
+    return next;
+}
+
+/* records the length of a contiguous file from its size in bytes; the first
+   cluster is always part of it */
+static void exfat_set_contig(struct bpb *fat_bpb, struct fat_file *file,
+                             uint32_t size)
+{
+    unsigned long clusterbytes = fat_bpb->bpb_secperclus * SECTOR_SIZE;
+    unsigned long count = size ? (size - 1) / clusterbytes + 1 : 1;
+    unsigned long max = fat_bpb->dataclusters + 2 -
+                        CLUSTER_NUM(file->firstcluster);
+
+    file->contigfirst = file->firstcluster;
+    file->contigcount = MIN(count, max);
+}
+
+/* exFAT volumes are read-only; the write entry points refuse them before
+   anything gets here */
+static long find_free_cluster_exfat(struct bpb *fat_bpb, long startcluster,
+                                    unsigned long count, bool append)
+{
+    (void)fat_bpb; (void)startcluster; (void)count; (void)append;
+    return 0;
+}
+
+static int update_fat_entry_exfat(struct bpb *fat_bpb, unsigned long entry,
+                                  unsigned long val)
+{
+    (void)fat_bpb; (void)entry; (void)val;
+    return -1;
+}
+
+/* returns the first cluster of the allocation bitmap, which is listed in the
+   root directory, or 0 if there is none */
+static long exfat_find_bitmap(struct bpb *fat_bpb)
+{
+    for (long cluster = fat_bpb->bpb_rootclus; cluster > 0;
+         cluster = get_next_cluster_exfat(fat_bpb, cluster))
+    {
+        unsigned long sector = cluster2sec(fat_bpb, cluster);
+
+        for (unsigned long i = 0; i < fat_bpb->bpb_secperclus; i++)
+        {
+            const uint8_t *ent = cache_sector(fat_bpb, sector + i);
+            if (!ent)
+                return 0;
+
+            for (unsigned int j = 0; j < DIR_ENTRIES_PER_SECTOR;
+                 j++, ent += DIR_ENTRY_SIZE)
+            {
+                if (ent[0] == EXFAT_ENTRY_EOD)
+                    return 0;
+
+                if (ent[0] == EXFAT_ENTRY_BITMAP)
+                    return BYTES2INT32(ent, EXFAT_STREAM_FIRSTCLUSTER);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* exFAT has no free count on disk; count the clear bits of the allocation
+   bitmap, where bit n stands for cluster n+2 */
+static void fat_recalc_free_internal_exfat(struct bpb *fat_bpb)
+{
+    unsigned long free = 0;
+    unsigned long bits = fat_bpb->dataclusters;
+
+    for (long cluster = exfat_find_bitmap(fat_bpb); cluster > 0 && bits;
+         cluster = get_next_cluster_exfat(fat_bpb, cluster))
+    {
+        unsigned long sector = cluster2sec(fat_bpb, cluster);
+
+        for (unsigned long i = 0; i < fat_bpb->bpb_secperclus && bits; i++)
+        {
+            const uint8_t *map = cache_sector(fat_bpb, sector + i);
+            if (!map)
+                return;
+
+            for (unsigned int j = 0; j < SECTOR_SIZE && bits; j++)
+            {
+                unsigned int n = MIN(bits, 8);
+                free += n - __builtin_popcount(map[j] & ((1u << n) - 1));
+                bits -= n;
+            }
+        }
+    }
+
+    if (bits)
+    {
+        DEBUGF("%s() - Allocation bitmap is missing or short\n", __func__);
+        free = 0;
     }
 
     fat_bpb->fsinfo.freecount = free;
-    update_fsinfo32(fat_bpb);
 }
 
+/* sets up the volume from an exFAT boot sector */
+static int exfat_mount_internal(struct bpb *fat_bpb, const uint8_t *buf)
+{
+    unsigned int secshift = buf[EXFAT_BYTSPERSECSHIFT];
+    unsigned int clusshift = buf[EXFAT_SECPERCLUSSHIFT];
+
+    /* sectors are 512 to 4096 bytes and clusters at most 32MB */
+    if (secshift < 9 || secshift > 12 || secshift + clusshift > 25)
+    {
+        DEBUGF("%s() - Bad sector or cluster size (%u, %u)\n", __func__,
+               secshift, clusshift);
+        return -1;
+    }
+
+    if (buf[EXFAT_NUMFATS] != 1)
+    {
+        DEBUGF("%s() - TexFAT volumes aren't supported\n", __func__);
+        return -2;
+    }
+
+    if (BYTES2INT16(buf, BPB_LAST_WORD) != 0xaa55)
+    {
+        DEBUGF("%s() - Last word is not 0xaa55\n", __func__);
+        return -3;
+    }
+
+    unsigned long secmult   = 1ul << (secshift - 9);
+    fat_bpb->bpb_bytspersec = 1ul << secshift;
+    fat_bpb->bpb_secperclus = secmult << clusshift;
+    fat_bpb->bpb_numfats    = 1;
+    fat_bpb->bpb_rootclus   = BYTES2INT32(buf, EXFAT_ROOTCLUSTER);
+
+    fat_bpb->fatsize         = secmult * BYTES2INT32(buf, EXFAT_FATLENGTH);
+    fat_bpb->fatrgnstart     = secmult * BYTES2INT32(buf, EXFAT_FATOFFSET);
+    fat_bpb->fatrgnend       = fat_bpb->fatrgnstart + fat_bpb->fatsize;
+    fat_bpb->firstdatasector = secmult *
+                               BYTES2INT32(buf, EXFAT_CLUSTERHEAPOFFSET);
+    fat_bpb->dataclusters    = BYTES2INT32(buf, EXFAT_CLUSTERCOUNT);
+
+    /* sector numbers are 32 bits here and contiguous files are flagged in
+       their cluster numbers */
+    uint64_t totalsectors = (uint64_t)fat_bpb->dataclusters *
+                            fat_bpb->bpb_secperclus + fat_bpb->firstdatasector;
+
+    if (totalsectors > 0xffffffffull ||
+        fat_bpb->dataclusters + 2 > EXFAT_CONTIG_FLAG)
+    {
+        DEBUGF("%s() - Volume is too large\n", __func__);
+        return -4;
+    }
+
+    if (fat_bpb->dataclusters + 2 > fat_bpb->fatsize * CLUSTERS_PER_FAT_SECTOR ||
+        fat_bpb->bpb_rootclus < 2 ||
+        (unsigned long)fat_bpb->bpb_rootclus > fat_bpb->dataclusters + 1)
+    {
+        DEBUGF("%s() - Volume layout is not sane\n", __func__);
+        return -5;
+    }
+
+    fat_bpb->totalsectors  = totalsectors;
+    fat_bpb->rootdirsector = cluster2sec(fat_bpb, fat_bpb->bpb_rootclus);
+
+    /* counted from the allocation bitmap after mounting */
+    fat_bpb->fsinfo.freecount = 0xffffffff;
+    fat_bpb->fsinfo.nextfree  = 0xffffffff;
+    fat_bpb->fsinfo_disk      = fat_bpb->fsinfo;
+
+#ifdef HAVE_FAT16SUPPORT
+    fat_bpb->is_fat16 = false;
+#endif
+    fat_bpb->is_exfat = true;
+
+    BPB_FN_SETEX(fat_bpb, get_next_cluster);
+    BPB_FN_SETEX(fat_bpb, find_free_cluster);
+    BPB_FN_SETEX(fat_bpb, update_fat_entry);
+    BPB_FN_SETEX(fat_bpb, fat_recalc_free_internal);
+
+    return 0;
+}
+#endif /* HAVE_EXFATSUPPORT */
+
 static int fat_mount_internal(struct bpb *fat_bpb)
 {
     int rc;
@@ -1137,6 +1707,17 @@ static int fat_mount_internal(struct bpb *fat_bpb)
         FAT_ERROR(rc * 10 - 2);
     }
 
+#ifdef HAVE_EXFATSUPPORT
+    fat_bpb->is_exfat = false;
+
+    if (!memcmp(buf + BS_OEMNAME, EXFAT_OEMNAME, 8))
+    {
+        rc = exfat_mount_internal(fat_bpb, buf);
+        dc_release_buffer(buf);
+        return rc;
+    }
+#endif /* HAVE_EXFATSUPPORT */
+
     fat_bpb->bpb_bytspersec = BYTES2INT16(buf, BPB_BYTSPERSEC);
     unsigned long secmult = fat_bpb->bpb_bytspersec / SECTOR_SIZE;
     /* Sanity check is performed later */
@@ -1273,8 +1854,11 @@ static int fat_mount_internal(struct bpb *fat_bpb)
         fat_bpb->fsinfo.nextfree = BYTES2INT32(buf, FSINFO_NEXTFREE);
     }
 
-#ifdef HAVE_FAT16SUPPORT
+    fat_bpb->fsinfo_disk = fat_bpb->fsinfo;
+
+#ifdef HAVE_FAT_FN_TABLE
     /* Fix up calls that change per FAT type */
+#ifdef HAVE_FAT16SUPPORT
     if (fat_bpb->is_fat16)
     {
         BPB_FN_SET16(fat_bpb, get_next_cluster);
@@ -1283,13 +1867,14 @@ static int fat_mount_internal(struct bpb *fat_bpb)
         BPB_FN_SET16(fat_bpb, fat_recalc_free_internal);
     }
     else
+#endif /* HAVE_FAT16SUPPORT */
     {
         BPB_FN_SET32(fat_bpb, get_next_cluster);
         BPB_FN_SET32(fat_bpb, find_free_cluster);
         BPB_FN_SET32(fat_bpb, update_fat_entry);
         BPB_FN_SET32(fat_bpb, fat_recalc_free_internal);
     }
-#endif /* HAVE_FAT16SUPPORT */
+#endif /* HAVE_FAT_FN_TABLE */
 
     rc = 0;
 fat_error:
@@ -1335,9 +1920,13 @@ static union raw_dirent * cache_direntry(struct bpb *fat_bpb,
     return ent;
 }
 
-static long next_write_cluster(struct bpb *fat_bpb, long oldcluster)
+/* returns the cluster following oldcluster, allocating one if the chain ends
+   there; 'count' is the number of clusters the caller expects to need, which
+   lets a new allocation pick a free run that holds them all */
+static long next_write_cluster(struct bpb *fat_bpb, long oldcluster,
+                               unsigned long count)
 {
-    DEBUGF("%s(old:%lx)\n", __func__, oldcluster);
+    DEBUGF("%s(old:%lx,count:%lu)\n", __func__, oldcluster, count);
 
     long cluster = 0;
 
@@ -1359,7 +1948,8 @@ static long next_write_cluster(struct bpb *fat_bpb, long oldcluster)
         long findstart = oldcluster > 0 ?
             oldcluster + 1 : (long)fat_bpb->fsinfo.nextfree;
 
-        cluster = find_free_cluster(fat_bpb, findstart);
+        cluster = find_free_cluster(fat_bpb, findstart, count,
+                                    oldcluster > 0);
 
         if (cluster)
         {
@@ -1394,7 +1984,7 @@ static int fat_extend_dir(struct bpb *fat_bpb, struct fat_filestr *dirstr)
     int rc;
 
     long cluster    = dirstr->lastcluster;
-    long newcluster = next_write_cluster(fat_bpb, cluster);
+    long newcluster = next_write_cluster(fat_bpb, cluster, 1);
 
     if (!newcluster)
     {
@@ -1452,6 +2042,9 @@ static void fat_open_internal(IF_MV(int volume,) long startcluster,
     file->dircluster   = 0;
     file->e.entry      = 0;
     file->e.entries    = 0;
+#ifdef HAVE_EXFATSUPPORT
+    file->contigfirst  = 0;
+#endif
 }
 
 #if CONFIG_RTC
@@ -1986,6 +2579,9 @@ int fat_create_file(struct fat_file *parent, const char *name,
     if (!fat_bpb)
         return -1;
 
+    if (IS_EXFAT(fat_bpb))
+        return FAT_RC_EROFS;
+
     int rc;
 
     fat_open_internal(IF_MV(parent->volume,) 0, file);
@@ -2054,7 +2650,7 @@ fat_error:
     if (rc < 0)
         free_cluster_chain(fat_bpb, file->firstcluster);
 
-    cache_commit(fat_bpb);
+    cache_commit(fat_bpb, false);
     return rc;
 }
 
@@ -2082,8 +2678,8 @@ bool fat_file_is_same(const struct fat_file *file1,
            IF_MV( && file1->volume == file2->volume );
 }
 
-int fat_open(const struct fat_file *parent, long startcluster,
-             struct fat_file *file)
+int fat_open(const struct fat_file *parent,
+             const struct fat_direntry *fatent, struct fat_file *file)
 {
     if (!parent)
         return -2; /* this does _not_ open any root */
@@ -2097,9 +2693,14 @@ int fat_open(const struct fat_file *parent, long startcluster,
 #ifdef HAVE_MULTIVOLUME
     file->volume       = parent->volume;
 #endif
-    file->firstcluster = startcluster;
+    file->firstcluster = fatent->firstcluster;
     file->dircluster   = parent->firstcluster;
 
+#ifdef HAVE_EXFATSUPPORT
+    if (IS_CONTIG_CLUSTER(file->firstcluster))
+        exfat_set_contig(fat_bpb, file, fatent->filesize);
+#endif
+
     return 0;
 }
 
@@ -2119,6 +2720,9 @@ int fat_remove(struct fat_file *file, enum fat_remove_op what)
     if (!fat_bpb)
         return -1;
 
+    if (IS_EXFAT(fat_bpb))
+        return FAT_RC_EROFS;
+
     int rc;
 
     if (file->firstcluster == fat_bpb->bpb_rootclus)
@@ -2147,6 +2751,7 @@ int fat_remove(struct fat_file *file, enum fat_remove_op what)
 
         /* at least the first cluster was freed */
         file->firstcluster = 0;
+        file->chaingen++;
 
         if (rc == 0)
             FAT_ERROR(-5);
@@ -2154,7 +2759,7 @@ int fat_remove(struct fat_file *file, enum fat_remove_op what)
 
     rc = 0;
 fat_error:
-    cache_commit(fat_bpb);
+    cache_commit(fat_bpb, false);
     return rc;
 }
 
@@ -2165,6 +2770,9 @@ int fat_rename(struct fat_file *parent, struct fat_file *file,
     if (!fat_bpb)
         return -1;
 
+    if (IS_EXFAT(fat_bpb))
+        return FAT_RC_EROFS;
+
     int rc;
     /* save old file; don't change it unless everything succeeds */
     struct fat_file newfile = *file;
@@ -2272,7 +2880,7 @@ fat_error:
     if (rc < 0 && !fat_file_is_same(&newfile, file))
         free_direntries(fat_bpb, &newfile);
 
-    cache_commit(fat_bpb);
+    cache_commit(fat_bpb, false);
     return rc;
 }
 
@@ -2284,6 +2892,9 @@ int fat_modtime(struct fat_file *parent, struct fat_file *file,
     if (!fat_bpb)
         return -1;
 
+    if (IS_EXFAT(fat_bpb))
+        return FAT_RC_EROFS;
+
     int rc;
 
     struct fat_filestr parentstr;
@@ -2308,12 +2919,72 @@ int fat_modtime(struct fat_file *parent, struct fat_file *file,
     rc = 0;
 fat_error:
     dc_unlock_cache();
-    cache_commit(fat_bpb);
+    cache_commit(fat_bpb, false);
     return rc;
 }
 
 /** File stream functions **/
 
+#ifdef HAVE_EXFATSUPPORT
+/* returns the last cluster of a contiguous file; files that weren't opened
+   from their directory entry (dircache keeps no directory sizes) have the
+   length read back from their stream entry */
+static long exfat_contig_last(struct bpb *fat_bpb, struct fat_file *file)
+{
+    const long first = CLUSTER_NUM(file->firstcluster);
+
+    if (file->contigfirst != file->firstcluster)
+    {
+        /* the rest of the cluster heap unless the entry says otherwise */
+        file->contigfirst = file->firstcluster;
+        file->contigcount = fat_bpb->dataclusters + 2 - first;
+
+        if (file->e.entries >= 2 && file->e.entry != FAT_DIRSCAN_RW_VAL)
+        {
+            struct fat_file parent;
+            fat_open_internal(IF_MV(file->volume,) file->dircluster, &parent);
+
+            struct fat_filestr parentstr;
+            fat_filestr_init(&parentstr, &parent);
+
+            dc_lock_cache();
+
+            const uint8_t *ent = (const uint8_t *)cache_direntry(fat_bpb,
+                &parentstr, file->e.entry - file->e.entries + 2);
+
+            if (ent && ent[0] == EXFAT_ENTRY_STREAM &&
+                BYTES2INT32(ent, EXFAT_STREAM_FIRSTCLUSTER) ==
+                    (unsigned long)first)
+            {
+                exfat_set_contig(fat_bpb, file,
+                    BYTES2INT32(ent, EXFAT_STREAM_DATALENGTH + 4) ?
+                        FAT_MAX_FILE_SIZE :
+                        BYTES2INT32(ent, EXFAT_STREAM_DATALENGTH));
+            }
+
+            dc_unlock_cache();
+        }
+    }
+
+    return first + file->contigcount - 1;
+}
+#endif /* HAVE_EXFATSUPPORT */
+
+/* returns the cluster after 'cluster' in the file's data, 0 at the end */
+static long file_next_cluster(struct bpb *fat_bpb, struct fat_file *file,
+                              long cluster)
+{
+#ifdef HAVE_EXFATSUPPORT
+    /* contiguous files need no FAT lookups; their length bounds them */
+    if (IS_CONTIG_CLUSTER(file->firstcluster))
+        return cluster < exfat_contig_last(fat_bpb, file) ? cluster + 1 : 0;
+#else
+    (void)file;
+#endif
+
+    return get_next_cluster(fat_bpb, cluster);
+}
+
 int fat_closewrite(struct fat_filestr *filestr, uint32_t size,
                    struct fat_direntry *fatentp)
 {
@@ -2323,6 +2994,9 @@ int fat_closewrite(struct fat_filestr *filestr, uint32_t size,
     if (!fat_bpb)
         return -1;
 
+    if (IS_EXFAT(fat_bpb))
+        return FAT_RC_EROFS;
+
     int rc;
 
     if (!size && file->firstcluster)
@@ -2333,6 +3007,7 @@ int fat_closewrite(struct fat_filestr *filestr, uint32_t size,
             FAT_ERROR(rc * 10 - 2);
 
         file->firstcluster = 0;
+        file->chaingen++;
         fat_rewind(filestr);
     }
 
@@ -2372,16 +3047,26 @@ int fat_closewrite(struct fat_filestr *filestr, uint32_t size,
 
     rc = 0;
 fat_error:
-    cache_commit(fat_bpb);
+    /* the free count has settled for now */
+    cache_commit(fat_bpb, true);
     return rc;
 }
 
 void fat_filestr_init(struct fat_filestr *fatstr, struct fat_file *file)
 {
     fatstr->fatfilep = file;
+    fatstr->extents = NULL;
     fat_rewind(fatstr);
 }
 
+/* give the stream somewhere to remember the cluster runs it seeks over */
+void fat_filestr_set_extents(struct fat_filestr *fatstr,
+                             struct fat_extents *extents)
+{
+    extents->count = 0;
+    fatstr->extents = extents;
+}
+
 unsigned long fat_query_sectornum(const struct fat_filestr *filestr)
 {
     /* return next sector number to be transferred */
@@ -2475,6 +3160,9 @@ long fat_readwrite(struct fat_filestr *filestr, unsigned long sectorcount,
     if (!fat_bpb)
         return -1;
 
+    if (write && IS_EXFAT(fat_bpb))
+        return FAT_RC_EROFS;
+
     bool eof = filestr->eof;
 
     if ((eof && !write) || !sectorcount)
@@ -2498,12 +3186,14 @@ long fat_readwrite(struct fat_filestr *filestr, unsigned long sectorcount,
     if (!sector)
     {
         /* look up first sector of file */
-        long newcluster = file->firstcluster;
+        long newcluster = CLUSTER_NUM(file->firstcluster);
 
         if (write && !newcluster)
         {
             /* file is empty; try to allocate its first cluster */
-            newcluster = next_write_cluster(fat_bpb, 0);
+            newcluster = next_write_cluster(fat_bpb, 0,
+                (sectorcount + fat_bpb->bpb_secperclus - 1) /
+                    fat_bpb->bpb_secperclus);
             file->firstcluster = newcluster;
         }
 
@@ -2537,8 +3227,11 @@ long fat_readwrite(struct fat_filestr *filestr, unsigned long sectorcount,
         if (++sectornum >= fat_bpb->bpb_secperclus)
         {
             /* out of sectors in this cluster; get the next cluster */
-            long newcluster = write ? next_write_cluster(fat_bpb, cluster) :
-                                      get_next_cluster(fat_bpb, cluster);
+            long newcluster = write ?
+                next_write_cluster(fat_bpb, cluster,
+                    (sectorcount - transferred - count +
+                     fat_bpb->bpb_secperclus - 1) / fat_bpb->bpb_secperclus) :
+                file_next_cluster(fat_bpb, file, cluster);
             if (newcluster)
             {
                 cluster = newcluster;
@@ -2558,8 +3251,9 @@ long fat_readwrite(struct fat_filestr *filestr, unsigned long sectorcount,
             }
         }
 
-        /* find sequential sectors and transfer them all at once */
-        if (sector != last || count >= FAT_MAX_TRANSFER_SIZE)
+        /* find sequential sectors and transfer them all at once, also across
+           clusters that happen to be adjacent on disk */
+        if (sector != last || count >= fat_bpb->maxtransfer)
         {
             /* not sequential/over limit */
             rc = transfer(fat_bpb, last - count + 1, count, buf, write);
@@ -2602,7 +3296,7 @@ fat_error:
 void fat_rewind(struct fat_filestr *filestr)
 {
     /* rewind the file position */
-    filestr->lastcluster  = filestr->fatfilep->firstcluster;
+    filestr->lastcluster  = CLUSTER_NUM(filestr->fatfilep->firstcluster);
     filestr->lastsector   = 0;
     filestr->clusternum   = 0;
     filestr->sectornum    = FAT_FILE_RW_VAL;
@@ -2619,6 +3313,127 @@ void fat_seek_to_stream(struct fat_filestr *filestr,
     filestr->eof         = filestr_seek_to->eof;
 }
 
+/* helper for fat_seek; finds the cluster at clusternum within the file,
+   recording the contiguous runs passed while walking past the known ones */
+static long seek_cluster(struct bpb *fat_bpb, struct fat_filestr *filestr,
+                         long clusternum)
+{
+    struct fat_file * const file = filestr->fatfilep;
+    struct fat_extents * const x = filestr->extents;
+    struct fat_extent * const ext = x ? x->runs : NULL;
+    int count = x ? x->count : 0;
+    const long firstcluster = CLUSTER_NUM(file->firstcluster);
+
+#ifdef HAVE_EXFATSUPPORT
+    if (IS_CONTIG_CLUSTER(file->firstcluster))
+    {
+        /* the whole file is one run */
+        long cluster = firstcluster + clusternum;
+        return cluster <= exfat_contig_last(fat_bpb, file) ? cluster : 0;
+    }
+#endif
+
+    /* runs are stale if the chain was cut or the stream was rebound to
+       another file */
+    if (count && (x->chaingen != file->chaingen ||
+                  ext[0].cluster != firstcluster))
+        count = 0;
+
+    if (x)
+        x->chaingen = file->chaingen;
+
+    /* find the last run starting at or before clusternum */
+    int low = 0, high = count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (ext[mid].clusternum <= clusternum)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    long num = 0;
+    long cluster = firstcluster;
+    bool record = x && !count;
+
+    if (low > 0)
+    {
+        const struct fat_extent *e = &ext[low - 1];
+        if (clusternum < e->clusternum + e->count)
+        {
+            x->count = count;
+            return e->cluster + (clusternum - e->clusternum);
+        }
+
+        /* continue walking from the end of the run; only a walk past the
+           last run adds new ones */
+        num = e->clusternum + e->count - 1;
+        cluster = e->cluster + e->count - 1;
+        record = low == count;
+    }
+
+    if (filestr->clusternum > num && clusternum >= filestr->clusternum)
+    {
+        /* current position is closer */
+        num = filestr->clusternum;
+        cluster = filestr->lastcluster;
+        record = false;
+    }
+
+    if (record && !count)
+    {
+        ext[0].clusternum = 0;
+        ext[0].cluster = cluster;
+        ext[0].count = 1;
+        count = 1;
+    }
+
+    while (num < clusternum)
+    {
+        long next = get_next_cluster(fat_bpb, cluster);
+        if (next <= 0)
+        {
+            cluster = 0; /* end of chain or FAT read error */
+            break;
+        }
+
+        num++;
+
+        if (record)
+        {
+            if (next == cluster + 1)
+            {
+                ext[count - 1].count++;
+            }
+            else
+            {
+                if (count >= FAT_EXTENT_COUNT)
+                {
+                    /* full; keep every other run so the remembered ones
+                       stay spread over the whole file */
+                    for (int i = 1; i < count / 2; i++)
+                        ext[i] = ext[i * 2];
+
+                    count /= 2;
+                }
+
+                ext[count].clusternum = num;
+                ext[count].cluster = next;
+                ext[count].count = 1;
+                count++;
+            }
+        }
+
+        cluster = next;
+    }
+
+    if (x)
+        x->count = count;
+
+    return cluster;
+}
+
 int fat_seek(struct fat_filestr *filestr, unsigned long seeksector)
 {
     const struct fat_file * const file = filestr->fatfilep;
@@ -2627,7 +3442,7 @@ int fat_seek(struct fat_filestr *filestr, unsigned long seeksector)
         return -1;
 
     int rc;
-    long          cluster    = file->firstcluster;
+    long          cluster    = CLUSTER_NUM(file->firstcluster);
     unsigned long sector     = 0;
     long          clusternum = 0;
     unsigned long sectornum  = FAT_FILE_RW_VAL;
@@ -2654,23 +3469,21 @@ int fat_seek(struct fat_filestr *filestr, unsigned long seeksector)
         clusternum = seeksector / fat_bpb->bpb_secperclus;
         sectornum = seeksector % fat_bpb->bpb_secperclus;
 
-        long numclusters = clusternum;
-
-        if (filestr->clusternum && clusternum >= filestr->clusternum)
+    #ifdef HAVE_FAT16SUPPORT
+        if (cluster < 0) /* FAT16 root dir; sequential pseudo-clusters */
         {
-            /* seek forward from current position */
-            cluster = filestr->lastcluster;
-            numclusters -= filestr->clusternum;
+            cluster += clusternum;
+            if (cluster >= 0)
+                FAT_ERROR(FAT_SEEK_EOF);
         }
-
-        for (long i = 0; i < numclusters; i++)
+        else
+    #endif /* HAVE_FAT16SUPPORT */
         {
-            cluster = get_next_cluster(fat_bpb, cluster);
-
+            cluster = seek_cluster(fat_bpb, filestr, clusternum);
             if (!cluster)
             {
                 DEBUGF("Seeking beyond the end of the file! "
-                       "(sector %lu, cluster %ld)\n", seeksector, i);
+                       "(sector %lu, cluster %ld)\n", seeksector, clusternum);
                 FAT_ERROR(FAT_SEEK_EOF);
             }
         }
@@ -2699,6 +3512,9 @@ int fat_truncate(const struct fat_filestr *filestr)
     if (!fat_bpb)
         return -1;
 
+    if (IS_EXFAT(fat_bpb))
+        return FAT_RC_EROFS;
+
     int rc = 1;
 
     long last = filestr->lastcluster;
@@ -2713,6 +3529,9 @@ int fat_truncate(const struct fat_filestr *filestr)
             FAT_ERROR(rc2 * 10 - 2);
     }
 
+    /* runs remembered by any of the file's streams may now be gone */
+    filestr->fatfilep->chaingen++;
+
     int rc2 = free_cluster_chain(fat_bpb, next);
     if (rc2 <= 0)
     {
@@ -2727,51 +3546,258 @@ fat_error:
 
 /** Directory stream functions **/
 
-int fat_readdir(struct fat_filestr *dirstr, struct fat_dirscan_info *scan,
-                struct filestr_cache *cachep, struct fat_direntry *entry)
+/* makes sure the directory sector holding 'direntry' is in the stream cache;
+   returns 1 if it is, 0 at the end of the directory or < 0 on error */
+static int readdir_sector(struct fat_filestr *dirstr,
+                          struct filestr_cache *cachep, unsigned int direntry)
+{
+    int rc;
+
+    if (direntry >= MAX_DIRENTRIES)
+    {
+        DEBUGF("%s() - Dir is too large (entry %u)\n", __func__, direntry);
+        FAT_ERROR(-1);
+    }
+
+    unsigned long sector = direntry / DIR_ENTRIES_PER_SECTOR;
+    if (cachep->sector != sector)
+    {
+        if (cachep->sector + 1 != sector)
+        {
+            /* Nothing cached or sector isn't contiguous */
+            rc = fat_seek(dirstr, sector);
+            if (rc < 0)
+                FAT_ERROR(rc * 10 - 2);
+        }
+
+        rc = fat_readwrite(dirstr, 1, cachep->buffer, false);
+        if (rc <= 0)
+        {
+            if (rc == 0)
+                return 0; /* eof */
+
+            DEBUGF("%s() - Couldn't read dir (err %d)\n", __func__, rc);
+            FAT_ERROR(rc * 10 - 3);
+        }
+
+        cachep->sector = sector;
+    }
+
+    rc = 1;
+fat_error:
+    return rc;
+}
+
+#ifdef HAVE_EXFATSUPPORT
+/* running checksum of an exFAT entry set; the primary entry's own checksum
+   field is left out */
+static uint16_t exfat_set_checksum(uint16_t chksum, const uint8_t *ent,
+                                   bool primary)
+{
+    for (unsigned int i = 0; i < DIR_ENTRY_SIZE; i++)
+    {
+        if (primary && (i == EXFAT_FILE_SETCHECKSUM ||
+                        i == EXFAT_FILE_SETCHECKSUM + 1))
+            continue;
+
+        chksum = ((chksum & 1) ? 0x8000 : 0) + (chksum >> 1) + ent[i];
+    }
+
+    return chksum;
+}
+
+/* exFAT keeps each file in a set of entries: a file entry with the
+   attributes and times, a stream extension with the location and size and
+   then name entries with 15 UTF-16 characters each */
+static int exfat_readdir(struct bpb *fat_bpb, struct fat_filestr *dirstr,
+                         struct fat_dirscan_info *scan,
+                         struct filestr_cache *cachep,
+                         struct fat_direntry *entry)
 {
     int rc = 0;
 
-    /* long file names are stored in special entries; each entry holds up to
-       13 UTF-16 characters' thus, UTF-8 converted names can be max 255 chars
-       (1020 bytes) long, not including the trailing '\0'. */
-    struct fatlong_parse_state lnparse;
-    fatlong_parse_start(&lnparse);
+    /* names are collected where FAT long names go so the UTF-8 conversion
+       can run in place */
+    uint16_t * const ucs = entry->ucssegs[5];
+    unsigned int remaining = 0, namelen = 0, namepos = 0;
+    uint16_t chksum = 0, setchksum = 0;
 
     scan->entries = 0;
 
     while (1)
     {
         unsigned int direntry = ++scan->entry;
-        if (direntry >= MAX_DIRENTRIES)
+        int rc2 = readdir_sector(dirstr, cachep, direntry);
+        if (rc2 <= 0)
         {
-            DEBUGF("%s() - Dir is too large (entry %u)\n", __func__,
-                   direntry);
-            FAT_ERROR(-1);
+            if (rc2 == 0)
+                break; /* eof */
+
+            FAT_ERROR(rc2 * 10 - 1);
         }
 
-        unsigned long sector = direntry / DIR_ENTRIES_PER_SECTOR;
-        if (cachep->sector != sector)
+        const uint8_t *ent = (const uint8_t *)cachep->buffer +
+                (direntry % DIR_ENTRIES_PER_SECTOR) * DIR_ENTRY_SIZE;
+        unsigned int type = ent[0];
+
+        if (type == EXFAT_ENTRY_EOD)
+            break;    /* last entry */
+
+        if (type == EXFAT_ENTRY_FILE)
+        {
+            remaining = ent[EXFAT_FILE_SECONDARYCOUNT];
+            if (remaining < 2 || remaining > EXFAT_MAX_SECONDARY)
+                remaining = 0;
+
+            namelen   = 0;
+            namepos   = 0;
+            setchksum = BYTES2INT16(ent, EXFAT_FILE_SETCHECKSUM);
+            chksum    = exfat_set_checksum(0, ent, true);
+
+            uint32_t crt = BYTES2INT32(ent, EXFAT_FILE_CRTTIME);
+            uint32_t wrt = BYTES2INT32(ent, EXFAT_FILE_WRTTIME);
+
+            entry->attr         = ent[EXFAT_FILE_ATTRIBUTES];
+            entry->crttimetenth = ent[EXFAT_FILE_CRT10MS];
+            entry->crttime      = crt & 0xffff;
+            entry->crtdate      = crt >> 16;
+            entry->lstaccdate   = BYTES2INT32(ent, EXFAT_FILE_ACCTIME) >> 16;
+            entry->wrttime      = wrt & 0xffff;
+            entry->wrtdate      = wrt >> 16;
+
+            scan->entries = 1;
+            continue;
+        }
+
+        if ((type & (EXFAT_ENTRY_INUSE | EXFAT_ENTRY_SECONDARY)) !=
+                (EXFAT_ENTRY_INUSE | EXFAT_ENTRY_SECONDARY) || !remaining)
+        {
+            /* free entry, other primary entry or an orphan */
+            remaining = 0;
+            scan->entries = 0;
+            continue;
+        }
+
+        chksum = exfat_set_checksum(chksum, ent, false);
+
+        if (++scan->entries == 2)
         {
-            if (cachep->sector + 1 != sector)
+            if (type != EXFAT_ENTRY_STREAM)
             {
-                /* Nothing cached or sector isn't contiguous */
-                int rc2 = fat_seek(dirstr, sector);
-                if (rc2 < 0)
-                    FAT_ERROR(rc2 * 10 - 2);
+                remaining = 0;
+                scan->entries = 0;
+                continue;
             }
 
-            int rc2 = fat_readwrite(dirstr, 1, cachep->buffer, false);
-            if (rc2 <= 0)
-            {
-                if (rc2 == 0)
-                    break; /* eof */
+            unsigned int flags = ent[EXFAT_STREAM_FLAGS];
+            unsigned long cluster = BYTES2INT32(ent, EXFAT_STREAM_FIRSTCLUSTER);
 
-                DEBUGF("%s() - Couldn't read dir (err %d)\n", __func__, rc);
-                FAT_ERROR(rc2 * 10 - 3);
+            if (!(flags & EXFAT_STREAM_F_ALLOC) || cluster < 2 ||
+                cluster > fat_bpb->dataclusters + 1)
+                cluster = 0;
+            else if (flags & EXFAT_STREAM_F_NOFATCHAIN)
+                cluster |= EXFAT_CONTIG_FLAG;
+
+            namelen = ent[EXFAT_STREAM_NAMELENGTH];
+            entry->firstcluster = cluster;
+
+            /* sizes past what FAT can hold are clipped */
+            entry->filesize =
+                BYTES2INT32(ent, EXFAT_STREAM_DATALENGTH + 4) ?
+                    FAT_MAX_FILE_SIZE :
+                    BYTES2INT32(ent, EXFAT_STREAM_DATALENGTH);
+        }
+        else if (type == EXFAT_ENTRY_NAME)
+        {
+            for (unsigned int i = 0;
+                 i < EXFAT_NAME_CHARS && namepos < namelen; i++)
+            {
+                ucs[namepos++] = BYTES2INT16(ent, EXFAT_NAME_OFFSET + i*2);
             }
+        }
+        /* anything else is a vendor extension, which only counts toward the
+           checksum */
+
+        if (--remaining)
+            continue;
+
+        if (chksum != setchksum || !namelen || namepos != namelen)
+        {
+            DEBUGF("%s() - Bad entry set (entry %u)\n", __func__, direntry);
+            scan->entries = 0;
+            continue;
+        }
+
+        /* convert the name to UTF-8 */
+        unsigned char * const name = entry->name;
+        unsigned char *p = name;
 
-            cachep->sector = sector;
+        ucs[namelen] = 0x0000;
+
+        for (uint16_t *ucsp = ucs, ucc = *ucsp; ucc; ucc = *++ucsp)
+        {
+            if ((p = utf8encode(ucc, p)) - name > FAT_DIRENTRY_NAME_MAX)
+                break;
+        }
+
+        if (p - name > FAT_DIRENTRY_NAME_MAX)
+        {
+            DEBUGF("%s() - Name is too long (entry %u)\n", __func__,
+                   direntry);
+            scan->entries = 0;
+            continue;
+        }
+
+        *p = '\0';
+        entry->shortname[0] = '\0';
+
+        DEBUGF("LN:\"%s\"", entry->name);
+        rc = 1;
+        break;
+    } /* end while */
+
+fat_error:
+    if (rc <= 0)
+    {
+        /* error or eod; stay on last good position */
+        fat_empty_fat_direntry(entry);
+        scan->entry--;
+        scan->entries = 0;
+    }
+
+    return rc;
+}
+#endif /* HAVE_EXFATSUPPORT */
+
+int fat_readdir(struct fat_filestr *dirstr, struct fat_dirscan_info *scan,
+                struct filestr_cache *cachep, struct fat_direntry *entry)
+{
+    int rc = 0;
+
+#ifdef HAVE_EXFATSUPPORT
+    struct bpb * const fat_bpb = FAT_BPB(dirstr->fatfilep->volume);
+    if (fat_bpb && fat_bpb->is_exfat)
+        return exfat_readdir(fat_bpb, dirstr, scan, cachep, entry);
+#endif
+
+    /* long file names are stored in special entries; each entry holds up to
+       13 UTF-16 characters' thus, UTF-8 converted names can be max 255 chars
+       (1020 bytes) long, not including the trailing '\0'. */
+    struct fatlong_parse_state lnparse;
+    fatlong_parse_start(&lnparse);
+
+    scan->entries = 0;
+
+    while (1)
+    {
+        unsigned int direntry = ++scan->entry;
+        int rc2 = readdir_sector(dirstr, cachep, direntry);
+        if (rc2 <= 0)
+        {
+            if (rc2 == 0)
+                break; /* eof */
+
+            FAT_ERROR(rc2 * 10 - 2);
         }
 
         unsigned int index = direntry % DIR_ENTRIES_PER_SECTOR;
@@ -2883,11 +3909,15 @@ int fat_mount(IF_MV(int volume,) IF_MD(int drive,) unsigned long startsector)
 #ifdef HAVE_MULTIDRIVE
     fat_bpb->drive       = drive;
 #endif
+    fat_bpb->maxtransfer = MIN(FAT_MAX_TRANSFER_SIZE,
+                               storage_max_transfer(IF_MD_DRV(drive)));
 
     rc = fat_mount_internal(fat_bpb);
     if (rc < 0)
         FAT_ERROR(rc * 10 - 2);
 
+    freemap_init(fat_bpb);
+
     /* it worked */
     fat_bpb->mounted = true;
 
@@ -2906,6 +3936,20 @@ fat_error:
     return rc;
 }
 
+/* write back the volume's cached sectors and its real FSInfo values; the
+   caller has to be sure the volume's storage is still there */
+int fat_flush(IF_MV_NONVOID(int volume))
+{
+    struct bpb * const fat_bpb = FAT_BPB(volume);
+    if (!fat_bpb)
+        return -1; /* not mounted */
+
+    if (!IS_EXFAT(fat_bpb)) /* nothing is ever written to exFAT */
+        cache_commit(fat_bpb, true);
+
+    return 0;
+}
+
 int fat_unmount(IF_MV_NONVOID(int volume))
 {
     struct bpb * const fat_bpb = FAT_BPB(volume);
@@ -233,4 +233,10 @@ int ata_read_smart(struct ata_smart_values*);
 #define STORAGE_CLOSE
 #endif
 
+/* most sectors the filesystem hands over in one request; the 28-bit commands
+ * only have an 8-bit sector count */
+#ifndef ATA_MAX_TRANSFER_SECTORS
+#define ATA_MAX_TRANSFER_SECTORS 256
+#endif
+
 #endif /* __ATA_H__ */
@@ -617,6 +617,9 @@ Lyre prototype 1 */
 #undef HAVE_MULTIDRIVE
 #undef CONFIG_STORAGE_MULTI
 #undef CONFIG_STORAGE
+#ifdef WARBLE
+#undef HAVE_RECORDING /* the encoders need the kernel */
+#endif
 #endif
 
 #ifndef CONFIG_BUFLIB_BACKEND
@@ -886,6 +889,12 @@ Lyre prototype 1 */
 #error HAVE_MULTIDRIVE needs to have an explicit NUM_DRIVES
 #endif
 
+/* read-only exFAT (for SDXC cards) is opted into by target configs; it is
+   never needed to boot */
+#if defined(BOOTLOADER) && defined(HAVE_EXFATSUPPORT)
+#undef HAVE_EXFATSUPPORT
+#endif
+
 /* note to remove multi-partition booting this could be changed to MULTIDRIVE */
 #if defined(HAVE_BOOTDATA) && defined(BOOT_REDIR) && defined(HAVE_MULTIVOLUME)
 #define HAVE_MULTIBOOT
@@ -123,6 +123,7 @@
 
 /* Rockbox capabilities */
 #define HAVE_FAT16SUPPORT
+#define HAVE_EXFATSUPPORT /* read-only, for SDXC cards */
 #define HAVE_ALBUMART
 #define HAVE_BMP_SCALING
 #define HAVE_JPEG
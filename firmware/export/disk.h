@@ -46,6 +46,7 @@ int disk_mount_all(void); /* returns the # of successful mounts */
 int disk_mount(int drive);
 int disk_unmount_all(void);
 int disk_unmount(int drive);
+void disk_flush_all(void);
 
 /* The number of 512-byte sectors in a "logical" sector. Needed for ipod 5.5G */
 #ifdef MAX_LOG_SECTOR_SIZE
@@ -42,10 +42,22 @@
  ** Values that can be overridden by a target in config-[target].h
  **/
 
-/* if your ATA implementation can do better, go right ahead and increase this
- * value */
+/* upper bound on sectors per storage request; the driver's own limit, see
+ * storage_max_transfer(), applies on top of this */
 #ifndef FAT_MAX_TRANSFER_SIZE
-#define FAT_MAX_TRANSFER_SIZE 256
+#define FAT_MAX_TRANSFER_SIZE 1024
+#endif
+
+/* bytes of the per-volume map that lets the cluster allocator skip groups of
+ * FAT sectors with no free entries */
+#ifndef FAT_FREEMAP_SIZE
+#define FAT_FREEMAP_SIZE 512
+#endif
+
+/* number of contiguous cluster runs an open file remembers for seeking;
+ * each costs 12 bytes per entry of the open file table */
+#ifndef FAT_EXTENT_COUNT
+#define FAT_EXTENT_COUNT 16
 #endif
 
 /**
@@ -60,6 +72,7 @@
  * shouldn't return the last digit as "0", therefore this is unambiguous */
 #define FAT_RC_ENOSPC (-10)
 #define FAT_SEEK_EOF  (-20)
+#define FAT_RC_EROFS  (-30) /* volume can't be written (exFAT) */
 
 /* Number of bytes reserved for a file name (including the trailing \0).
    Since names are stored in the entry as UTF-8, we won't be ble to
@@ -108,6 +121,28 @@ struct fat_file
     long   firstcluster;        /* first cluster in file */
     long   dircluster;          /* first cluster of parent directory */
     struct fat_dirscan_info e;  /* entry information */
+    unsigned int chaingen;      /* changes whenever clusters are freed */
+#ifdef HAVE_EXFATSUPPORT
+    long   contigfirst;         /* firstcluster that contigcount is for */
+    unsigned long contigcount;  /* clusters in a contiguous exFAT file */
+#endif
+};
+
+/* a run of contiguous clusters within a file's cluster chain */
+struct fat_extent
+{
+    long clusternum;            /* cluster number within the file */
+    long cluster;               /* first cluster of the run */
+    long count;                 /* number of clusters in the run */
+};
+
+/* the runs remembered by a file stream, kept outside struct fat_filestr
+   since the many short-lived streams on the stack never seek */
+struct fat_extents
+{
+    int          count;         /* number of runs in runs[] */
+    unsigned int chaingen;      /* chaingen the runs were recorded at */
+    struct fat_extent runs[FAT_EXTENT_COUNT]; /* sorted by clusternum */
 };
 
 /* this stores what was last accessed when read or writing a file's data */
@@ -119,6 +154,7 @@ struct fat_filestr
     long          clusternum;   /* cluster number of last access */
     unsigned long sectornum;    /* sector number within current cluster */
     bool          eof;          /* end-of-file reached */
+    struct fat_extents *extents; /* runs for seeking (NULL = none) */
 };
 
 /** File entity functions **/
@@ -128,8 +164,8 @@ int fat_create_file(struct fat_file *parent, const char *name,
 bool fat_dir_is_parent(const struct fat_file *dir, const struct fat_file *file);
 bool fat_file_is_same(const struct fat_file *file1, const struct fat_file *file2);
 int fat_fstat(struct fat_file *file, struct fat_direntry *entry);
-int fat_open(const struct fat_file *parent, long startcluster,
-             struct fat_file *file);
+int fat_open(const struct fat_file *parent,
+             const struct fat_direntry *fatent, struct fat_file *file);
 int fat_open_rootdir(IF_MV(int volume,) struct fat_file *dir);
 enum fat_remove_op           /* what should fat_remove(), remove? */
 {
@@ -147,6 +183,8 @@ int fat_modtime(struct fat_file *parent, struct fat_file *file,
 int fat_closewrite(struct fat_filestr *filestr, uint32_t size,
                    struct fat_direntry *fatentp);
 void fat_filestr_init(struct fat_filestr *filestr, struct fat_file *file);
+void fat_filestr_set_extents(struct fat_filestr *filestr,
+                             struct fat_extents *extents);
 unsigned long fat_query_sectornum(const struct fat_filestr *filestr);
 long fat_readwrite(struct fat_filestr *filestr, unsigned long sectorcount,
                    void *buf, bool write);
@@ -165,6 +203,7 @@ void fat_rewinddir(struct fat_dirscan_info *scan);
 /** Mounting and unmounting functions **/
 bool fat_ismounted(IF_MV_NONVOID(int volume));
 int fat_mount(IF_MV(int volume,) IF_MD(int drive,) unsigned long startsector);
+int fat_flush(IF_MV_NONVOID(int volume));
 int fat_unmount(IF_MV_NONVOID(int volume));
 
 /** Debug screen stuff **/
@@ -32,6 +32,18 @@
 
 #define SD_BLOCK_SIZE 512 /* XXX : support other sizes ? */
 
+/* most sectors the filesystem hands over in one request; only drivers that
+ * split requests as their controllers require may take more than the
+ * default, since every multi-block command saved is a card command/stop
+ * round trip saved */
+#ifndef SD_MAX_TRANSFER_SECTORS
+#if CONFIG_CPU == AS3525 || CONFIG_CPU == IMX233 || CONFIG_CPU == X1000
+#define SD_MAX_TRANSFER_SECTORS 1024
+#else
+#define SD_MAX_TRANSFER_SECTORS STORAGE_DEFAULT_MAX_TRANSFER
+#endif
+#endif
+
 struct storage_info;
 
 void sd_enable(bool on);
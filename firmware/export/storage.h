@@ -31,6 +31,10 @@
 #define HAVE_HOSTFS
 #endif
 
+/* most sectors the filesystem hands over in one request to drivers that
+ * don't state their own limit */
+#define STORAGE_DEFAULT_MAX_TRANSFER 256
+
 #if (CONFIG_STORAGE & STORAGE_SD)
 #include "sd.h"
 #endif
@@ -165,6 +169,7 @@ static inline void storage_sleep(void) {};
             #define storage_present(drive) hostfs_present(IF_MD(drive))
         #endif
         #define storage_driver_type(drive) hostfs_driver_type(IF_MV(drive))
+        #define storage_max_transfer(drive) (STORAGE_DEFAULT_MAX_TRANSFER)
     #elif (CONFIG_STORAGE & STORAGE_ATA)
         #define STORAGE_FUNCTION(NAME) (ata_## NAME)
         #define storage_spindown(sec) ata_spindown(sec)
@@ -188,6 +193,7 @@ static inline void storage_sleep(void) {};
             #define storage_present(drive) ata_present(IF_MD(drive))
         #endif
         #define storage_driver_type(drive) (STORAGE_ATA_NUM)
+        #define storage_max_transfer(drive) (ATA_MAX_TRANSFER_SECTORS)
     #elif (CONFIG_STORAGE & STORAGE_SD)
         #define STORAGE_FUNCTION(NAME) (sd_## NAME)
         #define storage_spindown(sec) sd_spindown(sec)
@@ -212,6 +218,7 @@ static inline void storage_sleep(void) {};
             #define storage_present(drive) sd_present(IF_MD(drive))
         #endif
         #define storage_driver_type(drive) (STORAGE_SD_NUM)
+        #define storage_max_transfer(drive) (SD_MAX_TRANSFER_SECTORS)
      #elif (CONFIG_STORAGE & STORAGE_MMC)
         #define STORAGE_FUNCTION(NAME) (mmc_## NAME)
         #define storage_spindown(sec) mmc_spindown(sec)
@@ -236,6 +243,7 @@ static inline void storage_sleep(void) {};
             #define storage_present(drive) mmc_present(IF_MD(drive))
         #endif
         #define storage_driver_type(drive) (STORAGE_MMC_NUM)
+        #define storage_max_transfer(drive) (STORAGE_DEFAULT_MAX_TRANSFER)
     #elif (CONFIG_STORAGE & STORAGE_NAND)
         #define STORAGE_FUNCTION(NAME) (nand_## NAME)
         #define storage_spindown(sec) nand_spindown(sec)
@@ -260,6 +268,7 @@ static inline void storage_sleep(void) {};
             #define storage_present(drive) nand_present(IF_MD(drive))
         #endif
         #define storage_driver_type(drive) (STORAGE_NAND_NUM)
+        #define storage_max_transfer(drive) (STORAGE_DEFAULT_MAX_TRANSFER)
     #elif (CONFIG_STORAGE & STORAGE_RAMDISK)
         #define STORAGE_FUNCTION(NAME) (ramdisk_## NAME)
         #define storage_spindown(sec) ramdisk_spindown(sec)
@@ -284,6 +293,7 @@ static inline void storage_sleep(void) {};
             #define storage_present(drive) ramdisk_present(IF_MD(drive))
         #endif
         #define storage_driver_type(drive) (STORAGE_RAMDISK_NUM)
+        #define storage_max_transfer(drive) (STORAGE_DEFAULT_MAX_TRANSFER)
     #elif (CONFIG_STORAGE & STORAGE_USB)
         // TODO:  Eventually fix me
     #else
@@ -312,6 +322,7 @@ bool storage_removable(int drive);
 bool storage_present(int drive);
 #endif
 int storage_driver_type(int drive);
+int storage_max_transfer(int drive);
 
 #endif /* NOT CONFIG_STORAGE_MULTI and NOT SIMULATOR*/
 
@@ -51,6 +51,11 @@
 #define DIRCACHE_MIN     (1024*1024*1) /* 1 MB - provision min size */
 #define DIRCACHE_LIMIT   (1024*1024*6) /* 6 MB - provision max size */
 
+/* directories with at least this many entries get a name hash to speed up
+   path lookups; only so many are kept at once (least recently used go) */
+#define DIRCACHE_HASH_MIN   64
+#define DIRCACHE_HASH_DIRS  16
+
 /* make it easy to change serialnumber size without modifying anything else;
    32 bits allows 21845 builds before wrapping in a 6MB cache that is filled
    exclusively with entries and nothing else (32 byte entries), making that
@@ -75,6 +80,9 @@ typedef uint32_t dc_serial_t;
 #if CONFIG_PLATFORM & PLATFORM_NATIVE
 /* native dircache is lower-level than on a hosted target */
 #define DIRCACHE_NATIVE
+/* the cache may be saved at shutdown and revalidated against the volumes at
+   boot instead of being rebuilt from nothing */
+#define DIRCACHE_SNAPSHOT
 #endif
 
 struct dircache_file
@@ -123,6 +131,10 @@ struct fat_direntry;
 int dircache_readdir_internal(struct filestr_base *stream,
                               struct file_base_info *infop,
                               struct fat_direntry *fatent);
+int dircache_findname_internal(struct filestr_base *stream,
+                               struct file_base_info *infop,
+                               struct fat_direntry *fatent,
+                               const char *name);
 void dircache_rewinddir_internal(struct file_base_info *info);
 #endif /* DIRCACHE_NATIVE */
 
@@ -171,6 +183,8 @@ enum dircache_search_flags
 
 int dircache_search(unsigned int flags, struct dircache_fileref *dcfrefp,
                     const char *path);
+int dircache_search_name(const struct dircache_fileref *dirrefp,
+                         const char *name, struct dircache_fileref *dcfrefp);
 
 int dircache_fileref_cmp(const struct dircache_fileref *dcfrefp1,
                          const struct dircache_fileref *dcfrefp2);
@@ -201,10 +215,10 @@ void dircache_dump(void);
 /** Misc. stuff **/
 void dircache_dcfile_init(struct dircache_file *dcfilep);
 
-#ifdef HAVE_EEPROM_SETTINGS
+#ifdef DIRCACHE_SNAPSHOT
 int dircache_load(void);
 int dircache_save(void);
-#endif /* HAVE_EEPROM_SETTINGS */
+#endif /* DIRCACHE_SNAPSHOT */
 
 void dircache_init(size_t last_size) INIT_ATTR;
 
@@ -279,6 +279,19 @@ static inline int readdir_internal(struct filestr_base *stream,
 #endif
 }
 
+static inline int findname_internal(struct filestr_base *stream,
+                                    struct file_base_info *infop,
+                                    struct fat_direntry *fatent,
+                                    const char *name)
+{
+#ifdef HAVE_DIRCACHE
+    return dircache_findname_internal(stream, infop, fatent, name);
+#else
+    (void)stream; (void)infop; (void)fatent; (void)name;
+    return -1; /* no quick way; scan for it */
+#endif
+}
+
 static inline void rewinddir_internal(struct file_base_info *infop)
 {
 #ifdef HAVE_DIRCACHE
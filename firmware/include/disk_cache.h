@@ -38,6 +38,8 @@ static inline void dc_unlock_cache(void)
 
 void * dc_cache_probe(IF_MV(int volume,) unsigned long secnum,
                       unsigned int *flags);
+void dc_cache_fill(IF_MV(int volume,) unsigned long secnum, unsigned int count,
+                   const void *buf);
 void dc_dirty_buf(void *buf);
 void dc_discard_buf(void *buf);
 void dc_commit_all(IF_MV_NONVOID(int volume));
@@ -45,13 +47,25 @@ void dc_discard_all(IF_MV_NONVOID(int volume));
 
 void dc_init(void) INIT_ATTR;
 
-/* in addition to filling, writeback is implemented by the client */
+/* in addition to filling, writeback is implemented by the client; bufs
+   holds count buffers for consecutive sectors starting at sector */
 extern void dc_writeback_callback(IF_MV(int volume, ) unsigned long sector,
-                                  void *buf);
+                                  unsigned int count, void * const *bufs);
 
 
 /** These synchronize and can be called by anyone **/
 
+struct dc_stats
+{
+    unsigned long hits;          /* probes that found the sector */
+    unsigned long misses;        /* probes that had to read it */
+    unsigned long prefetched;    /* sectors added by readahead */
+    unsigned long prefetch_hits; /* readahead sectors used afterwards */
+};
+
+/* copy out the cache's counters */
+void dc_get_stats(struct dc_stats *stats);
+
 /* expropriate a buffer from the cache of DC_CACHE_BUFSIZE bytes */
 void * dc_get_buffer(void);
 /* return buffer to the cache by buffer */
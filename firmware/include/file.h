@@ -76,6 +76,9 @@ int fdprintf(int fildes, const char *fmt, ...) ATTRIBUTE_PRINTF(2, 3);
 #ifndef read
 #define read            FS_PREFIX(read)
 #endif
+#ifndef readv
+#define readv           FS_PREFIX(readv)
+#endif
 #ifndef write
 #define write           FS_PREFIX(write)
 #endif
@@ -310,6 +310,11 @@ static inline void file_internal_unlock_WRITER(void)
         FILE_SET_CODE(rc, RC, (_rc));          \
         goto file_error; })
 
+/* errno for a failed FAT call; some of its return codes mean more than EIO */
+#define FAT_RC_ERRNO(_rc) \
+    ((_rc) == FAT_RC_ENOSPC ? ENOSPC : \
+     (_rc) == FAT_RC_EROFS  ? EROFS  : EIO)
+
 /* set errno and return a value at the point of invocation */
 #define FILE_ERROR_RETURN(_errno, _rc...) \
     ({ FILE_SET_CODE(errno, ERRNO, _errno); \
@@ -45,6 +45,14 @@
 
 #include <time.h>
 
+#define IOV_MAX 16
+
+struct iovec
+{
+    void   *iov_base;
+    size_t iov_len;
+};
+
 int     open(const char *name, int oflag);
 int     creat(const char *name);
 int     close(int fildes);
@@ -52,6 +60,7 @@ int     ftruncate(int fildes, off_t length);
 int     fsync(int fildes);
 off_t   lseek(int fildes, off_t offset, int whence);
 ssize_t read(int fildes, void *buf, size_t nbyte);
+ssize_t readv(int fildes, const struct iovec *iov, int iovcnt);
 ssize_t write(int fildes, const void *buf, size_t nbyte);
 int     remove(const char *path);
 int     rename(const char *old, const char *new);
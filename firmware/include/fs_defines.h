@@ -100,13 +100,36 @@
  * volumes that would slow cache probing. IOC_MAP_NUM_ENTRIES is the number
  * for each map per volume. The buffers themselves are shared.
  */
+#ifndef DC_NUM_ENTRIES
 #if MEMORYSIZE < 8
 #define DC_NUM_ENTRIES      32
 #define DC_MAP_NUM_ENTRIES  128
-#else
+#elif MEMORYSIZE < 32
 #define DC_NUM_ENTRIES      64
 #define DC_MAP_NUM_ENTRIES  256
+#elif MEMORYSIZE < 64
+#define DC_NUM_ENTRIES      128
+#define DC_MAP_NUM_ENTRIES  512
+#else
+#define DC_NUM_ENTRIES      256
+#define DC_MAP_NUM_ENTRIES  1024
+#endif /* MEMORYSIZE */
+#endif /* DC_NUM_ENTRIES */
+
+/* Number of sectors read in one go when a FAT or directory sector misses the
+ * cache; the ones after it are added to the cache since FAT chains and
+ * directories are mostly read in order. Each miss may then evict this many
+ * entries, so it must stay well below DC_NUM_ENTRIES. 1 disables readahead.
+ */
+#ifndef DC_READAHEAD_SECTORS
+#if MEMORYSIZE < 8
+#define DC_READAHEAD_SECTORS 1
+#elif MEMORYSIZE < 32
+#define DC_READAHEAD_SECTORS 4
+#else
+#define DC_READAHEAD_SECTORS 8
 #endif /* MEMORYSIZE */
+#endif /* DC_READAHEAD_SECTORS */
 
 /* this _could_ be larger than a sector if that would ever be useful */
 #define DC_CACHE_BUFSIZE    SECTOR_SIZE
@@ -27,6 +27,9 @@
 #include "adc.h"
 #include "string.h"
 #include "storage.h"
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+#include "disk.h"
+#endif
 #include "power.h"
 #include "audio.h"
 #include "usb.h"
@@ -825,6 +828,11 @@ void shutdown_hw(enum shutdown_type sd_type)
     if (battery_level_safe()) { /* do not save on critical battery */
         font_unload_all();
 
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+        /* write the free space hints that are held back during use */
+        disk_flush_all();
+#endif
+
 /* Commit pending writes if needed. Even though we don't do write caching,
    things like flash translation layers may need this to commit scattered
    pages to their final locations. So far only used for iPod Nano 2G. */
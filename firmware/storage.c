@@ -446,6 +446,27 @@ int storage_driver_type(int drive)
     return bit ? find_first_set_bit(bit) : -1;
 }
 
+int storage_max_transfer(int drive)
+{
+    if ((unsigned int)drive >= num_drives)
+        return STORAGE_DEFAULT_MAX_TRANSFER;
+
+    switch ((storage_drivers[drive] & DRIVER_MASK)>>DRIVER_OFFSET)
+    {
+#if (CONFIG_STORAGE & STORAGE_ATA)
+    case STORAGE_ATA:
+        return ATA_MAX_TRANSFER_SECTORS;
+#endif
+
+#if (CONFIG_STORAGE & STORAGE_SD)
+    case STORAGE_SD:
+        return SD_MAX_TRANSFER_SECTORS;
+#endif
+    }
+
+    return STORAGE_DEFAULT_MAX_TRANSFER;
+}
+
 void storage_enable(bool on)
 {
 #if (CONFIG_STORAGE & STORAGE_ATA)
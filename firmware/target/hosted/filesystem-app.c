@@ -291,6 +291,11 @@ ssize_t app_read(int fd, void *buf, size_t nbyte)
     return os_read(fd, buf, nbyte);
 }
 
+ssize_t app_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    return os_readv(fd, iov, iovcnt);
+}
+
 ssize_t app_write(int fd, const void *buf, size_t nbyte)
 {
     return os_write(fd, buf, nbyte);
@@ -75,9 +75,11 @@ int     app_creat(const char *name, mode_t mode);
 #define app_lseek       os_lseek
 #ifdef HAVE_SDL_THREADS
 ssize_t app_read(int fildes, void *buf, size_t nbyte);
+ssize_t app_readv(int fildes, const struct iovec *iov, int iovcnt);
 ssize_t app_write(int fildes, const void *buf, size_t nbyte);
 #else
 #define app_read        os_read
+#define app_readv       os_readv
 #define app_write       os_write
 #endif /* HAVE_SDL_THREADS */
 int     app_remove(const char *path);
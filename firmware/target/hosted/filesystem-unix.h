@@ -32,6 +32,7 @@
 #define _FILESYSTEM_UNIX__FILE_H_
 
 #include <unistd.h>
+#include <sys/uio.h>
 
 #define OS_STAT_T       struct stat
 
@@ -52,6 +53,9 @@
 #ifndef os_read
 #define os_read         read
 #endif
+#ifndef os_readv
+#define os_readv        readv
+#endif
 #ifndef os_write
 #define os_write        write
 #endif
@@ -48,6 +48,14 @@ size_t strlcpy_ucs2utf8(char *buffer, const unsigned short *ucs,
 
 #define OS_STAT_T       struct _stat
 
+#define IOV_MAX 16
+
+struct iovec
+{
+    void   *iov_base;
+    size_t iov_len;
+};
+
 #ifndef OSFUNCTIONS_DECLARED
 /* Wrap for off_t <=> long conversions */
 static inline off_t os_filesize_(int osfd)
@@ -68,6 +76,28 @@ static inline int os_ftruncate_(int osfd, off_t length)
 #define os_write        write
 #endif
 
+#ifndef os_readv
+/* No native readv(); stop at the first short read like the real thing */
+static inline ssize_t os_readv_(int osfd, const struct iovec *iov,
+                                int iovcnt)
+{
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        ssize_t rc = os_read(osfd, iov[i].iov_base, iov[i].iov_len);
+        if (rc < 0)
+            return total ?: rc;
+
+        total += rc;
+        if ((size_t)rc < iov[i].iov_len)
+            break;
+    }
+    return total;
+}
+
+#define os_readv        os_readv_
+#endif
+
 /* These need string type conversion from utf8 to ucs2; that's done inside */
 int os_open(const char *ospath, int oflag, ...);
 int os_creat(const char *ospath, mode_t mode);
@@ -52,4 +52,24 @@ ssize_t os_sdl_readwrite(int osfd, void *buf, size_t nbyte, bool dowrite)
     return rc;
 }
 
+/* Each segment goes through the above so other threads still get a turn */
+ssize_t os_sdl_readv(int osfd, const struct iovec *iov, int iovcnt)
+{
+    ssize_t total = 0;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        ssize_t rc = os_sdl_readwrite(osfd, iov[i].iov_base, iov[i].iov_len,
+                                      false);
+        if (rc < 0)
+            return total ?: rc;
+
+        total += rc;
+        if ((size_t)rc < iov[i].iov_len)
+            break;
+    }
+
+    return total;
+}
+
 #endif /* HAVE_SDL_THREADS */
@@ -24,13 +24,17 @@
 #ifdef HAVE_SDL_THREADS
 #undef os_read
 #undef os_write
+#undef os_readv
 
+struct iovec;
 ssize_t os_sdl_readwrite(int osfd, void *buf, size_t nbyte, bool dowrite);
+ssize_t os_sdl_readv(int osfd, const struct iovec *iov, int iovcnt);
 
 #define os_read(osfd, buf, nbyte) \
     os_sdl_readwrite((osfd), (buf), (nbyte), false)
 #define os_write(osfd, buf, nbyte) \
     os_sdl_readwrite((osfd), (void *)(buf), (nbyte), true)
+#define os_readv        os_sdl_readv
 
 #endif /* HAVE_SDL_THREADS */
 
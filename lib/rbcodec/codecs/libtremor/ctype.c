@@ -1,4 +1,4 @@
 #include "config.h"
-#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE) && !defined(__PCTOOL__)
 #include "libc/ctype.c"
 #endif
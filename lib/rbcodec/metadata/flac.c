@@ -82,6 +82,13 @@ bool get_flac_metadata(int fd, struct mp3entry* id3)
             id3->filesize = filesize(fd);
             id3->frequency = (buf[10] << 12) | (buf[11] << 4)
                 | ((buf[12] & 0xf0) >> 4);
+
+            if (id3->frequency == 0)
+            {
+                logf("flac sample rate invalid!");
+                return false;
+            }
+
             rc = true;  /* Got vital metadata */
 
             /* totalsamples is a 36-bit field, but we assume <= 32 bits are used */
@@ -91,7 +98,8 @@ bool get_flac_metadata(int fd, struct mp3entry* id3)
             {
                 /* Calculate track length (in ms) and estimate the bitrate (in kbit/s) */
                 id3->length = ((int64_t) totalsamples * 1000) / id3->frequency;
-                id3->bitrate = (id3->filesize * 8) / id3->length;
+                id3->bitrate = id3->length ?
+                    (id3->filesize * 8) / id3->length : 0;
             }
             else if (totalsamples == 0)
             {
@@ -446,7 +446,14 @@ bool get_metadata(struct mp3entry* id3, int fd, const char* trackname)
         return false;
     }
 
-    if (!entry->parse_func(fd, id3))
+    /* Parse from a block read up front rather than many small reads */
+    bool block = metadata_block_acquire(fd);
+    bool parsed = entry->parse_func(fd, id3);
+
+    if (block)
+        metadata_block_release();
+
+    if (!parsed)
     {
         DEBUGF("parsing %s failed (format: %s)\n", trackname, entry->label);
         return false;
@@ -0,0 +1,190 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#include <stdio.h>
+#include "string-extra.h"
+#include "platform.h"
+#include "metadata.h"
+
+/* NOTE: this file must not include metadata_common.h, which redirects read()
+   here */
+
+/* The start of the file is read in one go when parsing begins and the
+   parsers' many small reads are then served from memory. A small read
+   elsewhere, such as a tag at the end of the file, loads a window around it
+   instead; larger reads go to the file. The file position is always kept up
+   to date, so code that reads the file directly still sees what it expects.
+
+   The buffers are static: 72 KiB of RAM, or 24 KiB on targets with up to
+   8 MiB. They can't be borrowed per call from core_alloc() as the buffering
+   thread parses during playback, when getting the memory would mean
+   shrinking the audio buffer, which restarts playback. Targets with 2 MiB
+   can't spare even 24 KiB and read the file directly. */
+#if defined(MEMORYSIZE) && MEMORYSIZE <= 2
+#define METADATA_BLOCK_SIZE     0
+#elif defined(MEMORYSIZE) && MEMORYSIZE <= 8
+#define METADATA_BLOCK_SIZE     (16*1024)
+#else
+#define METADATA_BLOCK_SIZE     (64*1024)
+#endif
+#define METADATA_WINDOW_SIZE    (4*1024)
+
+#if METADATA_BLOCK_SIZE == 0
+bool metadata_block_acquire(int fd)
+{
+    (void)fd;
+    return false;
+}
+
+void metadata_block_release(void)
+{
+}
+
+ssize_t metadata_read(int fd, void *buf, size_t count)
+{
+    return read(fd, buf, count);
+}
+#else /* METADATA_BLOCK_SIZE > 0 */
+
+#ifndef STORAGE_ALIGN_ATTR
+#define STORAGE_ALIGN_ATTR
+#endif
+
+struct metadata_buf
+{
+    unsigned char *buf;
+    off_t start;    /* file offset of the data */
+    long  len;      /* bytes of valid data */
+};
+
+static unsigned char head_buf[METADATA_BLOCK_SIZE] STORAGE_ALIGN_ATTR;
+static unsigned char window_buf[2*METADATA_WINDOW_SIZE] STORAGE_ALIGN_ATTR;
+
+static int block_fd = -1;   /* file being parsed (-1 = free) */
+static struct metadata_buf head   = { .buf = head_buf,   .start = -1 };
+static struct metadata_buf window = { .buf = window_buf, .start = -1 };
+
+/* fill a buffer from 'start'; returns false on error */
+static bool buf_fill(struct metadata_buf *b, int fd, off_t start, long len)
+{
+    b->start = -1;
+    b->len   = 0;
+
+    if (lseek(fd, start, SEEK_SET) != start)
+        return false;
+
+    ssize_t n = read(fd, b->buf, len);
+    if (n < 0)
+        return false;
+
+    b->start = start;
+    b->len   = n;
+    return true;
+}
+
+/* copy from a buffer if it holds all of the read or all that's left of the
+   file; returns the amount copied or -1 if it doesn't */
+static ssize_t buf_copy(const struct metadata_buf *b, off_t pos,
+                        void *dst, size_t count)
+{
+    off_t end = b->start + b->len;
+
+    if (pos < b->start || pos > end)
+        return -1;
+
+    if (pos + (off_t)count > end)
+    {
+        /* a short fill means the end of the file was reached */
+        if (b->buf == head_buf ? b->len == METADATA_BLOCK_SIZE :
+                                 b->len == 2*METADATA_WINDOW_SIZE)
+            return -1;
+
+        count = end - pos;
+    }
+
+    memcpy(dst, b->buf + (pos - b->start), count);
+    return count;
+}
+
+/*
+ * Claim the buffers for parsing 'fd' and read the start of the file.
+ * Returns false if another thread is using them, in which case reads go to
+ * the file as usual.
+ */
+bool metadata_block_acquire(int fd)
+{
+    /* threads are switched only when they block, so this needs no lock */
+    if (block_fd >= 0)
+        return false;
+
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return false;
+
+    block_fd = fd;
+    window.start = -1;
+    window.len = 0;
+
+    if (!buf_fill(&head, fd, 0, METADATA_BLOCK_SIZE))
+        block_fd = -1;
+
+    lseek(fd, pos, SEEK_SET);
+    return block_fd >= 0;
+}
+
+void metadata_block_release(void)
+{
+    block_fd = -1;
+    head.start = window.start = -1;
+    head.len = window.len = 0;
+}
+
+/*
+ * read() for the metadata parsers
+ */
+ssize_t metadata_read(int fd, void *buf, size_t count)
+{
+    if (fd != block_fd || count > METADATA_WINDOW_SIZE)
+        return read(fd, buf, count);
+
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return read(fd, buf, count);
+
+    ssize_t n = buf_copy(&head, pos, buf, count);
+    if (n < 0)
+        n = buf_copy(&window, pos, buf, count);
+
+    if (n < 0)
+    {
+        /* the aligned window always holds the whole read if the file does */
+        if (!buf_fill(&window, fd, pos & ~(off_t)(METADATA_WINDOW_SIZE-1),
+                      2*METADATA_WINDOW_SIZE))
+            return -1;
+
+        n = buf_copy(&window, pos, buf, count);
+        if (n < 0)
+            n = 0; /* beyond the end */
+    }
+
+    if (lseek(fd, pos + n, SEEK_SET) < 0)
+        return -1;
+
+    return n;
+}
+#endif /* METADATA_BLOCK_SIZE */
@@ -35,6 +35,14 @@
 
 enum tagtype { TAGTYPE_APE = 1, TAGTYPE_VORBIS };
 
+/* Reads of the file being parsed are served from a block of it loaded by
+   get_metadata(); see metadata_block.c */
+bool metadata_block_acquire(int fd);
+void metadata_block_release(void);
+ssize_t metadata_read(int fd, void *buf, size_t count);
+#undef read
+#define read metadata_read
+
 bool read_ape_tags(int fd, struct mp3entry* id3);
 long read_vorbis_tags(int fd, struct mp3entry *id3,
     long tag_remaining);
@@ -41,6 +41,7 @@
 
 #include "metadata.h"
 #include "metadata/metadata_parsers.h"
+#include "metadata/metadata_common.h"
 
 //#define DEBUG_VERBOSE
 
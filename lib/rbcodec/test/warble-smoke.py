@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#             __________               __   ___.
+#   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+#   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+#   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+#   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+#                     \/            \/     \/    \/            \/
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+# KIND, either express or implied.
+#
+# Smoke test for the metadata parsers through "warble -m", using a handful of
+# tiny generated files, well-formed and broken. A parser that crashes or
+# hangs fails the test, as does one that gets a good file wrong.
+#
+#   warble-smoke.py path/to/warble.<target>
+#
+# The same files make a seed corpus for the WARBLE_FUZZ build:
+#
+#   warble-smoke.py --seeds DIR
+#   ./warble.<target> DIR
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+
+# must match the order of ext[] in LLVMFuzzerTestOneInput() in warble.c
+FUZZ_EXT = ["mp3", "mp2", "mp1", "aiff", "wav", "ogg", "flac"]
+
+TITLE = "Smoke Test"
+
+
+def wav(frames):
+    data = bytes(frames * 4)
+    fmt = struct.pack("<HHIIHH", 1, 2, 44100, 44100 * 4, 4, 16)
+    return (b"RIFF" + struct.pack("<I", 36 + len(data)) + b"WAVE" +
+            b"fmt " + struct.pack("<I", len(fmt)) + fmt +
+            b"data" + struct.pack("<I", len(data)) + data)
+
+
+def syncsafe(n):
+    return bytes([(n >> 21) & 0x7f, (n >> 14) & 0x7f, (n >> 7) & 0x7f, n & 0x7f])
+
+
+def id3v2(title, claimed=None):
+    text = b"\0" + title.encode("latin-1")
+    frame = b"TIT2" + struct.pack(">I", len(text)) + b"\0\0" + text
+    size = len(frame) if claimed is None else claimed
+    return b"ID3\3\0\0" + syncsafe(size) + frame
+
+
+def mp3(frames):
+    # MPEG-1 layer III, 128 kbit/s, 44.1 kHz: 417 byte frames
+    return b"".join(b"\xff\xfb\x90\x00" + bytes(413) for _ in range(frames))
+
+
+def flac(title, rate=44100, samples=44100):
+    # block sizes, unknown frame sizes, then rate, 2 channels, 16 bits,
+    # sample count and an empty MD5
+    info = struct.pack(">HH", 4096, 4096) + bytes(6)
+    info += struct.pack(">Q", (rate << 44) | (1 << 41) | (15 << 36) | samples)
+    info += bytes(16)
+    vendor = b"smoke"
+    comment = ("TITLE=" + title).encode("utf-8")
+    vc = (struct.pack("<I", len(vendor)) + vendor + struct.pack("<I", 1) +
+          struct.pack("<I", len(comment)) + comment)
+    return (b"fLaC" + bytes([0x00]) + struct.pack(">I", len(info))[1:] +
+            info + bytes([0x84]) + struct.pack(">I", len(vc))[1:] + vc +
+            b"\xff\xf8" + bytes(64))
+
+
+# name, contents, whether parsing should succeed, title it should find
+CASES = [
+    ("good.wav", wav(4410), True, None),
+    ("good.mp3", id3v2(TITLE) + mp3(20), True, TITLE),
+    ("good.flac", flac(TITLE), True, TITLE),
+    ("empty.mp3", b"", False, None),
+    ("empty.flac", b"", False, None),
+    ("short.wav", wav(0)[:20], False, None),
+    ("tagonly.mp3", id3v2(TITLE, claimed=0x0fffffff), False, None),
+    ("garbage.mp3", bytes(range(256)) * 16, False, None),
+    ("header.flac", b"fLaC", False, None),
+    ("norate.flac", flac(TITLE, rate=0), False, None),
+    ("onesample.flac", flac(TITLE, samples=1), True, TITLE),
+]
+
+
+def write_seeds(directory):
+    os.makedirs(directory, exist_ok=True)
+    for name, data, _, _ in CASES:
+        ext = name.rsplit(".", 1)[1]
+        with open(os.path.join(directory, name), "wb") as f:
+            f.write(bytes([FUZZ_EXT.index(ext)]) + data)
+    return 0
+
+
+def run(warble):
+    failed = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, data, good, title in CASES:
+            path = os.path.join(tmp, name)
+            with open(path, "wb") as f:
+                f.write(data)
+
+            p = subprocess.run([warble, "-m", "-v", "-t", "5", path],
+                               stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                               universal_newlines=True)
+
+            if p.returncode < 0 or p.returncode > 1:
+                problem = "crashed or hung (%d)" % p.returncode
+            elif (p.returncode == 0) != good:
+                problem = "parsed" if p.returncode == 0 else "didn't parse"
+            elif title and ("Title: %s\n" % title) not in p.stdout:
+                problem = "didn't find the title"
+            else:
+                problem = None
+
+            print("%-6s %s%s" % ("FAIL" if problem else "ok", name,
+                                 ": " + problem if problem else ""))
+            if problem:
+                sys.stdout.write(p.stdout + p.stderr)
+                failed += 1
+
+    print("%d of %d failed" % (failed, len(CASES)))
+    return 1 if failed else 0
+
+
+def main(args):
+    if len(args) == 2 and args[0] == "--seeds":
+        return write_seeds(args[1])
+    if len(args) == 1:
+        return run(args[0])
+    sys.stderr.write("usage: %s WARBLE | --seeds DIR\n" % sys.argv[0])
+    return 2
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
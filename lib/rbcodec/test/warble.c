@@ -25,11 +25,13 @@
 #include <endian.h>
 #include <fcntl.h>
 #include <math.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include "buffering.h" /* TYPE_PACKET_AUDIO */
 #include "kernel.h"
@@ -754,6 +756,179 @@ static void print_mp3entry(const struct mp3entry *id3, FILE *f)
     if (id3->mb_track_id) fprintf(f, "Musicbrainz track ID: %s\n", id3->mb_track_id);
 }
 
+/***************** METADATA *****************/
+
+/* The I/O of the metadata parsers is counted by linking with
+   -Wl,--wrap=read,--wrap=lseek (see warble.make), which sends the calls made
+   by warble and librbcodec through these wrappers but leaves the codecs
+   alone. Only the file being parsed is counted. */
+ssize_t __real_read(int fd, void *buf, size_t count);
+off_t __real_lseek(int fd, off_t offset, int whence);
+
+static struct {
+    int fd;             /* file being counted (-1 = none) */
+    off_t next;         /* file offset just after the last read */
+    long bytes;         /* bytes read */
+    long reads;         /* read() calls that went to the file */
+    long seeks;         /* reads that didn't follow on from the last one */
+} io = { .fd = -1 };
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+    if (fd != io.fd)
+        return __real_read(fd, buf, count);
+
+    off_t pos = __real_lseek(fd, 0, SEEK_CUR);
+    if (pos != io.next)
+        io.seeks++;
+
+    ssize_t n = __real_read(fd, buf, count);
+    if (n > 0) {
+        io.bytes += n;
+        io.next = pos + n;
+    }
+    io.reads++;
+    return n;
+}
+
+off_t __wrap_lseek(int fd, off_t offset, int whence)
+{
+    /* a seek only costs anything if the next read is elsewhere, which
+       __wrap_read notices */
+    return __real_lseek(fd, offset, whence);
+}
+
+static bool parse_counted(struct mp3entry *id3, int fd, const char *fn)
+{
+    io.fd = fd;
+    io.next = 0;
+    io.bytes = io.reads = io.seeks = 0;
+    __real_lseek(fd, 0, SEEK_SET);
+    bool ok = get_metadata(id3, fd, fn);
+    io.fd = -1;
+    return ok;
+}
+
+#ifdef WARBLE_FUZZ
+/* Entry point for libFuzzer. The first byte picks the format, since the
+   parsers are chosen by file name, and the rest is the file. AFL can use
+   the same build through its libFuzzer driver. */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static const char * const ext[] = {
+        "mp3", "mp2", "mp1", "aiff", "wav", "ogg", "flac", "mpc", "a52",
+        "wv", "m4a", "mp4", "shn", "sid", "adx", "nsf", "spx", "spc", "ape",
+        "wma", "mod", "sap", "rm", "cmc", "oma", "mmf", "au", "vox", "w64",
+        "tta", "ay", "vtx", "gbs", "hes", "sgc", "vgm", "kss", "opus", "aac",
+    };
+    static int fd = -1;
+    char fn[16];
+    struct mp3entry id3;
+
+    if (size < 1)
+        return 0;
+
+    if (fd < 0) {
+        FILE *f = tmpfile();
+        if (!f)
+            abort();
+        fd = fileno(f);
+    }
+
+    snprintf(fn, sizeof(fn), "fuzz.%s", ext[data[0] % ARRAYLEN(ext)]);
+    data++, size--;
+
+    if (ftruncate(fd, 0) < 0 ||
+        pwrite(fd, data, size, 0) != (ssize_t)size)
+        abort();
+
+    memset(&id3, 0, sizeof(id3));
+    parse_counted(&id3, fd, fn);
+    return 0;
+}
+#endif /* WARBLE_FUZZ */
+
+static const char *meta_current;
+
+static void timeout_handler(int sig)
+{
+    /* a parser that doesn't finish is as much a bug as one that crashes */
+    static const char msg[] = "error: timed out parsing ";
+    (void)sig;
+    write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    write(STDERR_FILENO, meta_current, strlen(meta_current));
+    write(STDERR_FILENO, "\n", 1);
+    _exit(2);
+}
+
+static double elapsed(const struct timespec *t0)
+{
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* Parse the metadata of each file and print what it cost. One line is
+   printed per file, so a corpus can be compared before and after a change
+   by sorting and diffing the output. */
+static int parse_files(char **files, int count, int timeout, bool verbose)
+{
+    struct timespec t0;
+    long total_bytes = 0, total_reads = 0, total_seeks = 0, total_size = 0;
+    int failed = 0;
+    double total_time = 0;
+
+    signal(SIGALRM, timeout_handler);
+    printf("%-6s %10s %10s %6s %6s %9s  %s\n",
+           "result", "size", "read", "reads", "seeks", "ms", "file");
+
+    for (int i = 0; i < count; i++) {
+        struct mp3entry id3;
+        int fd = open(files[i], O_RDONLY);
+        if (fd < 0) {
+            perror(files[i]);
+            failed++;
+            continue;
+        }
+
+        long size = filesize(fd);
+        meta_current = files[i];
+        fflush(stdout);
+        alarm(timeout);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        bool ok = parse_counted(&id3, fd, files[i]);
+        double t = elapsed(&t0);
+        alarm(0);
+
+        printf("%-6s %10ld %10ld %6ld %6ld %9.3f  %s\n",
+               ok ? "ok" : "failed", size, io.bytes, io.reads, io.seeks,
+               t * 1000, files[i]);
+        if (ok && verbose)
+            print_mp3entry(&id3, stdout);
+
+        failed += !ok;
+        total_size += size;
+        total_bytes += io.bytes;
+        total_reads += io.reads;
+        total_seeks += io.seeks;
+        total_time += t;
+        close(fd);
+    }
+
+    if (count > 0) {
+        printf("%d files, %d failed, %.1f files/s\n"
+               "read %ld of %ld bytes (%.2f%%), %.1f MB/s, "
+               "%.1f reads and %.1f seeks per file\n",
+               count, failed, total_time > 0 ? count / total_time : 0,
+               total_bytes, total_size,
+               total_size > 0 ? 100.0 * total_bytes / total_size : 0,
+               total_time > 0 ? total_bytes / total_time / 1e6 : 0,
+               (double)total_reads / count, (double)total_seeks / count);
+    }
+
+    return failed ? 1 : 0;
+}
+
 static void decode_file(const char *input_fn)
 {
     /* Initialize DSP before any sort of interaction */
@@ -838,6 +1013,7 @@ static void print_help(const char *progname)
     fprintf(stderr, "Usage:\n"
                     "        Play: %s [options] INPUTFILE\n"
                     "Write to WAV: %s [options] INPUTFILE OUTPUTFILE\n"
+                    "    Metadata: %s -m [-t sec] [-v] INPUTFILE...\n"
                     "\n"
                     "general options:\n"
                     "  -c a=1:b=2    Configuration (see below)\n"
@@ -847,6 +1023,12 @@ static void print_help(const char *progname)
                     "  -f            Write raw codec output converted to 64-bit float\n"
                     "  -r            Write raw 32-bit codec output without WAV header\n"
                     "\n"
+                    "metadata options:\n"
+                    "  -m            Only parse metadata and report bytes read, reads,\n"
+                    "                seeks and time per file, then totals\n"
+                    "  -t <n>        Give up on a file after <n> seconds [10]\n"
+                    "  -v            Print the parsed metadata too\n"
+                    "\n"
                     "configuration:\n"
                     "  dither=<0|1>  Enable/disable dithering [0]\n"
                     "  halt=<0|1>    Stop decoding if 1 [0]\n"
@@ -864,13 +1046,23 @@ static void print_help(const char *progname)
                     "  %s in.adx -c loop=1:wait=44100:halt=1\n"
                     "  # Lower pitch 1 octave and write to out.wav\n"
                     "  %s in.ogg -c rate=0.5:tempo=2 out.wav\n"
-                    , progname, progname, progname, progname);
+                    "  # Measure metadata parsing over a collection\n"
+                    "  find music -type f -print0 | xargs -0 %s -m\n"
+                    , progname, progname, progname, progname, progname, progname);
 }
 
+#ifdef WARBLE_FUZZ
+/* libFuzzer brings its own main() */
+#define main warble_main
+int main(int argc, char **argv);
+#endif
+
 int main(int argc, char **argv)
 {
+    bool meta_only = false, meta_verbose = false;
+    int meta_timeout = 10;
     int opt;
-    while ((opt = getopt(argc, argv, "c:fhr")) != -1) {
+    while ((opt = getopt(argc, argv, "c:fhmrt:v")) != -1) {
         switch (opt) {
         case 'c':
             config = optarg;
@@ -878,10 +1070,19 @@ int main(int argc, char **argv)
         case 'f':
             use_dsp = false;
             break;
+        case 'm':
+            meta_only = true;
+            break;
         case 'r':
             use_dsp = false;
             write_raw = true;
             break;
+        case 't':
+            meta_timeout = atoi(optarg);
+            break;
+        case 'v':
+            meta_verbose = true;
+            break;
         case 'h': /* fallthrough */
         default:
             print_help(argv[0]);
@@ -889,6 +1090,15 @@ int main(int argc, char **argv)
         }
     }
 
+    if (meta_only) {
+        if (optind >= argc) {
+            print_help(argv[0]);
+            exit(1);
+        }
+        return parse_files(&argv[optind], argc - optind, meta_timeout,
+                           meta_verbose);
+    }
+
     if (argc == optind + 2) {
         write_init(argv[optind + 1]);
     } else if (argc == optind + 1) {
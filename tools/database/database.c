@@ -6,6 +6,7 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "config.h"
 #include "tagcache.h"
@@ -14,6 +15,14 @@
 /* This is meant to be run on the root of the dap. it'll put the db files into
  * a .rockbox subdir */
 
+static long elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000
+           + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
 int main(int argc, char **argv)
 {
     (void)argc;
@@ -32,15 +41,36 @@ int main(int argc, char **argv)
     /* / is actually ., will get translated in io.c
      * (with the help of sim_root_dir below */
     const char *paths[] = { "/", NULL };
+    struct timespec start;
+    long build_ms, total_ms;
+    struct tagcache_search tcs;
+    int entries = 0;
+
     tagcache_init();
 
     fprintf(stderr, "Scanning files (make take some time)...");
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
     do_tagcache_build(paths);
+    build_ms = elapsed_ms(&start);
     tagcache_reverse_scan();
+    total_ms = elapsed_ms(&start);
 
     fprintf(stderr, "...done!\n");
 
+    if (tagcache_search(&tcs, tag_filename))
+    {
+        entries = tcs.entry_count;
+        tagcache_search_finish(&tcs);
+    }
+
+    /* Timings, to compare scanning speed between builds on a given tree */
+    fprintf(stderr, "%d entries, scan+commit %ld ms, reverse scan %ld ms",
+            entries, build_ms, total_ms - build_ms);
+    if (build_ms > 0)
+        fprintf(stderr, " (%ld files/s)", entries * 1000L / build_ms);
+    fprintf(stderr, "\n");
+
     return 0;
 }
 
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+#             __________               __   ___.
+#   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+#   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+#   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+#   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+#                     \/            \/     \/    \/            \/
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+# KIND, either express or implied.
+#
+# Makes a synthetic music library for timing the database tool, the same on
+# every run: artists/albums/tracks of silent MP3 files with ID3v2 tags, and
+# the .rockbox directory the tool wants.
+#
+#   mklibrary.py [-a ARTISTS] [-b ALBUMS] [-t TRACKS] [-f FRAMES] DIR
+#
+# To compare the scanning speed of two builds, configure each for the
+# database tool (type D). Only application targets, such as sdlapp, build
+# the scan's read-ahead; other targets give the plain scan to compare with.
+# Then, for each build:
+#
+#   mklibrary.py /tmp/lib
+#   sync; echo 3 | sudo tee /proc/sys/vm/drop_caches
+#   cd /tmp/lib && rm -f .rockbox/database_* && /path/to/database.<target>
+#
+# The tool prints the number of entries and the scan times. Dropping the
+# page cache first makes the scan read from the disk as it would for a new
+# library; without that, both builds read from memory.
+
+import argparse
+import os
+import struct
+
+GENRES = ["Rock", "Jazz", "Classical", "Electronic", "Folk", "Pop"]
+
+
+def syncsafe(n):
+    return bytes([(n >> 21) & 0x7f, (n >> 14) & 0x7f, (n >> 7) & 0x7f,
+                  n & 0x7f])
+
+
+def text_frame(frame_id, text):
+    data = b"\x01" + text.encode("utf-16")  # UTF-16 with BOM
+    return frame_id.encode() + struct.pack(">I", len(data)) + b"\0\0" + data
+
+
+def id3v2(tags, padding):
+    frames = b"".join(text_frame(k, v) for k, v in tags)
+    return b"ID3\x03\x00\x00" + syncsafe(len(frames) + padding) + frames + \
+        bytes(padding)
+
+
+def mp3(frames):
+    # MPEG-1 layer III, 128 kbit/s, 44.1 kHz: 417 byte frames
+    return (b"\xff\xfb\x90\x00" + bytes(413)) * frames
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Make a synthetic music library for the database tool.")
+    parser.add_argument("-a", "--artists", type=int, default=50)
+    parser.add_argument("-b", "--albums", type=int, default=4,
+                        help="albums per artist")
+    parser.add_argument("-t", "--tracks", type=int, default=12,
+                        help="tracks per album")
+    parser.add_argument("-f", "--frames", type=int, default=250,
+                        help="MPEG frames per track (about 0.4 KiB each)")
+    parser.add_argument("dir")
+    args = parser.parse_args()
+
+    os.makedirs(os.path.join(args.dir, ".rockbox"), exist_ok=True)
+    audio = mp3(args.frames)
+    count = 0
+
+    for a in range(args.artists):
+        artist = "Artist %03d" % a
+        for b in range(args.albums):
+            album = "Album %02d of %s" % (b, artist)
+            path = os.path.join(args.dir, "Music", artist, album)
+            os.makedirs(path, exist_ok=True)
+            for t in range(args.tracks):
+                title = "Track %02d of %s" % (t + 1, album)
+                tags = [("TIT2", title), ("TPE1", artist), ("TALB", album),
+                        ("TRCK", "%d/%d" % (t + 1, args.tracks)),
+                        ("TYER", str(1970 + (a + b) % 50)),
+                        ("TCON", GENRES[(a + b) % len(GENRES)])]
+                name = "%02d %s.mp3" % (t + 1, title)
+                with open(os.path.join(path, name), "wb") as f:
+                    f.write(id3v2(tags, 512) + audio)
+                count += 1
+
+    print("%d tracks in %s" % (count, args.dir))
+    return 0
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
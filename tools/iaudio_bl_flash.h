@@ -0,0 +1,3 @@
+#define BMPHEIGHT_iaudio_bl_flash 80
+#define BMPWIDTH_iaudio_bl_flash 128
+extern const unsigned short iaudio_bl_flash[];
@@ -517,6 +517,15 @@ ssize_t sim_read(int fildes, void *buf, size_t nbyte)
     return os_read(filestr->osfd, buf, nbyte);
 }
 
+ssize_t sim_readv(int fildes, const struct iovec *iov, int iovcnt)
+{
+    struct filestr_desc *filestr = get_filestr(fildes);
+    if (!filestr)
+        return -1;
+
+    return os_readv(filestr->osfd, iov, iovcnt);
+}
+
 ssize_t sim_write(int fildes, const void *buf, size_t nbyte)
 {
     struct filestr_desc *filestr = get_filestr(fildes);
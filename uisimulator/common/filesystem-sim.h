@@ -65,6 +65,7 @@ int     sim_ftruncate(int fildes, off_t length);
 int     sim_fsync(int fildes);
 off_t   sim_lseek(int fildes, off_t offset, int whence);
 ssize_t sim_read(int fildes, void *buf, size_t nbyte);
+ssize_t sim_readv(int fildes, const struct iovec *iov, int iovcnt);
 ssize_t sim_write(int fildes, const void *buf, size_t nbyte);
 int     sim_remove(const char *path);
 int     sim_rename(const char *old, const char *new);